@@ -0,0 +1,463 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include "global.h"
+#include "sampler.h"
+#include "mixpool.h"
+#include "rtcheck.h"
+
+// Synthetic store: one sample every SYNTH_STEP keys, filled across the rest.
+#define SYNTH_KEY0 21
+#define SYNTH_KEY1 108
+#define SYNTH_STEP 6
+#define SYNTH_SECONDS 12
+
+// Frames rendered per measurement. Voices must not run out within this.
+#define BENCH_FRAMES SAMPLE_RATE
+#define BENCH_MIN_ITERS 8
+#define BENCH_MAX_ITERS 100
+
+// Drift test: single against double precision mixing.
+#define DRIFT_VOICES 256
+#define DRIFT_BLOCKS 200
+#define DRIFT_FRAMES 256
+#define DRIFT_MAX_DBFS -90.0
+
+// Interpolation cost comparison.
+#define COST_VOICES 256
+#define COST_FRAMES 256
+
+#define BENCH_MIN_BUF 32
+#define BENCH_MAX_BUF 4096
+
+// Stop increasing polyphony once callbacks take this share of the period.
+#define BENCH_MAX_SHARE 4
+
+typedef struct {
+    int voices;                 // Voices actually rendered.
+    double nsPerVoiceFrame;
+    double meanShare;           // Mean callback time / buffer period.
+    double worstShare;          // Worst callback time / buffer period.
+} BenchResult;
+
+static float _outL[JACK_BUF_SIZE], _outR[JACK_BUF_SIZE];
+
+static double _now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// The instrument being measured.
+static Instrument *_inst()
+{
+    return atomic_load(&_sampler.active[0]);
+}
+
+// Create an instrument of decaying, slightly noisy tones spread across the
+// keyboard.
+static void _synth_store()
+{
+    Instrument *inst = &_sampler.slot[0];
+    SampleStore *ss = sstore_new();
+    int len = SYNTH_SECONDS * SAMPLE_RATE;
+    srand(1);
+
+    for (int key = SYNTH_KEY0; key <= SYNTH_KEY1; key += SYNTH_STEP) {
+        Sample *s = sstore_add_sample(ss, key, 0, 0);
+        double freq = 440 * pow(2, (key - 69) / 12.0);
+
+        s->len = len;
+        s->idx0 = 0;
+        s->rms = 1;
+        s->speed = 1;
+        s->data = sample_alloc_data(len);
+
+        for (int i = 0; i < len; ++i) {
+            double t = (double)i / SAMPLE_RATE;
+            double x = 12000 * exp(-t / 4) * sin(2 * M_PI * freq * t);
+            x += (rand() % 256) - 128;
+            s->data[2 * i] = (int16_t) x;
+            s->data[2 * i + 1] = (int16_t) (0.9 * x);
+        }
+        s->buf = sbuf_intern(s->data, len);
+        s->data = s->buf->data;
+    }
+
+    sstore_fill_samples(ss);
+    sstore_compute_rms(ss, 0.25);
+
+    inst->store = ss;
+    atomic_store(&inst->state, INST_READY);
+    for (int ch = 0; ch < MIDI_CHANNELS; ++ch) {
+        atomic_store(&_sampler.active[ch], inst);
+    }
+    inst->activeOn = MIDI_CHANNELS;
+    _sampler.state = SAMPLER_STATE_RUNNING;
+}
+
+// Stop every playing sample and release all keys.
+static void _stop_all()
+{
+    while (_sampler.voices.numPlaying) {
+        vpool_stop(&_sampler.voices, 0);
+    }
+    _inst()->numVoices = 0;
+    _inst()->numStolen = 0;
+    for (int key = 0; key < 128; ++key) {
+        ctrls_key_update(&_inst()->ctrls, key, 0);
+    }
+}
+
+static void _start_voices(int count)
+{
+    _stop_all();
+    for (int i = 0; i < count; ++i) {
+        int key = SYNTH_KEY0 + i % (SYNTH_KEY1 - SYNTH_KEY0 + 1);
+        sampler_note(0, key, 0.8);
+    }
+}
+
+static BenchResult _run(int voices, int nframes)
+{
+    BenchResult res;
+    int iters = BENCH_FRAMES / nframes;
+    if (iters < BENCH_MIN_ITERS) {
+        iters = BENCH_MIN_ITERS;
+    } else if (iters > BENCH_MAX_ITERS) {
+        iters = BENCH_MAX_ITERS;
+    }
+
+    _start_voices(voices);
+
+    // The first callback admits the new voices and warms the caches.
+    sampler_process(nframes, _outL, _outR);
+    res.voices = sampler_num_playing();
+
+    double total = 0, worst = 0;
+    for (int i = 0; i < iters; ++i) {
+        double t0 = _now_ns();
+        sampler_process(nframes, _outL, _outR);
+        double dt = _now_ns() - t0;
+        total += dt;
+        if (dt > worst) {
+            worst = dt;
+        }
+    }
+
+    double period = 1e9 * nframes / SAMPLE_RATE;
+    double mean = total / iters;
+
+    res.nsPerVoiceFrame = mean / (nframes * (double)(res.voices ? res.voices : 1));
+    res.meanShare = mean / period;
+    res.worstShare = worst / period;
+    return res;
+}
+
+// Find the largest polyphony whose worst callback meets the deadline, given
+// that lo meets it and hi doesn't.
+static int _max_polyphony(int lo, int hi, int nframes, double deadline)
+{
+    while (hi - lo > 1) {
+        int mid = (lo + hi) / 2;
+        if (_run(mid, nframes).worstShare <= deadline) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static double _rand(double lo, double hi)
+{
+    return lo + (hi - lo) * rand() / (double)RAND_MAX;
+}
+
+static double _dbfs(double x)
+{
+    return 20 * log10(x + 1e-30);
+}
+
+// Mix randomly pitched and amplified voices through both the single and
+// double precision kernels for many blocks, carrying voice state between
+// blocks as sampler_process does. Returns 0 if the largest difference
+// between the two buses is below DRIFT_MAX_DBFS.
+static int _drift(int quality)
+{
+    static double busD[2 * DRIFT_FRAMES], offset[DRIFT_FRAMES + 1];
+    static double keyUpD[DRIFT_FRAMES], fadeInD[DRIFT_FRAMES];
+    static double oneD[DRIFT_FRAMES];
+    static float busF[2 * DRIFT_FRAMES];
+    static float keyUpF[DRIFT_FRAMES], fadeInF[DRIFT_FRAMES];
+    static float oneF[DRIFT_FRAMES];
+
+    const int16_t *data[DRIFT_VOICES];
+    double idx[DRIFT_VOICES], speed[DRIFT_VOICES];
+    double ampD[DRIFT_VOICES], fadeD[DRIFT_VOICES];
+    float ampF[DRIFT_VOICES], fadeF[DRIFT_VOICES];
+
+    for (int i = 0; i < DRIFT_FRAMES; ++i) {
+        oneD[i] = oneF[i] = 1;
+    }
+
+    srand(2);
+    for (int v = 0; v < DRIFT_VOICES; ++v) {
+        int key = SYNTH_KEY0 + rand() % (SYNTH_KEY1 - SYNTH_KEY0 + 1);
+        Sample *s = sstore_sample(_inst()->store, key, 0, 0);
+        data[v] = s->data;
+        idx[v] = rand() % SAMPLE_RATE;
+        speed[v] = s->speed * _rand(0.5, 2);
+        ampD[v] = ampF[v] = _rand(5, 20) / DRIFT_VOICES;
+        fadeD[v] = fadeF[v] = 1;
+    }
+
+    double tauKeyUp = ctrls_value(&_inst()->ctrls, CTRL_TAU_KEY_UP);
+    double tauFadeIn = ctrls_value(&_inst()->ctrls, CTRL_TAU_FADE_IN);
+    double maxErr = 0, sumErr = 0, peak = 0;
+
+    for (int blk = 0; blk < DRIFT_BLOCKS; ++blk) {
+        memset(busD, 0, sizeof(busD));
+        memset(busF, 0, sizeof(busF));
+
+        double pb0 = _rand(0.95, 1.05);
+        double pbSlope = (_rand(0.95, 1.05) - pb0) / DRIFT_FRAMES;
+        double kD = 1, fD = 1;
+        float kF = 1, fF = 1;
+
+        for (int i = 0; i <= DRIFT_FRAMES; ++i) {
+            offset[i] = i * pb0 + pbSlope * 0.5 * i * (i - 1);
+            if (i < DRIFT_FRAMES) {
+                keyUpD[i] = (kD *= tauKeyUp);
+                fadeInD[i] = (fD *= tauFadeIn);
+                keyUpF[i] = (kF *= (float)tauKeyUp);
+                fadeInF[i] = (fF *= (float)tauFadeIn);
+            }
+        }
+
+        for (int v = 0; v < DRIFT_VOICES; ++v) {
+            // Half of the voices have been released.
+            bool up = v % 2;
+            InterpVoiceD vd = { data[v], idx[v], speed[v], ampD[v], fadeD[v],
+                offset, up ? keyUpD : oneD, fadeInD
+            };
+            interp_mix_d[quality] (&vd, DRIFT_FRAMES, busD);
+
+            InterpVoiceF vf = { data[v], idx[v], speed[v], ampF[v], fadeF[v],
+                offset, up ? keyUpF : oneF, fadeInF
+            };
+            interp_mix_f[quality] (&vf, DRIFT_FRAMES, busF);
+
+            idx[v] += speed[v] * offset[DRIFT_FRAMES];
+            if (up) {
+                ampD[v] *= keyUpD[DRIFT_FRAMES - 1];
+                ampF[v] *= keyUpF[DRIFT_FRAMES - 1];
+            }
+            fadeD[v] *= fadeInD[DRIFT_FRAMES - 1];
+            fadeF[v] *= fadeInF[DRIFT_FRAMES - 1];
+        }
+
+        for (int i = 0; i < 2 * DRIFT_FRAMES; ++i) {
+            double err = fabs(busD[i] - busF[i]) * INT16_SCALE;
+            maxErr = fmax(maxErr, err);
+            sumErr += err * err;
+            peak = fmax(peak, fabs(busD[i]) * INT16_SCALE);
+        }
+    }
+
+    double rmsErr = sqrt(sumErr / (2.0 * DRIFT_FRAMES * DRIFT_BLOCKS));
+
+    printf("\nSingle vs double precision %s mixing, %d voices, %d frames:\n",
+           interp_quality_name(quality), DRIFT_VOICES,
+           DRIFT_BLOCKS * DRIFT_FRAMES);
+    printf("    Peak level:   %7.1f dBFS\n", _dbfs(peak));
+    printf("    Max error:    %7.1f dBFS\n", _dbfs(maxErr));
+    printf("    RMS error:    %7.1f dBFS\n", _dbfs(rmsErr));
+
+    if (_dbfs(maxErr) > DRIFT_MAX_DBFS) {
+        printf("FAIL: error exceeds %.0f dBFS.\n", DRIFT_MAX_DBFS);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
+
+// Compare the cost of each interpolation quality at a typical load.
+static void _cost()
+{
+    double linear = 0;
+
+    printf("\nInterpolation cost, %d voices, %d frames:\n",
+           COST_VOICES, COST_FRAMES);
+    printf("%8s %14s %8s\n", "quality", "ns/voice-frame", "relative");
+
+    for (int q = 0; q < INTERP_COUNT; ++q) {
+        _inst()->interp = q;
+        BenchResult res = _run(COST_VOICES, COST_FRAMES);
+        if (q == INTERP_LINEAR) {
+            linear = res.nsPerVoiceFrame;
+        }
+        printf("%8s %14.2f %7.2fx\n", interp_quality_name(q),
+               res.nsPerVoiceFrame, res.nsPerVoiceFrame / linear);
+    }
+
+    _stop_all();
+}
+
+// Return 1 if the audio path made calls trapped in RT_CHECK builds.
+static int _rt_status()
+{
+    if (rtcheck_violations() == 0) {
+        return 0;
+    }
+    printf("\nReal-time violations: %ld\n", rtcheck_violations());
+    return 1;
+}
+
+static void _usage(char *prog)
+{
+    printf("Usage: %s [-d instrument-dir] [-t deadline] [-q quality] "
+           "[-j threads] [-z] [-e] [-c]\n", prog);
+    printf("    -d  Load a real instrument instead of synthetic samples.\n");
+    printf("    -t  Deadline as a share of the buffer period (default 0.5).\n");
+    printf("    -q  Interpolation: linear, cubic or sinc (default: the\n");
+    printf("        instrument's, or linear).\n");
+    printf("    -j  Mix threads (default: the instrument's, or 1).\n");
+    printf("    -z  Pack the samples, to measure decoding them.\n");
+    printf("    -e  Test single against double precision mixing and exit.\n");
+    printf("    -c  Compare the cost of each interpolation quality and exit.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    char *dir = NULL;
+    double deadline = 0.5;
+    int quality = -1, threads = 0;
+    bool drift = false, cost = false, pack = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:t:q:j:zech")) != -1) {
+        switch (opt) {
+        case 'd':
+            dir = optarg;
+            break;
+        case 't':
+            deadline = atof(optarg);
+            break;
+        case 'q':
+            quality = interp_quality_parse(optarg);
+            if (quality < 0) {
+                _usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 'z':
+            pack = true;
+            break;
+        case 'e':
+            drift = true;
+            break;
+        case 'c':
+            cost = true;
+            break;
+        default:
+            _usage(argv[0]);
+            return 1;
+        }
+    }
+
+    sampler_init();
+
+    if (drift) {
+        _synth_store();
+        int status = 0;
+        for (int q = 0; q < INTERP_COUNT; ++q) {
+            status |= _drift(q);
+        }
+        return status;
+    }
+
+    if (dir != NULL) {
+        const char *err = sampler_load(dir);
+        if (err != NULL) {
+            printf("%s\n", err);
+            return 1;
+        }
+    } else {
+        _synth_store();
+    }
+
+    if (pack) {
+        sstore_pack(_inst()->store);
+        _inst()->packed = true;
+        vpool_alloc_windows(&_sampler.voices);
+    }
+
+    // Measure without the instrument's polyphony limits.
+    _inst()->polyphony = MAX_POLYPHONY;
+    _inst()->keyPolyphony = 0;
+
+    if (threads > 0) {
+        mixpool_stop();
+        mixpool_start(threads, -1);
+    }
+
+    if (cost) {
+        _cost();
+        return _rt_status();
+    }
+
+    if (quality >= 0) {
+        _inst()->interp = quality;
+    }
+    printf("Interpolation: %s\n", interp_quality_name(_inst()->interp));
+
+    printf("\n%6s %6s %14s %8s %8s\n",
+           "frames", "voices", "ns/voice-frame", "mean", "worst");
+
+    int maxPoly[16];
+    int numBufs = 0;
+
+    for (int nframes = BENCH_MIN_BUF; nframes <= BENCH_MAX_BUF;
+         nframes *= 2, ++numBufs) {
+        int pass = 0, fail = MAX_POLYPHONY + 1;
+
+        for (int voices = 1; voices <= MAX_POLYPHONY; voices *= 2) {
+            BenchResult res = _run(voices, nframes);
+            printf("%6d %6d %14.2f %7.1f%% %7.1f%%\n",
+                   nframes, res.voices, res.nsPerVoiceFrame,
+                   100 * res.meanShare, 100 * res.worstShare);
+
+            if (res.worstShare <= deadline) {
+                pass = voices;
+            } else if (voices < fail) {
+                fail = voices;
+            }
+
+            if (res.meanShare > BENCH_MAX_SHARE) {
+                break;
+            }
+        }
+
+        if (fail > pass + 1 && fail <= MAX_POLYPHONY) {
+            pass = _max_polyphony(pass, fail, nframes, deadline);
+        }
+        maxPoly[numBufs] = pass;
+    }
+
+    printf("\nMaximum polyphony with worst case <= %.0f%% of period:\n",
+           100 * deadline);
+    for (int i = 0; i < numBufs; ++i) {
+        printf("%6d frames: %d\n", BENCH_MIN_BUF << i, maxPoly[i]);
+    }
+
+    _stop_all();
+    return _rt_status();
+}
@@ -1,5 +1,8 @@
 #include <stdio.h>
+#include <string.h>
 #include "confconfig.h"
+#include "interp.h"
+#include "voicepool.h"
 
 void confconfig_init()
 {
@@ -81,3 +84,151 @@ double confconfig_rms_time()
     printf("Config rms time: %f\n", val);
     return val;
 }
+
+int confconfig_interp()
+{
+    if (!_confConfig.keyFile) {
+        return INTERP_LINEAR;
+    }
+
+    int val = INTERP_LINEAR;
+    gchar *name = g_key_file_get_string(_confConfig.keyFile, "Config",
+                                        "Interpolation", NULL);
+    if (name != NULL) {
+        val = interp_quality_parse(name);
+        if (val < 0) {
+            printf("Unknown interpolation: %s\n", name);
+            val = INTERP_LINEAR;
+        }
+        g_free(name);
+    }
+    printf("Config interpolation: %s\n", interp_quality_name(val));
+    return val;
+}
+
+double confconfig_stream_preload()
+{
+    if (!_confConfig.keyFile) {
+        return 0;
+    }
+
+    double val = g_key_file_get_double(_confConfig.keyFile, "Config",
+                                       "StreamPreload", NULL);
+    if (val <= 0) {
+        val = 0;
+    }
+    printf("Config stream preload: %f\n", val);
+    return val;
+}
+
+bool confconfig_pack_samples()
+{
+    if (!_confConfig.keyFile) {
+        return false;
+    }
+
+    bool val = g_key_file_get_boolean(_confConfig.keyFile, "Config",
+                                      "PackSamples", NULL);
+    printf("Config pack samples: %s\n", val ? "on" : "off");
+    return val;
+}
+
+bool confconfig_bind_memory()
+{
+    if (!_confConfig.keyFile) {
+        return false;
+    }
+
+    bool val = g_key_file_get_boolean(_confConfig.keyFile, "Config",
+                                      "BindMemory", NULL);
+    printf("Config bind memory: %s\n", val ? "on" : "off");
+    return val;
+}
+
+int confconfig_polyphony()
+{
+    if (!_confConfig.keyFile) {
+        return MAX_POLYPHONY;
+    }
+
+    int val = g_key_file_get_integer(_confConfig.keyFile, "Config",
+                                     "Polyphony", NULL);
+    if (val <= 0 || val > MAX_POLYPHONY) {
+        val = MAX_POLYPHONY;
+    }
+    printf("Config polyphony: %i\n", val);
+    return val;
+}
+
+int confconfig_key_polyphony()
+{
+    if (!_confConfig.keyFile) {
+        return 0;
+    }
+
+    int val = g_key_file_get_integer(_confConfig.keyFile, "Config",
+                                     "KeyPolyphony", NULL);
+    if (val <= 0) {
+        val = 0;
+    }
+    printf("Config key polyphony: %i\n", val);
+    return val;
+}
+
+int confconfig_voice_steal()
+{
+    if (!_confConfig.keyFile) {
+        return VOICE_STEAL_OLDEST;
+    }
+
+    int val = VOICE_STEAL_OLDEST;
+    gchar *name = g_key_file_get_string(_confConfig.keyFile, "Config",
+                                        "VoiceSteal", NULL);
+    if (name != NULL) {
+        val = vpool_steal_parse(name);
+        if (val < 0) {
+            printf("Unknown voice steal policy: %s\n", name);
+            val = VOICE_STEAL_OLDEST;
+        }
+        g_free(name);
+    }
+    printf("Config voice steal: %s\n", vpool_steal_name(val));
+    return val;
+}
+
+int confconfig_mix_threads()
+{
+    if (!_confConfig.keyFile) {
+        return 1;
+    }
+
+    int val = g_key_file_get_integer(_confConfig.keyFile, "Config",
+                                     "MixThreads", NULL);
+    if (val < 1) {
+        val = 1;
+    }
+    printf("Config mix threads: %i\n", val);
+    return val;
+}
+
+int confconfig_midi_input()
+{
+    if (!_confConfig.keyFile) {
+        return MIDI_INPUT_ALSA;
+    }
+
+    int val = MIDI_INPUT_ALSA;
+    gchar *name = g_key_file_get_string(_confConfig.keyFile, "Config",
+                                        "MidiInput", NULL);
+    if (name != NULL) {
+        if (strcmp(name, "jack") == 0) {
+            val = MIDI_INPUT_JACK;
+        } else if (strcmp(name, "alsa") != 0) {
+            printf("Unknown midi input: %s\n", name);
+        }
+        g_free(name);
+    }
+    printf("Config midi input: %s\n", val == MIDI_INPUT_JACK ? "jack" :
+           "alsa");
+    return val;
+}
@@ -1,8 +1,13 @@
 #ifndef CONFCONFIG_H_
 #define CONFCONFIG_H_
 
+#include <stdbool.h>
 #include <glib.h>
 
+// Midi inputs, for confconfig_midi_input.
+#define MIDI_INPUT_ALSA 0       // An ALSA sequencer port.
+#define MIDI_INPUT_JACK 1       // A jack midi port.
+
 typedef struct {
     GKeyFile *keyFile;
 } ConfConfig;
@@ -18,5 +23,14 @@ int confconfig_rr_borrow();
 int confconfig_fake_rc_layer();
 double confconfig_crop_thresh();
 double confconfig_rms_time();
+int confconfig_interp();
+double confconfig_stream_preload();
+bool confconfig_pack_samples();
+bool confconfig_bind_memory();
+int confconfig_polyphony();
+int confconfig_key_polyphony();
+int confconfig_voice_steal();
+int confconfig_mix_threads();
+int confconfig_midi_input();
 
 #endif                          // CONFCONFIG_H_
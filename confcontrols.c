@@ -28,7 +28,7 @@ void confctrls_init() {
     _confCtrls.name[CTRL_PITCH_BEND] = "PitchBend";
 }
 
-static void _load(int id) {
+static void _load(Controls * c, int id) {
     char *name = _confCtrls.name[id];
     GError *err = NULL;
     int midi;
@@ -36,23 +36,23 @@ static void _load(int id) {
 
     midi = g_key_file_get_integer(_confCtrls.keyFile, name, "MIDI", &err);
     if(err == NULL) {
-        ctrls_connect_midi(id, midi);
+        ctrls_connect_midi(c, id, midi);
     }
 
     err = NULL;
     max = g_key_file_get_double(_confCtrls.keyFile, name, "Max", &err);
     if(err == NULL) {
-        ctrls_set_max(id, max);
+        ctrls_set_max(c, id, max);
     }
 
     err = NULL;
     val = g_key_file_get_double(_confCtrls.keyFile, name, "Value", &err);
     if(err == NULL) {
-        ctrls_update_direct(id, val);
+        ctrls_update_direct(c, id, val);
     }
 }
 
-void confctrls_load(char *path) {
+void confctrls_load(Controls * c, char *path) {
     confctrls_unload();
     _confCtrls.keyFile = g_key_file_new();
 
@@ -64,7 +64,7 @@ void confctrls_load(char *path) {
     }
 
     for(int id = 0; id < CTRL_COUNT; ++id) {
-        _load(id);
+        _load(c, id);
     }
 }
 
@@ -75,21 +75,21 @@ void confctrls_unload() {
     }
 }
 
-static void _save(int id) {
+static void _save(const Controls * c, int id) {
     char *name = _confCtrls.name[id];
     int midi;
     double max, val;
 
-    midi = ctrls_midi(id);
-    max = ctrls_max(id);
-    val = ctrls_value_gui(id);
+    midi = ctrls_midi(c, id);
+    max = ctrls_max(c, id);
+    val = ctrls_value_gui(c, id);
 
     g_key_file_set_integer(_confCtrls.keyFile, name, "MIDI", midi);
     g_key_file_set_double(_confCtrls.keyFile, name, "Max", max);
     g_key_file_set_double(_confCtrls.keyFile, name, "Value", val);
 }
 
-const char * confctrls_save(char *path) {
+const char * confctrls_save(const Controls * c, char *path) {
     if(_confCtrls.keyFile != NULL) {
         g_key_file_free(_confCtrls.keyFile);
         _confCtrls.keyFile = NULL;
@@ -98,7 +98,7 @@ const char * confctrls_save(char *path) {
     _confCtrls.keyFile = g_key_file_new();
 
     for(int id = 0; id < CTRL_COUNT; ++id) {
-        _save(id);
+        _save(c, id);
     }
 
     GError *err = NULL;
@@ -15,8 +15,8 @@ typedef struct {
 ConfCtrls _confCtrls;
 
 void confctrls_init();
-void confctrls_load(char *path);
+void confctrls_load(Controls * c, char *path);
 void confctrls_unload();
-const char *confctrls_save(char *path);
+const char *confctrls_save(const Controls * c, char *path);
 
 #endif                          // CONFCTRLS_H_
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include "confpresets.h"
+
+void confpresets_init()
+{
+    _confPresets.keyFile = NULL;
+}
+
+bool confpresets_load()
+{
+    confpresets_unload();
+    _confPresets.keyFile = g_key_file_new();
+
+    int status = g_key_file_load_from_file(_confPresets.keyFile,
+                                           "presets.conf", G_KEY_FILE_NONE,
+                                           NULL);
+    if (!status) {
+        confpresets_unload();
+        return false;
+    }
+    return true;
+}
+
+void confpresets_unload()
+{
+    if (_confPresets.keyFile != NULL) {
+        g_key_file_free(_confPresets.keyFile);
+        _confPresets.keyFile = NULL;
+    }
+}
+
+static void _group(int program, char *group, size_t size)
+{
+    snprintf(group, size, "%i", program);
+}
+
+static char *_get_string(int program, const char *key)
+{
+    if (!_confPresets.keyFile) {
+        return NULL;
+    }
+
+    char group[8];
+    _group(program, group, sizeof(group));
+    return g_key_file_get_string(_confPresets.keyFile, group, key, NULL);
+}
+
+char *confpresets_dir(int program)
+{
+    return _get_string(program, "Dir");
+}
+
+char *confpresets_controls(int program)
+{
+    return _get_string(program, "Controls");
+}
+
+int confpresets_channel(int program)
+{
+    if (!_confPresets.keyFile) {
+        return -1;
+    }
+
+    char group[8];
+    _group(program, group, sizeof(group));
+    int val = g_key_file_get_integer(_confPresets.keyFile, group, "Channel",
+                                     NULL);
+    if (val < 1 || val > 16) {
+        return -1;
+    }
+    return val - 1;
+}
+
+bool confpresets_channel_outputs()
+{
+    if (!_confPresets.keyFile) {
+        return false;
+    }
+
+    bool val = g_key_file_get_boolean(_confPresets.keyFile, "Sampler",
+                                      "ChannelOutputs", NULL);
+    printf("Presets channel outputs: %s\n", val ? "on" : "off");
+    return val;
+}
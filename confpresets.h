@@ -0,0 +1,51 @@
+#ifndef CONFPRESETS_H_
+#define CONFPRESETS_H_
+
+#include <stdbool.h>
+#include <glib.h>
+
+// ConfPresets: presets.conf maps midi programs to instruments. Each program
+// is a group named by its number, with the instrument directory, an optional
+// controls file applied on top of the instrument's own, and an optional midi
+// channel, 1-16, to make it active on when loaded:
+//
+//     [Sampler]
+//     ChannelOutputs=true
+//
+//     [0]
+//     Dir=../piano
+//     Controls=bright.conf
+//     Channel=1
+//
+// Paths are relative to the directory holding presets.conf.
+typedef struct {
+    GKeyFile *keyFile;
+} ConfPresets;
+
+// Global ConfPresets object.
+ConfPresets _confPresets;
+
+void confpresets_init();
+
+// confpresets_load: Load presets.conf from the working directory. Returns
+// false if there isn't one.
+bool confpresets_load();
+void confpresets_unload();
+
+// confpresets_dir: Return the instrument directory for a program, or NULL if
+// the program has no preset. Free with g_free.
+char *confpresets_dir(int program);
+
+// confpresets_controls: Return the controls file for a program, or NULL.
+// Free with g_free.
+char *confpresets_controls(int program);
+
+// confpresets_channel: Return the midi channel, 0-15, a program's preset is
+// made active on when loaded, or -1.
+int confpresets_channel(int program);
+
+// confpresets_channel_outputs: Return true if each midi channel has its own
+// jack outputs.
+bool confpresets_channel_outputs();
+
+#endif                          // CONFPRESETS_H_
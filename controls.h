@@ -36,55 +36,48 @@ typedef struct {
 
     double velocity[128];       // Committed key velocities.
     double _velocity[128];      // Uncommitted key velocities.
-
-    double pitchBendPrev;       // Keep for smoothing.
 } Controls;
 
-// There is only one, global controls object.
-Controls _ctrls;
-
 // Load default values for all of the controls.
-void ctrls_load_defaults();
+void ctrls_load_defaults(Controls * c);
 
 // Update the control directly, without applying min/max. The range of the
 // value will be unchecked.
-void ctrls_update_direct(int id, double value);
+void ctrls_update_direct(Controls * c, int id, double value);
 
 // Update a control from an input value ranging from 0-1.
-void ctrls_update(int id, double value);
+void ctrls_update(Controls * c, int id, double value);
 
 // Update a key velocity.
-void ctrls_key_update(int key, double velocity);
+void ctrls_key_update(Controls * c, int key, double velocity);
 
 // Processes a midi control message.
-void ctrls_midi_update(int control, double value);
+void ctrls_midi_update(Controls * c, int control, double value);
 
 // Commit values into the value array. This should only be called from one
 // thread. In our case, we'll only call it from the jack callback thread.
-void ctrls_commit();
+void ctrls_commit(Controls * c);
 
-double ctrls_value_gui(int id);
+double ctrls_value_gui(const Controls * c, int id);
 
 // Get a control value by it's id.
-int ctrls_midi(int id);
-double ctrls_value(int id);
-double ctrls_min(int id);
-double ctrls_max(int id);
+int ctrls_midi(const Controls * c, int id);
+double ctrls_value(const Controls * c, int id);
+double ctrls_min(const Controls * c, int id);
+double ctrls_max(const Controls * c, int id);
 
-void ctrls_set_max(int id, double value);
+void ctrls_set_max(Controls * c, int id, double value);
 
 // Get a key's current velocity. 0 means the key isn't pressed.
-double ctrls_key_velocity(int key);
-
-// Get the pitch-bend value from the previous commit.
-double ctrls_pitch_bend_prev();
+double ctrls_key_velocity(const Controls * c, int key);
 
 // Return the amplification multiplier for the given key, where vel is the key
 // velocity and rms is the sample's measured RMS value.
-double ctrls_sample_amp(int key, double vel, double rms);
+double ctrls_sample_amp(const Controls * c, int key, double vel,
+                        double rms);
 
-double ctrls_sample_pan(int key);       // TODO
+double ctrls_sample_pan(const Controls * c, int key);       // TODO
 
-void ctrls_connect_midi(int control, int midiChan);
+void ctrls_connect_midi(Controls * c, int control, int midiChan);
 
 #endif                          // CONTROLS_H_
@@ -0,0 +1,554 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "sampler.h"
+#include "confcontrols.h"
+#include "stats.h"
+
+// Headless sampler, controlled over a Unix domain socket. Clients send one
+// command per line, and every command is answered with any output lines
+// followed by "ok" or "error <message>". See _help. Loads run on their own
+// thread, so other clients are answered while one loads.
+
+#define DAEMON_MAX_CLIENTS 8
+#define DAEMON_LINE 1024
+
+typedef struct {
+    int fd;                     // -1 if unused.
+    FILE *out;
+    char line[DAEMON_LINE];
+    int len;
+    bool waiting;               // For its load to finish, and not read.
+} _Client;
+
+static _Client _clients[DAEMON_MAX_CLIENTS];
+static volatile sig_atomic_t _quit = 0;
+static volatile sig_atomic_t _dump = 0;
+static sigset_t _sigmask;            // Signal mask while polling.
+
+// The load in progress, if any.
+static struct {
+    bool busy;
+    pthread_t thread;
+    char *dir;
+    const char *err;
+    _Client *client;            // Waiting for the reply, or NULL.
+    int wakeFd[2];              // Written when the load finishes.
+} _load;
+
+static const char *_help[] = {
+    "load <instrument-dir>      While running, swaps instruments",
+    "unload",
+    "state",
+    "control <name> <value>     Set a control, e.g. control Amplify 0.5",
+    "control <cc> <value> [ch]  Send a midi control change, value 0-1",
+    "note <key> <vel> [ch]      Velocity 0-1, 0 to release",
+    "program <program> [ch]     Switch preset, 0-127",
+    "stats                      Callback stats, see README.md",
+    "stats reset",
+    "quit                       Stop the daemon",
+    "Midi channels [ch] are 1-16, default 1.",
+    NULL
+};
+
+static void _signal_handler(int sig)
+{
+    if (sig == SIGUSR1) {
+        _dump = 1;
+    } else {
+        _quit = 1;
+    }
+}
+
+// Handle signals only while polling, so they can't land on the sampler's
+// threads, which inherit the blocked mask.
+static void _signals()
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = _signal_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &set, &_sigmask);
+
+    // Clients that disconnect early are noticed on the next read.
+    signal(SIGPIPE, SIG_IGN);
+}
+
+// ----------------------------------------------------------------------------
+// Loading.
+// ----------------------------------------------------------------------------
+
+static void _reply(FILE * out, const char *err)
+{
+    if (err != NULL) {
+        fprintf(out, "error %s\n", err);
+    } else {
+        fprintf(out, "ok\n");
+    }
+    fflush(out);
+}
+
+static void *_load_thread(void *arg)
+{
+    _load.err = sampler_load(_load.dir);
+    char c = 0;
+    if (write(_load.wakeFd[1], &c, 1) < 0) {
+        perror("Daemon: write");
+    }
+    return NULL;
+}
+
+// Start loading dir on the load thread. The reply goes to client when it
+// finishes, or if client is NULL, errors are printed.
+static const char *_load_start(const char *dir, _Client * client)
+{
+    if (_load.busy) {
+        return "A load is in progress.";
+    }
+    _load.dir = strdup(dir);
+    _load.client = client;
+    if (pthread_create(&_load.thread, NULL, _load_thread, NULL) != 0) {
+        printf("Daemon: Failed to create load thread.\n");
+        exit(1);
+    }
+    _load.busy = true;
+    if (client != NULL) {
+        client->waiting = true;
+    }
+    return NULL;
+}
+
+// Wait for the load thread to finish, and return the load's error.
+static const char *_load_join()
+{
+    char c;
+    if (read(_load.wakeFd[0], &c, 1) < 0) {
+        perror("Daemon: read");
+    }
+    pthread_join(_load.thread, NULL);
+    free(_load.dir);
+    _load.busy = false;
+    return _load.err;
+}
+
+// ----------------------------------------------------------------------------
+// Commands.
+// ----------------------------------------------------------------------------
+
+static const char *_state_name(int state)
+{
+    switch (state) {
+    case SAMPLER_STATE_STOPPED:
+        return "stopped";
+    case SAMPLER_STATE_LOADING:
+        return "loading";
+    case SAMPLER_STATE_RUNNING:
+        return "running";
+    case SAMPLER_STATE_UNLOADING:
+        return "unloading";
+    }
+    return "unknown";
+}
+
+// Return the id of the named control, or -1.
+static int _control_id(const char *name)
+{
+    for (int i = 0; i < CTRL_COUNT; ++i) {
+        if (strcasecmp(name, _confCtrls.name[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Parse an optional midi channel, 1-16, into 0-15. Returns -1 if invalid.
+static int _channel(const char *arg)
+{
+    if (arg == NULL) {
+        return 0;
+    }
+    char *end;
+    long ch = strtol(arg, &end, 10);
+    if (*end != '\0' || ch < 1 || ch > MIDI_CHANNELS) {
+        return -1;
+    }
+    return ch - 1;
+}
+
+static const char *_cmd_control(const char *name, const char *arg,
+                                const char *chArg)
+{
+    if (name == NULL || arg == NULL) {
+        return "Usage: control <name|cc> <value> [channel]";
+    }
+    int ch = _channel(chArg);
+    if (ch < 0) {
+        return "Channel out of range.";
+    }
+
+    char *end;
+    double value = strtod(arg, &end);
+    if (*end != '\0') {
+        return "Invalid value.";
+    }
+
+    long cc = strtol(name, &end, 10);
+    if (*end == '\0') {
+        if (cc < 0 || cc > 127 || value < 0 || value > 1) {
+            return "Control or value out of range.";
+        }
+        if (sampler_state() != SAMPLER_STATE_RUNNING) {
+            return errBadState;
+        }
+        sampler_control(ch, cc, value);
+        return NULL;
+    }
+
+    int id = _control_id(name);
+    if (id < 0) {
+        return "Unknown control.";
+    }
+    ctrls_update_direct(sampler_controls(), id, value);
+    return NULL;
+}
+
+static const char *_cmd_program(const char *arg, const char *chArg)
+{
+    if (arg == NULL) {
+        return "Usage: program <program> [channel]";
+    }
+    int program = atoi(arg);
+    int ch = _channel(chArg);
+    if (program < 0 || program > 127 || ch < 0) {
+        return "Program or channel out of range.";
+    }
+    if (sampler_state() != SAMPLER_STATE_RUNNING) {
+        return errBadState;
+    }
+    sampler_program(ch, program);
+    return NULL;
+}
+
+static const char *_cmd_note(const char *keyArg, const char *velArg,
+                             const char *chArg)
+{
+    if (keyArg == NULL || velArg == NULL) {
+        return "Usage: note <key> <velocity> [channel]";
+    }
+    int key = atoi(keyArg);
+    double vel = atof(velArg);
+    int ch = _channel(chArg);
+    if (key < 0 || key > 127 || vel < 0 || vel > 1 || ch < 0) {
+        return "Key, velocity or channel out of range.";
+    }
+    if (sampler_state() != SAMPLER_STATE_RUNNING) {
+        return errBadState;
+    }
+    sampler_note(ch, key, vel);
+    return NULL;
+}
+
+// Run one command line from client c, writing the reply to its output. A
+// load is answered when it finishes.
+static void _command(char *line, _Client * c)
+{
+    FILE *out = c->out;
+    char *save;
+    char *cmd = strtok_r(line, " \t\r", &save);
+    char *arg1 = strtok_r(NULL, " \t\r", &save);
+    char *arg2 = strtok_r(NULL, " \t\r", &save);
+    char *arg3 = strtok_r(NULL, " \t\r", &save);
+    const char *err = NULL;
+
+    if (cmd == NULL) {
+        return;
+    } else if (strcmp(cmd, "load") == 0) {
+        if (arg1 == NULL) {
+            err = "Usage: load <instrument-dir>";
+        } else if ((err = _load_start(arg1, c)) == NULL) {
+            return;
+        }
+    } else if (strcmp(cmd, "unload") == 0) {
+        err = _load.busy ? "A load is in progress." : sampler_unload();
+    } else if (strcmp(cmd, "state") == 0) {
+        fprintf(out, "%s\n", _state_name(sampler_state()));
+    } else if (strcmp(cmd, "control") == 0) {
+        err = _cmd_control(arg1, arg2, arg3);
+    } else if (strcmp(cmd, "note") == 0) {
+        err = _cmd_note(arg1, arg2, arg3);
+    } else if (strcmp(cmd, "program") == 0) {
+        err = _cmd_program(arg1, arg2);
+    } else if (strcmp(cmd, "stats") == 0) {
+        if (arg1 != NULL && strcmp(arg1, "reset") == 0) {
+            stats_reset();
+        } else {
+            stats_dump(out);
+        }
+    } else if (strcmp(cmd, "quit") == 0) {
+        _quit = 1;
+    } else if (strcmp(cmd, "help") == 0) {
+        for (int i = 0; _help[i] != NULL; ++i) {
+            fprintf(out, "%s\n", _help[i]);
+        }
+    } else {
+        err = "Unknown command. Try help.";
+    }
+    _reply(out, err);
+}
+
+// ----------------------------------------------------------------------------
+// Socket.
+// ----------------------------------------------------------------------------
+
+static int _listen(const char *path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Daemon: Socket path is too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("Daemon: socket");
+        return -1;
+    }
+
+    // A socket left behind by a previous run is replaced.
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(fd, DAEMON_MAX_CLIENTS) != 0) {
+        perror("Daemon: bind");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void _accept(int listenFd)
+{
+    int fd = accept(listenFd, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+    for (int i = 0; i < DAEMON_MAX_CLIENTS; ++i) {
+        if (_clients[i].fd < 0) {
+            _clients[i].fd = fd;
+            _clients[i].out = fdopen(dup(fd), "w");
+            _clients[i].len = 0;
+            _clients[i].waiting = false;
+            return;
+        }
+    }
+    const char *msg = "error Too many clients.\n";
+    if (write(fd, msg, strlen(msg)) < 0) {
+        // Closing anyway.
+    }
+    close(fd);
+}
+
+static void _close(_Client * c)
+{
+    fclose(c->out);
+    close(c->fd);
+    c->fd = -1;
+}
+
+// Run each complete line read from a client, until one starts a load.
+static void _run(_Client * c)
+{
+    char *start = c->line;
+    char *nl;
+    while (!c->waiting &&
+           (nl = memchr(start, '\n', c->len - (start - c->line))) != NULL) {
+        *nl = '\0';
+        _command(start, c);
+        start = nl + 1;
+    }
+    c->len -= start - c->line;
+    memmove(c->line, start, c->len);
+}
+
+// Read from a client and run its lines.
+static void _read(_Client * c)
+{
+    int n = read(c->fd, c->line + c->len, DAEMON_LINE - 1 - c->len);
+    if (n <= 0) {
+        _close(c);
+        return;
+    }
+    c->len += n;
+    _run(c);
+
+    // A client waiting for a load may have a full buffer of lines to run.
+    if (!c->waiting && c->len == DAEMON_LINE - 1) {
+        fprintf(c->out, "error Line too long.\n");
+        _close(c);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// main
+// ----------------------------------------------------------------------------
+
+static void _usage(char *prog)
+{
+    printf("Usage: %s [-s socket] [instrument-dir]\n", prog);
+    printf("    -s  Control socket (default $XDG_RUNTIME_DIR/jlsampler.sock,"
+           " or /tmp).\n");
+}
+
+int main(int argc, char *argv[])
+{
+    char *sockPath = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:h")) != -1) {
+        switch (opt) {
+        case 's':
+            sockPath = optarg;
+            break;
+        default:
+            _usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind > 1) {
+        _usage(argv[0]);
+        return 1;
+    }
+
+    // Loading changes the working directory, so the socket path is made
+    // absolute to remove it on exit.
+    char path[PATH_MAX];
+    char cwd[PATH_MAX];
+    int len;
+    if (sockPath == NULL) {
+        const char *dir = getenv("XDG_RUNTIME_DIR");
+        len = snprintf(path, sizeof(path), "%s/jlsampler.sock",
+                       dir != NULL ? dir : "/tmp");
+    } else if (sockPath[0] == '/') {
+        len = snprintf(path, sizeof(path), "%s", sockPath);
+    } else if (getcwd(cwd, sizeof(cwd)) != NULL) {
+        len = snprintf(path, sizeof(path), "%s/%s", cwd, sockPath);
+    } else {
+        perror("Daemon: getcwd");
+        return 1;
+    }
+    if (len >= sizeof(path)) {
+        printf("Daemon: Socket path is too long.\n");
+        return 1;
+    }
+
+    _signals();
+
+    int listenFd = _listen(path);
+    if (listenFd < 0) {
+        return 1;
+    }
+    for (int i = 0; i < DAEMON_MAX_CLIENTS; ++i) {
+        _clients[i].fd = -1;
+    }
+
+    if (pipe2(_load.wakeFd, O_CLOEXEC) != 0) {
+        perror("Daemon: pipe");
+        return 1;
+    }
+
+    sampler_init();
+    sampler_init_jack();
+    printf("Listening on %s\n", path);
+
+    if (optind < argc) {
+        _load_start(argv[optind], NULL);
+    }
+
+    // Clients waiting for a load aren't polled, so their next commands wait
+    // in the socket.
+    struct pollfd fds[DAEMON_MAX_CLIENTS + 2];
+    while (!_quit) {
+        if (_dump) {
+            _dump = 0;
+            stats_dump(stdout);
+        }
+
+        fds[0].fd = listenFd;
+        fds[0].events = POLLIN;
+        fds[1].fd = _load.wakeFd[0];
+        fds[1].events = POLLIN;
+        for (int i = 0; i < DAEMON_MAX_CLIENTS; ++i) {
+            fds[i + 2].fd = _clients[i].waiting ? -1 : _clients[i].fd;
+            fds[i + 2].events = POLLIN;
+        }
+
+        if (ppoll(fds, DAEMON_MAX_CLIENTS + 2, NULL, &_sigmask) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Daemon: ppoll");
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) {
+            const char *err = _load_join();
+            _Client *c = _load.client;
+            if (c == NULL) {
+                if (err != NULL) {
+                    printf("%s\n", err);
+                }
+            } else {
+                c->waiting = false;
+                _reply(c->out, err);
+                _run(c);
+            }
+        }
+        for (int i = 0; i < DAEMON_MAX_CLIENTS; ++i) {
+            if (_clients[i].fd >= 0 && fds[i + 2].revents != 0) {
+                _read(&_clients[i]);
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            _accept(listenFd);
+        }
+    }
+
+    // Let a load finish before unloading.
+    if (_load.busy) {
+        _load_join();
+    }
+
+    for (int i = 0; i < DAEMON_MAX_CLIENTS; ++i) {
+        if (_clients[i].fd >= 0) {
+            _close(&_clients[i]);
+        }
+    }
+    close(listenFd);
+    unlink(path);
+
+    if (sampler_state() == SAMPLER_STATE_RUNNING) {
+        sampler_unload();
+    }
+    return 0;
+}
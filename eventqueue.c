@@ -0,0 +1,48 @@
+#include "eventqueue.h"
+#include "mem.h"
+
+struct EventQueue {
+    jack_ringbuffer_t *buf;
+};
+
+EventQueue *evq_new(int size)
+{
+    EventQueue *q = malloc_exit(sizeof(EventQueue));
+    // A jack ring buffer holds one byte less than it's size, so we need room
+    // for an extra event to store `size` events.
+    q->buf = jack_ringbuffer_create(sizeof(Event) * (size + 1));
+    return q;
+}
+
+void evq_free(EventQueue * q)
+{
+    jack_ringbuffer_free(q->buf);
+    free(q);
+}
+
+bool evq_put(EventQueue * q, const Event * ev)
+{
+    if (jack_ringbuffer_write_space(q->buf) < sizeof(Event)) {
+        return false;
+    }
+    jack_ringbuffer_write(q->buf, (const char *)ev, sizeof(Event));
+    return true;
+}
+
+bool evq_peek(EventQueue * q, Event * ev)
+{
+    if (jack_ringbuffer_read_space(q->buf) < sizeof(Event)) {
+        return false;
+    }
+    jack_ringbuffer_peek(q->buf, (char *)ev, sizeof(Event));
+    return true;
+}
+
+bool evq_get(EventQueue * q, Event * ev)
+{
+    if (!evq_peek(q, ev)) {
+        return false;
+    }
+    jack_ringbuffer_read_advance(q->buf, sizeof(Event));
+    return true;
+}
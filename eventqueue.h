@@ -0,0 +1,45 @@
+#ifndef EVENTQUEUE_H_
+#define EVENTQUEUE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <jack/ringbuffer.h>
+
+#define EVENT_NOTE 0            // param is the key, value the velocity.
+#define EVENT_CONTROL 1         // param is the midi control, value 0-1.
+#define EVENT_PITCH_BEND 2      // value runs from -1 to 1.
+#define EVENT_PROGRAM 3         // param is the midi program.
+
+// Event: A midi event for the audio thread, timestamped with the jack frame
+// time it should be played at.
+typedef struct {
+    uint32_t frame;             // Frame time of the event.
+    int channel;                // Midi channel, 0-15.
+    int type;
+    int param;
+    double value;
+} Event;
+
+// EventQueue: A lock-free queue of events from a single producer thread to
+// a single consumer thread.
+typedef struct EventQueue EventQueue;
+
+// evq_new: Create a new EventQueue with room for size events.
+EventQueue *evq_new(int size);
+
+// evq_free: Free the queue.
+void evq_free(EventQueue * q);
+
+// evq_put: Add an event to the queue. The return value is true if the put was
+// successful, and false if there wasn't room.
+bool evq_put(EventQueue * q, const Event * ev);
+
+// evq_peek: Copy the next event into ev without removing it. Returns false if
+// the queue is empty.
+bool evq_peek(EventQueue * q, Event * ev);
+
+// evq_get: Remove the next event from the queue and copy it into ev. Returns
+// false if the queue is empty.
+bool evq_get(EventQueue * q, Event * ev);
+
+#endif                          // EVENTQUEUE_H_
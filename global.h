@@ -2,12 +2,24 @@
 #define GLOBAL_H_
 
 #define JACK_BUF_SIZE 16384
-#define RING_BUF_SIZE 2048
+#define MAX_VOICES 2048        // Maximum number of playing samples.
+#define MAX_POLYPHONY 1024      // Leaves free voices for stolen voices' fades.
+#define EVENT_BUF_SIZE 4096     // Midi events queued for the audio thread.
 #define INT16_SCALE 3.0517578125e-05    // For scaling int16 values.
 #define SAMPLE_RATE 48000       // Fixed sample rate.
 #define MIN_AMP 1e-5            // Minimum amplification before stopping play.
+#define SAMPLE_PAD 16           // Zero frames before and after sample data.
+#define MIDI_CHANNELS 16
 
 #define MAX_LAYERS 128
 #define MAX_VARS 128
 
+// The mix bus, voice gains and interpolation are double precision unless
+// built with FLOAT_BUS defined (make FLOAT_BUS=1).
+#ifdef FLOAT_BUS
+typedef float mix_t;
+#else
+typedef double mix_t;
+#endif
+
 #endif                          // GLOBAL_H_
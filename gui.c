@@ -1,7 +1,10 @@
 #include <math.h>
 #include <pthread.h>
+#include <signal.h>
 #include <x86intrin.h>
+#include <glib-unix.h>
 #include "sampler.h"
+#include "stats.h"
 #include "gui.h"
 
 static void alertErr(const char *msg) {
@@ -18,20 +21,27 @@ static void alertErr(const char *msg) {
 
 static void _gui_update_state()
 {
-    // fileChooser.
+    // fileChooser. While running, the chosen instrument can be swapped in.
     gtk_widget_set_sensitive(_gui.fileChooser,
-                             _gui.state == SAMPLER_STATE_STOPPED);
+                             _gui.state == SAMPLER_STATE_STOPPED ||
+                             _gui.state == SAMPLER_STATE_RUNNING);
+
+    // btnSwap.
+    gtk_widget_set_sensitive(_gui.btnSwap,
+                             _gui.state == SAMPLER_STATE_RUNNING &&
+                             !_gui.swapping);
 
     // toggleRun.
     gtk_widget_set_sensitive(_gui.toggleRun,
-                             _gui.state == SAMPLER_STATE_STOPPED ||
-                             _gui.state == SAMPLER_STATE_RUNNING);
+                             (_gui.state == SAMPLER_STATE_STOPPED ||
+                              _gui.state == SAMPLER_STATE_RUNNING) &&
+                             !_gui.swapping);
     gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(_gui.toggleRun),
                                  _gui.state == SAMPLER_STATE_RUNNING);
 
     // spinWorking.
     if (_gui.state == SAMPLER_STATE_LOADING ||
-        _gui.state == SAMPLER_STATE_UNLOADING) {
+        _gui.state == SAMPLER_STATE_UNLOADING || _gui.swapping) {
         gtk_spinner_start(GTK_SPINNER(_gui.spinWorking));
     } else {
         gtk_spinner_stop(GTK_SPINNER(_gui.spinWorking));
@@ -100,6 +110,59 @@ static void gui_load()
     g_timeout_add(128, _loading_timer_cb, NULL);
 }
 
+// ----------------------------------------------------------------------------
+// gui_swap
+// ----------------------------------------------------------------------------
+
+static gboolean _swapping_timer_cb(gpointer data)
+{
+    if (_gui.swapping) {
+        return G_SOURCE_CONTINUE;
+    }
+
+    g_free(_gui.loadPath);
+    _gui.loadPath = NULL;
+    _gui_update_state();
+
+    if(_gui.errMsg != NULL) {
+        alertErr(_gui.errMsg);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static void *_swap_thread()
+{
+    _gui.errMsg = sampler_load(_gui.loadPath);
+    _gui.swapping = false;
+    return NULL;
+}
+
+// Load the chosen instrument while the current one keeps playing.
+static void gui_swap()
+{
+    if (_gui.state != SAMPLER_STATE_RUNNING || _gui.swapping) {
+        return;
+    }
+
+    _gui.swapping = true;
+    _gui_update_state();
+
+    // Load samples in background thread.
+    _gui.loadPath =
+        gtk_file_chooser_get_current_folder(GTK_FILE_CHOOSER
+                                            (_gui.fileChooser));
+
+    pthread_t thread;
+    int status = pthread_create(&thread, NULL, _swap_thread, NULL);
+    if (status != 0) {
+        printf("Failed to create loading thread.\n");
+        exit(1);
+    }
+    // Start a timer to check on progress.
+    g_timeout_add(128, _swapping_timer_cb, NULL);
+}
+
 // ----------------------------------------------------------------------------
 // gui_unload
 // ----------------------------------------------------------------------------
@@ -162,6 +225,11 @@ static void toggleRun(void *button, void *data)
     }
 }
 
+static void swap(void *button, void *data)
+{
+    gui_swap();
+}
+
 static void saveCtrls(void *btn, void *data) {
     GtkWidget *dialog;
     GtkFileChooser *chooser;
@@ -220,25 +288,49 @@ static void loadCtrls(void *btn, void *data) {
 }
 
 
+// Show the progress of loading samples in place of the callback stats.
+// Returns false if nothing is loading.
+static bool _show_load_progress()
+{
+    StatsSummary stats;
+    stats_summary(&stats);
+    if (!stats.loading ||
+        (_gui.state != SAMPLER_STATE_LOADING && !_gui.swapping)) {
+        return false;
+    }
+
+    snprintf(_gui.loadBuf, sizeof(_gui.loadBuf),
+             "Loading %i / %i files  %.0f / %.0f MB  %.1f MB/s",
+             stats.loadFilesDone, stats.loadFiles, stats.loadBytesDone / 1e6,
+             stats.loadBytes / 1e6, stats.loadRate / 1e6);
+    gtk_label_set_text(GTK_LABEL(_gui.lblLoad), _gui.loadBuf);
+    return true;
+}
+
 static gboolean _sampler_state_cb(gpointer data)
 {
+    bool loading = _show_load_progress();
     if (_gui.state != SAMPLER_STATE_RUNNING) {
         return G_SOURCE_CONTINUE;
     }
 
+    // The controls of the active instrument, which change on a swap.
+    Controls *c = sampler_controls();
     for (int i = 0; i < CTRL_COUNT; ++i) {
         if (_gui.adjSlider[i] == NULL) {
             continue;
         }
         if (i == CTRL_PITCH_BEND) {
-            gtk_adjustment_set_upper(_gui.adjSlider[i], ctrls_max(i));
-            gtk_adjustment_set_lower(_gui.adjSlider[i], -ctrls_max(i));
-            gtk_adjustment_set_value(_gui.adjSlider[i], ctrls_value_gui(i));
+            gtk_adjustment_set_upper(_gui.adjSlider[i], ctrls_max(c, i));
+            gtk_adjustment_set_lower(_gui.adjSlider[i], -ctrls_max(c, i));
+            gtk_adjustment_set_value(_gui.adjSlider[i],
+                                     ctrls_value_gui(c, i));
         } else {
-            gtk_adjustment_set_upper(_gui.adjSlider[i], ctrls_max(i));
-            gtk_adjustment_set_lower(_gui.adjSlider[i], ctrls_min(i));
-            gtk_adjustment_set_value(_gui.adjSlider[i], ctrls_value_gui(i));
-            gtk_adjustment_set_value(_gui.adjMidi[i], ctrls_midi(i));
+            gtk_adjustment_set_upper(_gui.adjSlider[i], ctrls_max(c, i));
+            gtk_adjustment_set_lower(_gui.adjSlider[i], ctrls_min(c, i));
+            gtk_adjustment_set_value(_gui.adjSlider[i],
+                                     ctrls_value_gui(c, i));
+            gtk_adjustment_set_value(_gui.adjMidi[i], ctrls_midi(c, i));
         }
     }
 
@@ -256,22 +348,43 @@ static gboolean _sampler_state_cb(gpointer data)
     sprintf(_gui.numPlayingBuf, "%d", sampler_num_playing());
     gtk_label_set_text(GTK_LABEL(_gui.lblNumPlaying), _gui.numPlayingBuf);
 
+    // Callback time as a percentage of the period.
+    if (loading) {
+        return G_SOURCE_CONTINUE;
+    }
+    StatsSummary stats;
+    stats_summary(&stats);
+    snprintf(_gui.loadBuf, sizeof(_gui.loadBuf),
+             "p50 %.1f%%  p99 %.1f%%  max %.1f%%  xruns %lu",
+             100 * stats.p50, 100 * stats.p99, 100 * stats.max, stats.xruns);
+    gtk_label_set_text(GTK_LABEL(_gui.lblLoad), _gui.loadBuf);
+
+    return G_SOURCE_CONTINUE;
+}
+
+// Write the callback stats to stdout on SIGUSR1.
+static gboolean _dump_stats_cb(gpointer data)
+{
+    stats_dump(stdout);
     return G_SOURCE_CONTINUE;
 }
 
 static void _slider_changed_cb(void *adj, void *data)
 {
-    ctrls_update_direct((uintptr_t) data, gtk_adjustment_get_value(adj));
+    ctrls_update_direct(sampler_controls(), (uintptr_t) data,
+                        gtk_adjustment_get_value(adj));
 }
 
 static void _midi_changed_cb(void *adj, void *data)
 {
-    ctrls_connect_midi((uintptr_t) data, gtk_adjustment_get_value(adj));
+    ctrls_connect_midi(sampler_controls(), (uintptr_t) data,
+                       gtk_adjustment_get_value(adj));
 }
 
 static void _max_changed_cb(void *adj, void *data)
 {
-    ctrls_set_max((uintptr_t) data, gtk_adjustment_get_value(adj));
+    ctrls_set_max(sampler_controls(), (uintptr_t) data,
+                  gtk_adjustment_get_value(adj));
 }
 
 // ----------------------------------------------------------------------------
@@ -285,6 +398,7 @@ void gui_init()
     _gui.winMain = NULL;
     _gui.fileChooser = NULL;
     _gui.toggleRun = NULL;
+    _gui.btnSwap = NULL;
     _gui.spinWorking = NULL;
     _gui.boxCtrls = NULL;
 
@@ -315,11 +429,13 @@ static void _get_controls()
     _gui.winMain = _widget("winMain");
     _gui.fileChooser = _widget("fileChooser");
     _gui.toggleRun = _widget("toggleRun");
+    _gui.btnSwap = _widget("btnSwap");
     _gui.spinWorking = _widget("spinWorking");
 
     _gui.btnSaveCtrls = _widget("btnSaveCtrls");
     _gui.btnLoadCtrls = _widget("btnLoadCtrls");
     _gui.lblNumPlaying = _widget("lblNumPlaying");
+    _gui.lblLoad = _widget("lblLoad");
 
     _gui.levelL = GTK_LEVEL_BAR(_widget("levelL"));
     _gui.levelR = GTK_LEVEL_BAR(_widget("levelR"));
@@ -383,7 +499,8 @@ static void _get_controls()
         }
         // Set initial max spinner values.
         if (_gui.adjMax[i] != NULL) {
-            gtk_adjustment_set_value(_gui.adjMax[i], ctrls_max(i));
+            gtk_adjustment_set_value(_gui.adjMax[i],
+                                     ctrls_max(sampler_controls(), i));
         }
     }
 }
@@ -392,6 +509,7 @@ static void _connect_callbacks()
 {
     g_signal_connect(_gui.winMain, "destroy", gtk_main_quit, NULL);
     g_signal_connect(_gui.toggleRun, "toggled", G_CALLBACK(toggleRun), NULL);
+    g_signal_connect(_gui.btnSwap, "clicked", G_CALLBACK(swap), NULL);
 
     g_signal_connect(_gui.btnSaveCtrls,
                      "clicked", G_CALLBACK(saveCtrls), NULL);
@@ -423,13 +541,16 @@ static void _connect_callbacks()
 
     // Run the sampler state callback function indefinitely.
     g_timeout_add(128, _sampler_state_cb, NULL);
+    g_unix_signal_add(SIGUSR1, _dump_stats_cb, NULL);
 }
 
 void gui_run(int argc, char *argv[])
 {
     sampler_init();
+    sampler_init_jack();
 
     _gui.state = SAMPLER_STATE_STOPPED;
+    _gui.swapping = false;
 
     gtk_init(&argc, &argv);
 
@@ -1,10 +1,12 @@
 #ifndef GUI_H_
 #define GUI_H_
+#include <stdbool.h>
 #include <gtk/gtk.h>
 #include "controls.h"
 
 typedef struct {
     int state;
+    bool swapping;              // Loading the next instrument while running.
     char *loadPath;
     const char *errMsg; // From the sampler load/unload.
 
@@ -13,13 +15,16 @@ typedef struct {
 
     GtkWidget *fileChooser;
     GtkWidget *toggleRun;
+    GtkWidget *btnSwap;
     GtkWidget *spinWorking;
 
     GtkWidget *btnSaveCtrls;
     GtkWidget *btnLoadCtrls;
     GtkWidget *lblNumPlaying;
+    GtkWidget *lblLoad;
 
     char numPlayingBuf[32];     // Larger than necessary.
+    char loadBuf[128];
 
     GtkLevelBar *levelL, *levelR, *levelLSat, *levelRSat;
 
@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "global.h"
+#include "instrument.h"
+#include "confconfig.h"
+#include "conftuning.h"
+#include "confcontrols.h"
+#include "voicepool.h"
+#include "samplemem.h"
+
+void inst_init(Instrument * inst)
+{
+    atomic_store(&inst->state, INST_FREE);
+    inst->dir = NULL;
+    inst->preset = false;
+    inst->store = NULL;
+    inst->cache.base = NULL;
+    inst->cache.size = 0;
+    inst->cache.mem = NULL;
+    inst->region = NULL;
+    inst->packed = false;
+    inst->source = NULL;
+    atomic_store(&inst->sharers, 0);
+    ctrls_load_defaults(&inst->ctrls);
+
+    inst->interp = INTERP_LINEAR;
+    inst->polyphony = MAX_POLYPHONY;
+    inst->keyPolyphony = 0;
+    inst->voiceSteal = VOICE_STEAL_OLDEST;
+    inst->mixThreads = 1;
+    inst->midiInput = MIDI_INPUT_ALSA;
+
+    inst->activeOn = 0;
+    inst->channels = 0;
+    inst->numVoices = 0;
+    inst->numStolen = 0;
+    atomic_store(&inst->drained, false);
+    atomic_store(&inst->kill, false);
+}
+
+// ----------------------------------------------------------------------------
+// inst_load
+// ----------------------------------------------------------------------------
+
+// Load the samples from the samples directory and process them. If w isn't
+// NULL, the data is written to it instead of kept. Called from the
+// instrument directory.
+static const char *_load_samples(SampleStore * ss, ScacheWriter * w)
+{
+    // Change into sample directory to load samples.
+    if (chdir("./samples") != 0) {
+        printf("Failed to change into samples directory.\n");
+        return errBadDir;
+    }
+    // Load samples using file info. Each sample is cropped and its RMS
+    // computed as it's loaded, and the fake RC layer filtered. Borrowed and
+    // filled samples are copies, and keep the values of the sample they were
+    // copied from.
+    double th = confconfig_crop_thresh();
+    double dt = confconfig_rms_time();
+    printf("Loading samples, crop th = %f, RMS dt = %f...\n", th, dt);
+    sstore_load(ss, th, dt, confconfig_fake_rc_layer(), w);
+
+    // Change back to sampler directory.
+    if (chdir("../") != 0) {
+        printf("Warning: Failed to change out of sample directory.");
+    }
+
+    // Borrow samples.
+    printf("Borrowing samples +/- %i...\n", confconfig_rr_borrow());
+    sstore_borrow_samples(ss, confconfig_rr_borrow());
+
+    // Fill samples.
+    printf("Filling samples...\n");
+    sstore_fill_samples(ss);
+
+    return NULL;
+}
+
+// Load the sample store, from the cache if it is up to date.
+static const char *_load_store(Instrument * inst, bool jack)
+{
+    // Samples are streamed from the cache when playing through jack with a
+    // preload time set, unless they're packed. Otherwise, through jack, the
+    // cached data is copied into sample memory, like loaded samples. Offline,
+    // the cache is mapped and pages are faulted in as needed. Packed samples
+    // are read once from the mapping, so it isn't copied either.
+    bool packed = confconfig_pack_samples();
+    double preload = confconfig_stream_preload();
+    bool streaming = preload > 0 && jack && !packed;
+    bool copy = jack && !streaming && !packed;
+
+    // Sample data and packs are bound to the audio thread's node while this
+    // store loads.
+    smem_bind(confconfig_bind_memory());
+
+    // Use the sample cache if it is up to date. Otherwise the samples are
+    // loaded and processed into a new cache one at a time, so they're never
+    // all in memory, and the new cache is used like an old one.
+    uint64_t fingerprint = scache_fingerprint();
+    bool loaded = scache_load(inst->store, &inst->cache, SCACHE_FILE,
+                              fingerprint, copy);
+    if (loaded) {
+        printf("Loaded sample cache: %s\n", SCACHE_FILE);
+    } else {
+        ScacheWriter w;
+        if (scache_writer_open(&w, SCACHE_FILE)) {
+            const char *err = _load_samples(inst->store, &w);
+            bool ok = scache_writer_close(&w, err == NULL ? inst->store :
+                                          NULL, SCACHE_FILE, fingerprint);
+            sstore_free_data(inst->store);
+            if (err != NULL) {
+                smem_bind(false);
+                return err;
+            }
+            loaded = ok && scache_load(inst->store, &inst->cache,
+                                       SCACHE_FILE, fingerprint, copy);
+        }
+    }
+
+    // Without a cache, the samples have to be held in memory.
+    if (!loaded) {
+        printf("No sample cache, loading samples into memory.\n");
+        streaming = false;
+        const char *err = _load_samples(inst->store, NULL);
+        if (err != NULL) {
+            smem_bind(false);
+            return err;
+        }
+    }
+
+    // The cache isn't needed once the samples are packed.
+    if (packed) {
+        printf("Packing samples...\n");
+        sstore_pack(inst->store);
+        scache_free(&inst->cache);
+        inst->packed = true;
+    }
+    smem_bind(false);
+
+    if (streaming) {
+        stream_start();
+        inst->region = stream_region_new(inst->cache.base, inst->cache.size,
+                                         preload, inst->store);
+    }
+    return NULL;
+}
+
+const char *inst_load(Instrument * inst, char *dir, bool jack,
+                      Instrument * share)
+{
+    atomic_store(&inst->state, INST_LOADING);
+
+    // Attempt to change into the given directory.
+    if (chdir(dir) != 0) {
+        printf("Failed to change into directory: %s\n", dir);
+        atomic_store(&inst->state, INST_FREE);
+        return errBadDir;
+    }
+    inst->dir = getcwd(NULL, 0);
+
+    // Load control defaults.
+    ctrls_load_defaults(&inst->ctrls);
+
+    // Load config files.
+    confconfig_load();
+    conftuning_load();
+    confctrls_load(&inst->ctrls, "controls.conf");
+
+    const char *err = NULL;
+    if (share != NULL) {
+        printf("Sharing samples with another instrument slot.\n");
+        inst->source = share;
+        inst->store = share->store;
+        inst->region = share->region;
+        inst->packed = share->packed;
+    } else {
+        inst->store = sstore_new();
+        err = _load_store(inst, jack);
+    }
+
+    // Interpolation quality, polyphony, mix threads and midi input.
+    inst->interp = confconfig_interp();
+    inst->polyphony = confconfig_polyphony();
+    inst->keyPolyphony = confconfig_key_polyphony();
+    inst->voiceSteal = confconfig_voice_steal();
+    inst->mixThreads = confconfig_mix_threads();
+    inst->midiInput = confconfig_midi_input();
+
+    // Unload config files.
+    confconfig_unload();
+    conftuning_unload();
+    confctrls_unload();
+
+    if (err != NULL) {
+        inst_free(inst);
+        return err;
+    }
+
+    inst->activeOn = 0;
+    inst->channels = 0;
+    inst->numVoices = 0;
+    inst->numStolen = 0;
+    atomic_store(&inst->drained, false);
+    atomic_store(&inst->kill, false);
+    atomic_store(&inst->state, INST_READY);
+    return NULL;
+}
+
+// ----------------------------------------------------------------------------
+// inst_free
+// ----------------------------------------------------------------------------
+
+void inst_free(Instrument * inst)
+{
+    if (inst->source != NULL) {
+        atomic_fetch_sub(&inst->source->sharers, 1);
+        inst->source = NULL;
+    } else {
+        stream_region_free(inst->region);
+        printf("Freeing sample memory...\n");
+        sstore_free(inst->store);
+        scache_free(&inst->cache);
+    }
+    inst->region = NULL;
+    inst->packed = false;
+    inst->store = NULL;
+
+    free(inst->dir);
+    inst->dir = NULL;
+    inst->preset = false;
+
+    atomic_store(&inst->state, INST_FREE);
+}
+
+// ----------------------------------------------------------------------------
+// inst_compute_ramps
+// ----------------------------------------------------------------------------
+
+void inst_compute_ramps(Instrument * inst, int nframes)
+{
+    InterpRamps *r = &inst->ramps;
+    double pitchBend = ctrls_value(&inst->ctrls, CTRL_PITCH_BEND);
+    mix_t tauKeyUp = ctrls_value(&inst->ctrls, CTRL_TAU_KEY_UP);
+    mix_t tauFadeIn = ctrls_value(&inst->ctrls, CTRL_TAU_FADE_IN);
+    mix_t keyUp = 1, fadeIn = 1;
+
+    for (int i = 0; i <= nframes; ++i) {
+        // Pitch-bend only changes between events, so it's constant here.
+        r->offset[i] = i * pitchBend;
+
+        keyUp *= tauKeyUp;
+        fadeIn *= tauFadeIn;
+        r->keyUp[i] = keyUp;
+        r->fadeIn[i] = fadeIn;
+    }
+}
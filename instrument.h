@@ -0,0 +1,85 @@
+#ifndef INSTRUMENT_H_
+#define INSTRUMENT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "controls.h"
+#include "interp.h"
+#include "sample.h"
+#include "samplecache.h"
+#include "stream.h"
+
+// Instrument slot states. Only a READY instrument can be made active.
+#define INST_FREE 0             // Nothing loaded.
+#define INST_LOADING 1          // Being loaded by a non-RT thread.
+#define INST_READY 2            // Loaded, and possibly active.
+#define INST_RETIRED 3          // Swapped out, freed once its voices finish.
+
+const char *errBadDir;
+
+typedef struct Instrument Instrument;
+
+// Instrument: Everything loaded from an instrument directory. Instruments
+// live in fixed slots that are reused, so a stale pointer never points at
+// freed memory. The audio thread only reads an instrument's store and
+// parameters, and owns its controls, ramps and voice count.
+//
+// Instruments loaded from the same directory share their samples: the first
+// one owns the store, and the others point at it through source. The owner
+// isn't freed while it has sharers.
+struct Instrument {
+    _Atomic int state;
+    char *dir;                  // Absolute path, or NULL.
+    bool preset;                // Kept loaded when swapped out.
+
+    SampleStore *store;
+    ScacheMap cache;            // The mapped sample cache, if any.
+    StreamRegion *region;       // NULL unless streaming.
+    bool packed;                // Samples are packed, see sstore_pack.
+    Instrument *source;         // The owner of store, or NULL if this is.
+    _Atomic int sharers;        // Instruments using this one's store.
+
+    Controls ctrls;
+    InterpRamps ramps;          // For the current block.
+
+    // Parameters from config.conf.
+    int interp;
+    int polyphony;
+    int keyPolyphony;           // 0 for no limit.
+    int voiceSteal;
+    int mixThreads;
+    int midiInput;
+
+    // Audio thread.
+    int activeOn;               // Midi channels it's active on.
+    uint16_t channels;          // Midi channels that started its voices.
+    int numVoices;              // Voices playing from the store.
+    int numStolen;              // Of those, voices fading out.
+    _Atomic bool drained;       // Inactive with no voices left.
+    _Atomic bool kill;          // Set by a loader to fade out its voices.
+};
+
+// inst_init: Initialize an empty slot.
+void inst_init(Instrument * inst);
+
+// inst_load: Load the instrument in dir into an empty slot, leaving it READY.
+// If jack is true the samples are prepared for real-time playback: either
+// read in, or streamed if the config sets a preload time. If share isn't
+// NULL, it's an instrument loaded from the same directory that the caller
+// has already counted a sharer of, and its samples are used instead of
+// loading them again. The reference is dropped by inst_free. Changes the
+// working directory to dir. Returns NULL if successful, otherwise an error,
+// leaving the slot FREE.
+const char *inst_load(Instrument * inst, char *dir, bool jack,
+                      Instrument * share);
+
+// inst_free: Free everything the instrument holds and mark the slot FREE. No
+// voice may be playing from it, and it may have no sharers.
+void inst_free(Instrument * inst);
+
+// inst_compute_ramps: Compute the instrument's ramps for the next nframes
+// from its controls. Audio thread.
+void inst_compute_ramps(Instrument * inst, int nframes);
+
+#endif                          // INSTRUMENT_H_
@@ -0,0 +1,1057 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "interp.h"
+
+// Sinc kernel design. The cutoff is a fraction of the sample rate.
+#define SINC_CUTOFF 0.45
+#define SINC_BETA 7.0
+
+void (*interp_mix_d[INTERP_COUNT]) (const InterpVoiceD * v, int n,
+                                    double *out);
+void (*interp_mix_f[INTERP_COUNT]) (const InterpVoiceF * v, int n,
+                                    float *out);
+
+static const char *_kernel;
+
+static const char *_qualityNames[INTERP_COUNT] = { "linear", "cubic", "sinc" };
+
+// Sinc coefficients. Row p holds the taps for fractional position
+// p / INTERP_SINC_PHASES, each repeated for left and right so rows can be
+// multiplied directly with interleaved frames. The extra row is for
+// interpolating between phases. About 16 kB, so it stays in L1.
+static float _sinc[INTERP_SINC_PHASES + 1][2 * INTERP_SINC_TAPS]
+    __attribute__ ((aligned(64)));
+
+// Catmull-Rom spline through b and c. Works on scalars and vectors alike.
+#define CUBIC(a, b, c, d, mu) \
+    ((b) + 0.5f * (mu) * ((c) - (a) + (mu) * (2 * (a) - 5 * (b) + 4 * (c) \
+        - (d) + (mu) * (3 * ((b) - (c)) + (d) - (a)))))
+
+// ----------------------------------------------------------------------------
+// Scalar
+// ----------------------------------------------------------------------------
+
+static void _mixd_scalar_from(const InterpVoiceD * v, int i, int n,
+                              double *out)
+{
+    for (; i < n; ++i) {
+        double pos = v->idx + v->speed * v->offset[i];
+        int j = (int)pos;
+        double mu = pos - (double)j;
+
+        __m128d a = { v->data[2 * j], v->data[2 * j + 1] };
+        __m128d b = { v->data[2 * j + 2], v->data[2 * j + 3] };
+
+        double gain = v->amp * v->keyUp[i] * (1 - v->fade * v->fadeIn[i]);
+        __m128d LR = (a + mu * (b - a)) * gain;
+
+        out[2 * i] += LR[0];
+        out[2 * i + 1] += LR[1];
+    }
+}
+
+static void _mixd_scalar(const InterpVoiceD * v, int n, double *out)
+{
+    _mixd_scalar_from(v, 0, n, out);
+}
+
+static void _mixf_scalar_from(const InterpVoiceF * v, int i, int n,
+                              float *out)
+{
+    for (; i < n; ++i) {
+        double pos = v->idx + v->speed * v->offset[i];
+        int j = (int)pos;
+        float mu = pos - (double)j;
+
+        float aL = v->data[2 * j], aR = v->data[2 * j + 1];
+        float bL = v->data[2 * j + 2], bR = v->data[2 * j + 3];
+
+        float gain = v->amp * v->keyUp[i] * (1 - v->fade * v->fadeIn[i]);
+
+        out[2 * i] += (aL + mu * (bL - aL)) * gain;
+        out[2 * i + 1] += (aR + mu * (bR - aR)) * gain;
+    }
+}
+
+static void _mixf_scalar(const InterpVoiceF * v, int n, float *out)
+{
+    _mixf_scalar_from(v, 0, n, out);
+}
+
+// ----------------------------------------------------------------------------
+// SSE4.1: Four frames per iteration, single precision only. There is no
+// gather, so frames are loaded one at a time.
+// ----------------------------------------------------------------------------
+
+__attribute__ ((target("sse4.1")))
+static void _mixf_sse41(const InterpVoiceF * v, int n, float *out)
+{
+    const int *frames = (const int *)v->data;   // One int per LR frame.
+
+    __m128d idx = _mm_set1_pd(v->idx);
+    __m128d speed = _mm_set1_pd(v->speed);
+    __m128 amp = _mm_set1_ps(v->amp);
+    __m128 fade = _mm_set1_ps(v->fade);
+    __m128 one = _mm_set1_ps(1);
+
+    int i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128d p0 = idx + speed * _mm_loadu_pd(v->offset + i);
+        __m128d p1 = idx + speed * _mm_loadu_pd(v->offset + i + 2);
+        __m128d f0 = _mm_floor_pd(p0);
+        __m128d f1 = _mm_floor_pd(p1);
+        __m128 mu = _mm_movelh_ps(_mm_cvtpd_ps(p0 - f0),
+                                  _mm_cvtpd_ps(p1 - f1));
+
+        int j[4];
+        _mm_storeu_si128((__m128i *) j,
+                         _mm_unpacklo_epi64(_mm_cvttpd_epi32(f0),
+                                            _mm_cvttpd_epi32(f1)));
+
+        __m128i a = _mm_setr_epi32(frames[j[0]], frames[j[1]],
+                                   frames[j[2]], frames[j[3]]);
+        __m128i b = _mm_setr_epi32(frames[j[0] + 1], frames[j[1] + 1],
+                                   frames[j[2] + 1], frames[j[3] + 1]);
+
+        // Split into sign-extended left and right.
+        __m128 aL = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16));
+        __m128 aR = _mm_cvtepi32_ps(_mm_srai_epi32(a, 16));
+        __m128 bL = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+        __m128 bR = _mm_cvtepi32_ps(_mm_srai_epi32(b, 16));
+
+        __m128 gain = one - fade * _mm_loadu_ps(v->fadeIn + i);
+        gain = gain * _mm_loadu_ps(v->keyUp + i) * amp;
+
+        __m128 L = (aL + mu * (bL - aL)) * gain;
+        __m128 R = (aR + mu * (bR - aR)) * gain;
+
+        _mm_storeu_ps(out + 2 * i,
+                      _mm_loadu_ps(out + 2 * i) + _mm_unpacklo_ps(L, R));
+        _mm_storeu_ps(out + 2 * i + 4,
+                      _mm_loadu_ps(out + 2 * i + 4) + _mm_unpackhi_ps(L, R));
+    }
+
+    _mixf_scalar_from(v, i, n, out);
+}
+
+// ----------------------------------------------------------------------------
+// AVX2: Four frames per iteration in double precision, eight in single.
+// ----------------------------------------------------------------------------
+
+__attribute__ ((target("avx2,fma")))
+static void _mixd_avx2(const InterpVoiceD * v, int n, double *out)
+{
+    const int *frames = (const int *)v->data;
+
+    __m256d idx = _mm256_set1_pd(v->idx);
+    __m256d speed = _mm256_set1_pd(v->speed);
+    __m256d amp = _mm256_set1_pd(v->amp);
+    __m256d fade = _mm256_set1_pd(v->fade);
+    __m256d one = _mm256_set1_pd(1);
+
+    int i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256d pos = _mm256_fmadd_pd(speed, _mm256_loadu_pd(v->offset + i),
+                                      idx);
+        __m256d fl = _mm256_floor_pd(pos);
+        __m256d mu = _mm256_sub_pd(pos, fl);
+        __m128i j = _mm256_cvttpd_epi32(fl);
+
+        // Gather both frames, then split into sign-extended left and right.
+        __m128i a = _mm_i32gather_epi32(frames, j, 4);
+        __m128i b = _mm_i32gather_epi32(frames + 1, j, 4);
+
+        __m256d aL = _mm256_cvtepi32_pd(_mm_srai_epi32(_mm_slli_epi32(a, 16),
+                                                       16));
+        __m256d aR = _mm256_cvtepi32_pd(_mm_srai_epi32(a, 16));
+        __m256d bL = _mm256_cvtepi32_pd(_mm_srai_epi32(_mm_slli_epi32(b, 16),
+                                                       16));
+        __m256d bR = _mm256_cvtepi32_pd(_mm_srai_epi32(b, 16));
+
+        __m256d gain = _mm256_fnmadd_pd(fade,
+                                        _mm256_loadu_pd(v->fadeIn + i), one);
+        gain = _mm256_mul_pd(gain, _mm256_loadu_pd(v->keyUp + i));
+        gain = _mm256_mul_pd(gain, amp);
+
+        __m256d L = _mm256_fmadd_pd(mu, _mm256_sub_pd(bL, aL), aL);
+        __m256d R = _mm256_fmadd_pd(mu, _mm256_sub_pd(bR, aR), aR);
+        L = _mm256_mul_pd(L, gain);
+        R = _mm256_mul_pd(R, gain);
+
+        // Interleave back into LR frames.
+        __m256d lo = _mm256_unpacklo_pd(L, R);  // L0 R0 L2 R2
+        __m256d hi = _mm256_unpackhi_pd(L, R);  // L1 R1 L3 R3
+        __m256d f01 = _mm256_permute2f128_pd(lo, hi, 0x20);
+        __m256d f23 = _mm256_permute2f128_pd(lo, hi, 0x31);
+
+        _mm256_storeu_pd(out + 2 * i,
+                         _mm256_add_pd(_mm256_loadu_pd(out + 2 * i), f01));
+        _mm256_storeu_pd(out + 2 * i + 4,
+                         _mm256_add_pd(_mm256_loadu_pd(out + 2 * i + 4),
+                                       f23));
+    }
+
+    _mixd_scalar_from(v, i, n, out);
+}
+
+__attribute__ ((target("avx2,fma")))
+static void _mixf_avx2(const InterpVoiceF * v, int n, float *out)
+{
+    const int *frames = (const int *)v->data;
+
+    __m256d idx = _mm256_set1_pd(v->idx);
+    __m256d speed = _mm256_set1_pd(v->speed);
+    __m256 amp = _mm256_set1_ps(v->amp);
+    __m256 fade = _mm256_set1_ps(v->fade);
+    __m256 one = _mm256_set1_ps(1);
+
+    int i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256d p0 = _mm256_fmadd_pd(speed, _mm256_loadu_pd(v->offset + i),
+                                     idx);
+        __m256d p1 = _mm256_fmadd_pd(speed,
+                                     _mm256_loadu_pd(v->offset + i + 4), idx);
+        __m256d f0 = _mm256_floor_pd(p0);
+        __m256d f1 = _mm256_floor_pd(p1);
+
+        __m256i j = _mm256_set_m128i(_mm256_cvttpd_epi32(f1),
+                                     _mm256_cvttpd_epi32(f0));
+        __m256 mu = _mm256_set_m128(_mm256_cvtpd_ps(_mm256_sub_pd(p1, f1)),
+                                    _mm256_cvtpd_ps(_mm256_sub_pd(p0, f0)));
+
+        __m256i a = _mm256_i32gather_epi32(frames, j, 4);
+        __m256i b = _mm256_i32gather_epi32(frames + 1, j, 4);
+
+        __m256 aL = _mm256_cvtepi32_ps(_mm256_srai_epi32
+                                       (_mm256_slli_epi32(a, 16), 16));
+        __m256 aR = _mm256_cvtepi32_ps(_mm256_srai_epi32(a, 16));
+        __m256 bL = _mm256_cvtepi32_ps(_mm256_srai_epi32
+                                       (_mm256_slli_epi32(b, 16), 16));
+        __m256 bR = _mm256_cvtepi32_ps(_mm256_srai_epi32(b, 16));
+
+        __m256 gain = _mm256_fnmadd_ps(fade,
+                                       _mm256_loadu_ps(v->fadeIn + i), one);
+        gain = _mm256_mul_ps(gain, _mm256_loadu_ps(v->keyUp + i));
+        gain = _mm256_mul_ps(gain, amp);
+
+        __m256 L = _mm256_fmadd_ps(mu, _mm256_sub_ps(bL, aL), aL);
+        __m256 R = _mm256_fmadd_ps(mu, _mm256_sub_ps(bR, aR), aR);
+        L = _mm256_mul_ps(L, gain);
+        R = _mm256_mul_ps(R, gain);
+
+        __m256 lo = _mm256_unpacklo_ps(L, R);   // L0 R0 L1 R1 L4 R4 L5 R5
+        __m256 hi = _mm256_unpackhi_ps(L, R);   // L2 R2 L3 R3 L6 R6 L7 R7
+        __m256 f0123 = _mm256_permute2f128_ps(lo, hi, 0x20);
+        __m256 f4567 = _mm256_permute2f128_ps(lo, hi, 0x31);
+
+        _mm256_storeu_ps(out + 2 * i,
+                         _mm256_add_ps(_mm256_loadu_ps(out + 2 * i), f0123));
+        _mm256_storeu_ps(out + 2 * i + 8,
+                         _mm256_add_ps(_mm256_loadu_ps(out + 2 * i + 8),
+                                       f4567));
+    }
+
+    _mixf_scalar_from(v, i, n, out);
+}
+
+// ----------------------------------------------------------------------------
+// AVX-512: Eight frames per iteration in double precision, sixteen in single.
+// ----------------------------------------------------------------------------
+
+__attribute__ ((target("avx512f,avx2,fma")))
+static void _mixd_avx512(const InterpVoiceD * v, int n, double *out)
+{
+    const int *frames = (const int *)v->data;
+
+    __m512d idx = _mm512_set1_pd(v->idx);
+    __m512d speed = _mm512_set1_pd(v->speed);
+    __m512d amp = _mm512_set1_pd(v->amp);
+    __m512d fade = _mm512_set1_pd(v->fade);
+    __m512d one = _mm512_set1_pd(1);
+
+    // Interleaving permutations. Bit 3 selects R.
+    __m512i perm0 = _mm512_set_epi64(11, 3, 10, 2, 9, 1, 8, 0);
+    __m512i perm1 = _mm512_set_epi64(15, 7, 14, 6, 13, 5, 12, 4);
+
+    int i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m512d pos = _mm512_fmadd_pd(speed, _mm512_loadu_pd(v->offset + i),
+                                      idx);
+        __m512d fl = _mm512_floor_pd(pos);
+        __m512d mu = _mm512_sub_pd(pos, fl);
+        __m256i j = _mm512_cvttpd_epi32(fl);
+
+        __m256i a = _mm256_i32gather_epi32(frames, j, 4);
+        __m256i b = _mm256_i32gather_epi32(frames + 1, j, 4);
+
+        __m512d aL = _mm512_cvtepi32_pd(_mm256_srai_epi32
+                                        (_mm256_slli_epi32(a, 16), 16));
+        __m512d aR = _mm512_cvtepi32_pd(_mm256_srai_epi32(a, 16));
+        __m512d bL = _mm512_cvtepi32_pd(_mm256_srai_epi32
+                                        (_mm256_slli_epi32(b, 16), 16));
+        __m512d bR = _mm512_cvtepi32_pd(_mm256_srai_epi32(b, 16));
+
+        __m512d gain = _mm512_fnmadd_pd(fade,
+                                        _mm512_loadu_pd(v->fadeIn + i), one);
+        gain = _mm512_mul_pd(gain, _mm512_loadu_pd(v->keyUp + i));
+        gain = _mm512_mul_pd(gain, amp);
+
+        __m512d L = _mm512_fmadd_pd(mu, _mm512_sub_pd(bL, aL), aL);
+        __m512d R = _mm512_fmadd_pd(mu, _mm512_sub_pd(bR, aR), aR);
+        L = _mm512_mul_pd(L, gain);
+        R = _mm512_mul_pd(R, gain);
+
+        __m512d f0 = _mm512_permutex2var_pd(L, perm0, R);
+        __m512d f1 = _mm512_permutex2var_pd(L, perm1, R);
+
+        _mm512_storeu_pd(out + 2 * i,
+                         _mm512_add_pd(_mm512_loadu_pd(out + 2 * i), f0));
+        _mm512_storeu_pd(out + 2 * i + 8,
+                         _mm512_add_pd(_mm512_loadu_pd(out + 2 * i + 8), f1));
+    }
+
+    _mixd_scalar_from(v, i, n, out);
+}
+
+__attribute__ ((target("avx512f,avx2,fma")))
+static void _mixf_avx512(const InterpVoiceF * v, int n, float *out)
+{
+    const int *frames = (const int *)v->data;
+
+    __m512d idx = _mm512_set1_pd(v->idx);
+    __m512d speed = _mm512_set1_pd(v->speed);
+    __m512 amp = _mm512_set1_ps(v->amp);
+    __m512 fade = _mm512_set1_ps(v->fade);
+    __m512 one = _mm512_set1_ps(1);
+
+    // Interleaving permutations. Bit 4 selects R.
+    __m512i perm0 = _mm512_set_epi32(23, 7, 22, 6, 21, 5, 20, 4,
+                                     19, 3, 18, 2, 17, 1, 16, 0);
+    __m512i perm1 = _mm512_set_epi32(31, 15, 30, 14, 29, 13, 28, 12,
+                                     27, 11, 26, 10, 25, 9, 24, 8);
+
+    int i;
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m512d p0 = _mm512_fmadd_pd(speed, _mm512_loadu_pd(v->offset + i),
+                                     idx);
+        __m512d p1 = _mm512_fmadd_pd(speed,
+                                     _mm512_loadu_pd(v->offset + i + 8), idx);
+        __m512d f0 = _mm512_floor_pd(p0);
+        __m512d f1 = _mm512_floor_pd(p1);
+
+        __m512i j = _mm512_inserti64x4(_mm512_castsi256_si512
+                                       (_mm512_cvttpd_epi32(f0)),
+                                       _mm512_cvttpd_epi32(f1), 1);
+
+        __m256 mu0 = _mm512_cvtpd_ps(_mm512_sub_pd(p0, f0));
+        __m256 mu1 = _mm512_cvtpd_ps(_mm512_sub_pd(p1, f1));
+        __m512 mu = _mm512_castsi512_ps(_mm512_inserti64x4
+                                        (_mm512_castsi256_si512
+                                         (_mm256_castps_si256(mu0)),
+                                         _mm256_castps_si256(mu1), 1));
+
+        __m512i a = _mm512_i32gather_epi32(j, frames, 4);
+        __m512i b = _mm512_i32gather_epi32(j, frames + 1, 4);
+
+        __m512 aL = _mm512_cvtepi32_ps(_mm512_srai_epi32
+                                       (_mm512_slli_epi32(a, 16), 16));
+        __m512 aR = _mm512_cvtepi32_ps(_mm512_srai_epi32(a, 16));
+        __m512 bL = _mm512_cvtepi32_ps(_mm512_srai_epi32
+                                       (_mm512_slli_epi32(b, 16), 16));
+        __m512 bR = _mm512_cvtepi32_ps(_mm512_srai_epi32(b, 16));
+
+        __m512 gain = _mm512_fnmadd_ps(fade,
+                                       _mm512_loadu_ps(v->fadeIn + i), one);
+        gain = _mm512_mul_ps(gain, _mm512_loadu_ps(v->keyUp + i));
+        gain = _mm512_mul_ps(gain, amp);
+
+        __m512 L = _mm512_fmadd_ps(mu, _mm512_sub_ps(bL, aL), aL);
+        __m512 R = _mm512_fmadd_ps(mu, _mm512_sub_ps(bR, aR), aR);
+        L = _mm512_mul_ps(L, gain);
+        R = _mm512_mul_ps(R, gain);
+
+        __m512 o0 = _mm512_permutex2var_ps(L, perm0, R);
+        __m512 o1 = _mm512_permutex2var_ps(L, perm1, R);
+
+        _mm512_storeu_ps(out + 2 * i,
+                         _mm512_add_ps(_mm512_loadu_ps(out + 2 * i), o0));
+        _mm512_storeu_ps(out + 2 * i + 16,
+                         _mm512_add_ps(_mm512_loadu_ps(out + 2 * i + 16), o1));
+    }
+
+    _mixf_scalar_from(v, i, n, out);
+}
+
+// ----------------------------------------------------------------------------
+// Cubic: The same layouts as the linear kernels, with four gathers per frame
+// instead of two.
+// ----------------------------------------------------------------------------
+
+static void _cubicd_scalar_from(const InterpVoiceD * v, int i, int n,
+                                double *out)
+{
+    for (; i < n; ++i) {
+        double pos = v->idx + v->speed * v->offset[i];
+        int j = (int)pos;
+        double mu = pos - (double)j;
+        const int16_t *x = v->data + 2 * j;
+
+        __m128d a = { x[-2], x[-1] };
+        __m128d b = { x[0], x[1] };
+        __m128d c = { x[2], x[3] };
+        __m128d d = { x[4], x[5] };
+
+        double gain = v->amp * v->keyUp[i] * (1 - v->fade * v->fadeIn[i]);
+        __m128d LR = CUBIC(a, b, c, d, mu) * gain;
+
+        out[2 * i] += LR[0];
+        out[2 * i + 1] += LR[1];
+    }
+}
+
+static void _cubicd_scalar(const InterpVoiceD * v, int n, double *out)
+{
+    _cubicd_scalar_from(v, 0, n, out);
+}
+
+static void _cubicf_scalar_from(const InterpVoiceF * v, int i, int n,
+                                float *out)
+{
+    for (; i < n; ++i) {
+        double pos = v->idx + v->speed * v->offset[i];
+        int j = (int)pos;
+        float mu = pos - (double)j;
+        const int16_t *x = v->data + 2 * j;
+
+        float aL = x[-2], bL = x[0], cL = x[2], dL = x[4];
+        float aR = x[-1], bR = x[1], cR = x[3], dR = x[5];
+
+        float gain = v->amp * v->keyUp[i] * (1 - v->fade * v->fadeIn[i]);
+
+        out[2 * i] += CUBIC(aL, bL, cL, dL, mu) * gain;
+        out[2 * i + 1] += CUBIC(aR, bR, cR, dR, mu) * gain;
+    }
+}
+
+static void _cubicf_scalar(const InterpVoiceF * v, int n, float *out)
+{
+    _cubicf_scalar_from(v, 0, n, out);
+}
+
+// Sign-extended left and right channels of packed LR frames.
+#define LEFT(x, bits) _mm##bits##_srai_epi32(_mm##bits##_slli_epi32(x, 16), 16)
+#define RIGHT(x, bits) _mm##bits##_srai_epi32(x, 16)
+
+__attribute__ ((target("sse4.1")))
+static void _cubicf_sse41(const InterpVoiceF * v, int n, float *out)
+{
+    const int *frames = (const int *)v->data;
+
+    __m128d idx = _mm_set1_pd(v->idx);
+    __m128d speed = _mm_set1_pd(v->speed);
+    __m128 amp = _mm_set1_ps(v->amp);
+    __m128 fade = _mm_set1_ps(v->fade);
+    __m128 one = _mm_set1_ps(1);
+
+    int i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128d p0 = idx + speed * _mm_loadu_pd(v->offset + i);
+        __m128d p1 = idx + speed * _mm_loadu_pd(v->offset + i + 2);
+        __m128d f0 = _mm_floor_pd(p0);
+        __m128d f1 = _mm_floor_pd(p1);
+        __m128 mu = _mm_movelh_ps(_mm_cvtpd_ps(p0 - f0),
+                                  _mm_cvtpd_ps(p1 - f1));
+
+        int j[4];
+        _mm_storeu_si128((__m128i *) j,
+                         _mm_unpacklo_epi64(_mm_cvttpd_epi32(f0),
+                                            _mm_cvttpd_epi32(f1)));
+
+        __m128i a = _mm_setr_epi32(frames[j[0] - 1], frames[j[1] - 1],
+                                   frames[j[2] - 1], frames[j[3] - 1]);
+        __m128i b = _mm_setr_epi32(frames[j[0]], frames[j[1]],
+                                   frames[j[2]], frames[j[3]]);
+        __m128i c = _mm_setr_epi32(frames[j[0] + 1], frames[j[1] + 1],
+                                   frames[j[2] + 1], frames[j[3] + 1]);
+        __m128i d = _mm_setr_epi32(frames[j[0] + 2], frames[j[1] + 2],
+                                   frames[j[2] + 2], frames[j[3] + 2]);
+
+        __m128 aL = _mm_cvtepi32_ps(LEFT(a, ));
+        __m128 bL = _mm_cvtepi32_ps(LEFT(b, ));
+        __m128 cL = _mm_cvtepi32_ps(LEFT(c, ));
+        __m128 dL = _mm_cvtepi32_ps(LEFT(d, ));
+        __m128 aR = _mm_cvtepi32_ps(RIGHT(a, ));
+        __m128 bR = _mm_cvtepi32_ps(RIGHT(b, ));
+        __m128 cR = _mm_cvtepi32_ps(RIGHT(c, ));
+        __m128 dR = _mm_cvtepi32_ps(RIGHT(d, ));
+
+        __m128 gain = one - fade * _mm_loadu_ps(v->fadeIn + i);
+        gain = gain * _mm_loadu_ps(v->keyUp + i) * amp;
+
+        __m128 L = CUBIC(aL, bL, cL, dL, mu) * gain;
+        __m128 R = CUBIC(aR, bR, cR, dR, mu) * gain;
+
+        _mm_storeu_ps(out + 2 * i,
+                      _mm_loadu_ps(out + 2 * i) + _mm_unpacklo_ps(L, R));
+        _mm_storeu_ps(out + 2 * i + 4,
+                      _mm_loadu_ps(out + 2 * i + 4) + _mm_unpackhi_ps(L, R));
+    }
+
+    _cubicf_scalar_from(v, i, n, out);
+}
+
+__attribute__ ((target("avx2,fma")))
+static void _cubicd_avx2(const InterpVoiceD * v, int n, double *out)
+{
+    const int *frames = (const int *)v->data;
+
+    __m256d idx = _mm256_set1_pd(v->idx);
+    __m256d speed = _mm256_set1_pd(v->speed);
+    __m256d amp = _mm256_set1_pd(v->amp);
+    __m256d fade = _mm256_set1_pd(v->fade);
+    __m256d one = _mm256_set1_pd(1);
+
+    int i;
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m256d pos = _mm256_fmadd_pd(speed, _mm256_loadu_pd(v->offset + i),
+                                      idx);
+        __m256d fl = _mm256_floor_pd(pos);
+        __m256d mu = _mm256_sub_pd(pos, fl);
+        __m128i j = _mm256_cvttpd_epi32(fl);
+
+        __m128i a = _mm_i32gather_epi32(frames - 1, j, 4);
+        __m128i b = _mm_i32gather_epi32(frames, j, 4);
+        __m128i c = _mm_i32gather_epi32(frames + 1, j, 4);
+        __m128i d = _mm_i32gather_epi32(frames + 2, j, 4);
+
+        __m256d aL = _mm256_cvtepi32_pd(LEFT(a, ));
+        __m256d bL = _mm256_cvtepi32_pd(LEFT(b, ));
+        __m256d cL = _mm256_cvtepi32_pd(LEFT(c, ));
+        __m256d dL = _mm256_cvtepi32_pd(LEFT(d, ));
+        __m256d aR = _mm256_cvtepi32_pd(RIGHT(a, ));
+        __m256d bR = _mm256_cvtepi32_pd(RIGHT(b, ));
+        __m256d cR = _mm256_cvtepi32_pd(RIGHT(c, ));
+        __m256d dR = _mm256_cvtepi32_pd(RIGHT(d, ));
+
+        __m256d gain = _mm256_fnmadd_pd(fade,
+                                        _mm256_loadu_pd(v->fadeIn + i), one);
+        gain = _mm256_mul_pd(gain, _mm256_loadu_pd(v->keyUp + i));
+        gain = _mm256_mul_pd(gain, amp);
+
+        __m256d L = CUBIC(aL, bL, cL, dL, mu) * gain;
+        __m256d R = CUBIC(aR, bR, cR, dR, mu) * gain;
+
+        __m256d lo = _mm256_unpacklo_pd(L, R);  // L0 R0 L2 R2
+        __m256d hi = _mm256_unpackhi_pd(L, R);  // L1 R1 L3 R3
+        __m256d f01 = _mm256_permute2f128_pd(lo, hi, 0x20);
+        __m256d f23 = _mm256_permute2f128_pd(lo, hi, 0x31);
+
+        _mm256_storeu_pd(out + 2 * i,
+                         _mm256_add_pd(_mm256_loadu_pd(out + 2 * i), f01));
+        _mm256_storeu_pd(out + 2 * i + 4,
+                         _mm256_add_pd(_mm256_loadu_pd(out + 2 * i + 4),
+                                       f23));
+    }
+
+    _cubicd_scalar_from(v, i, n, out);
+}
+
+__attribute__ ((target("avx2,fma")))
+static void _cubicf_avx2(const InterpVoiceF * v, int n, float *out)
+{
+    const int *frames = (const int *)v->data;
+
+    __m256d idx = _mm256_set1_pd(v->idx);
+    __m256d speed = _mm256_set1_pd(v->speed);
+    __m256 amp = _mm256_set1_ps(v->amp);
+    __m256 fade = _mm256_set1_ps(v->fade);
+    __m256 one = _mm256_set1_ps(1);
+
+    int i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256d p0 = _mm256_fmadd_pd(speed, _mm256_loadu_pd(v->offset + i),
+                                     idx);
+        __m256d p1 = _mm256_fmadd_pd(speed,
+                                     _mm256_loadu_pd(v->offset + i + 4), idx);
+        __m256d f0 = _mm256_floor_pd(p0);
+        __m256d f1 = _mm256_floor_pd(p1);
+
+        __m256i j = _mm256_set_m128i(_mm256_cvttpd_epi32(f1),
+                                     _mm256_cvttpd_epi32(f0));
+        __m256 mu = _mm256_set_m128(_mm256_cvtpd_ps(_mm256_sub_pd(p1, f1)),
+                                    _mm256_cvtpd_ps(_mm256_sub_pd(p0, f0)));
+
+        __m256i a = _mm256_i32gather_epi32(frames - 1, j, 4);
+        __m256i b = _mm256_i32gather_epi32(frames, j, 4);
+        __m256i c = _mm256_i32gather_epi32(frames + 1, j, 4);
+        __m256i d = _mm256_i32gather_epi32(frames + 2, j, 4);
+
+        __m256 aL = _mm256_cvtepi32_ps(LEFT(a, 256));
+        __m256 bL = _mm256_cvtepi32_ps(LEFT(b, 256));
+        __m256 cL = _mm256_cvtepi32_ps(LEFT(c, 256));
+        __m256 dL = _mm256_cvtepi32_ps(LEFT(d, 256));
+        __m256 aR = _mm256_cvtepi32_ps(RIGHT(a, 256));
+        __m256 bR = _mm256_cvtepi32_ps(RIGHT(b, 256));
+        __m256 cR = _mm256_cvtepi32_ps(RIGHT(c, 256));
+        __m256 dR = _mm256_cvtepi32_ps(RIGHT(d, 256));
+
+        __m256 gain = _mm256_fnmadd_ps(fade,
+                                       _mm256_loadu_ps(v->fadeIn + i), one);
+        gain = _mm256_mul_ps(gain, _mm256_loadu_ps(v->keyUp + i));
+        gain = _mm256_mul_ps(gain, amp);
+
+        __m256 L = CUBIC(aL, bL, cL, dL, mu) * gain;
+        __m256 R = CUBIC(aR, bR, cR, dR, mu) * gain;
+
+        __m256 lo = _mm256_unpacklo_ps(L, R);   // L0 R0 L1 R1 L4 R4 L5 R5
+        __m256 hi = _mm256_unpackhi_ps(L, R);   // L2 R2 L3 R3 L6 R6 L7 R7
+        __m256 f0123 = _mm256_permute2f128_ps(lo, hi, 0x20);
+        __m256 f4567 = _mm256_permute2f128_ps(lo, hi, 0x31);
+
+        _mm256_storeu_ps(out + 2 * i,
+                         _mm256_add_ps(_mm256_loadu_ps(out + 2 * i), f0123));
+        _mm256_storeu_ps(out + 2 * i + 8,
+                         _mm256_add_ps(_mm256_loadu_ps(out + 2 * i + 8),
+                                       f4567));
+    }
+
+    _cubicf_scalar_from(v, i, n, out);
+}
+
+__attribute__ ((target("avx512f,avx2,fma")))
+static void _cubicd_avx512(const InterpVoiceD * v, int n, double *out)
+{
+    const int *frames = (const int *)v->data;
+
+    __m512d idx = _mm512_set1_pd(v->idx);
+    __m512d speed = _mm512_set1_pd(v->speed);
+    __m512d amp = _mm512_set1_pd(v->amp);
+    __m512d fade = _mm512_set1_pd(v->fade);
+    __m512d one = _mm512_set1_pd(1);
+
+    __m512i perm0 = _mm512_set_epi64(11, 3, 10, 2, 9, 1, 8, 0);
+    __m512i perm1 = _mm512_set_epi64(15, 7, 14, 6, 13, 5, 12, 4);
+
+    int i;
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m512d pos = _mm512_fmadd_pd(speed, _mm512_loadu_pd(v->offset + i),
+                                      idx);
+        __m512d fl = _mm512_floor_pd(pos);
+        __m512d mu = _mm512_sub_pd(pos, fl);
+        __m256i j = _mm512_cvttpd_epi32(fl);
+
+        __m256i a = _mm256_i32gather_epi32(frames - 1, j, 4);
+        __m256i b = _mm256_i32gather_epi32(frames, j, 4);
+        __m256i c = _mm256_i32gather_epi32(frames + 1, j, 4);
+        __m256i d = _mm256_i32gather_epi32(frames + 2, j, 4);
+
+        __m512d aL = _mm512_cvtepi32_pd(LEFT(a, 256));
+        __m512d bL = _mm512_cvtepi32_pd(LEFT(b, 256));
+        __m512d cL = _mm512_cvtepi32_pd(LEFT(c, 256));
+        __m512d dL = _mm512_cvtepi32_pd(LEFT(d, 256));
+        __m512d aR = _mm512_cvtepi32_pd(RIGHT(a, 256));
+        __m512d bR = _mm512_cvtepi32_pd(RIGHT(b, 256));
+        __m512d cR = _mm512_cvtepi32_pd(RIGHT(c, 256));
+        __m512d dR = _mm512_cvtepi32_pd(RIGHT(d, 256));
+
+        __m512d gain = _mm512_fnmadd_pd(fade,
+                                        _mm512_loadu_pd(v->fadeIn + i), one);
+        gain = _mm512_mul_pd(gain, _mm512_loadu_pd(v->keyUp + i));
+        gain = _mm512_mul_pd(gain, amp);
+
+        __m512d L = CUBIC(aL, bL, cL, dL, mu) * gain;
+        __m512d R = CUBIC(aR, bR, cR, dR, mu) * gain;
+
+        __m512d f0 = _mm512_permutex2var_pd(L, perm0, R);
+        __m512d f1 = _mm512_permutex2var_pd(L, perm1, R);
+
+        _mm512_storeu_pd(out + 2 * i,
+                         _mm512_add_pd(_mm512_loadu_pd(out + 2 * i), f0));
+        _mm512_storeu_pd(out + 2 * i + 8,
+                         _mm512_add_pd(_mm512_loadu_pd(out + 2 * i + 8), f1));
+    }
+
+    _cubicd_scalar_from(v, i, n, out);
+}
+
+__attribute__ ((target("avx512f,avx2,fma")))
+static void _cubicf_avx512(const InterpVoiceF * v, int n, float *out)
+{
+    const int *frames = (const int *)v->data;
+
+    __m512d idx = _mm512_set1_pd(v->idx);
+    __m512d speed = _mm512_set1_pd(v->speed);
+    __m512 amp = _mm512_set1_ps(v->amp);
+    __m512 fade = _mm512_set1_ps(v->fade);
+    __m512 one = _mm512_set1_ps(1);
+
+    __m512i perm0 = _mm512_set_epi32(23, 7, 22, 6, 21, 5, 20, 4,
+                                     19, 3, 18, 2, 17, 1, 16, 0);
+    __m512i perm1 = _mm512_set_epi32(31, 15, 30, 14, 29, 13, 28, 12,
+                                     27, 11, 26, 10, 25, 9, 24, 8);
+
+    int i;
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m512d p0 = _mm512_fmadd_pd(speed, _mm512_loadu_pd(v->offset + i),
+                                     idx);
+        __m512d p1 = _mm512_fmadd_pd(speed,
+                                     _mm512_loadu_pd(v->offset + i + 8), idx);
+        __m512d f0 = _mm512_floor_pd(p0);
+        __m512d f1 = _mm512_floor_pd(p1);
+
+        __m512i j = _mm512_inserti64x4(_mm512_castsi256_si512
+                                       (_mm512_cvttpd_epi32(f0)),
+                                       _mm512_cvttpd_epi32(f1), 1);
+
+        __m256 mu0 = _mm512_cvtpd_ps(_mm512_sub_pd(p0, f0));
+        __m256 mu1 = _mm512_cvtpd_ps(_mm512_sub_pd(p1, f1));
+        __m512 mu = _mm512_castsi512_ps(_mm512_inserti64x4
+                                        (_mm512_castsi256_si512
+                                         (_mm256_castps_si256(mu0)),
+                                         _mm256_castps_si256(mu1), 1));
+
+        __m512i a = _mm512_i32gather_epi32(j, frames - 1, 4);
+        __m512i b = _mm512_i32gather_epi32(j, frames, 4);
+        __m512i c = _mm512_i32gather_epi32(j, frames + 1, 4);
+        __m512i d = _mm512_i32gather_epi32(j, frames + 2, 4);
+
+        __m512 aL = _mm512_cvtepi32_ps(LEFT(a, 512));
+        __m512 bL = _mm512_cvtepi32_ps(LEFT(b, 512));
+        __m512 cL = _mm512_cvtepi32_ps(LEFT(c, 512));
+        __m512 dL = _mm512_cvtepi32_ps(LEFT(d, 512));
+        __m512 aR = _mm512_cvtepi32_ps(RIGHT(a, 512));
+        __m512 bR = _mm512_cvtepi32_ps(RIGHT(b, 512));
+        __m512 cR = _mm512_cvtepi32_ps(RIGHT(c, 512));
+        __m512 dR = _mm512_cvtepi32_ps(RIGHT(d, 512));
+
+        __m512 gain = _mm512_fnmadd_ps(fade,
+                                       _mm512_loadu_ps(v->fadeIn + i), one);
+        gain = _mm512_mul_ps(gain, _mm512_loadu_ps(v->keyUp + i));
+        gain = _mm512_mul_ps(gain, amp);
+
+        __m512 L = CUBIC(aL, bL, cL, dL, mu) * gain;
+        __m512 R = CUBIC(aR, bR, cR, dR, mu) * gain;
+
+        __m512 o0 = _mm512_permutex2var_ps(L, perm0, R);
+        __m512 o1 = _mm512_permutex2var_ps(L, perm1, R);
+
+        _mm512_storeu_ps(out + 2 * i,
+                         _mm512_add_ps(_mm512_loadu_ps(out + 2 * i), o0));
+        _mm512_storeu_ps(out + 2 * i + 16,
+                         _mm512_add_ps(_mm512_loadu_ps(out + 2 * i + 16), o1));
+    }
+
+    _cubicf_scalar_from(v, i, n, out);
+}
+
+// ----------------------------------------------------------------------------
+// Sinc: One frame at a time, vectorized across the taps. The taps are
+// evaluated in single precision for both buses; the 16 bit input doesn't
+// need more. Each kernel returns the left and right values in the low lanes.
+// ----------------------------------------------------------------------------
+
+static double _bessel_i0(double x)
+{
+    double sum = 1, term = 1;
+    for (int k = 1; k < 32; ++k) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+static void _sinc_init()
+{
+    double half = INTERP_SINC_TAPS / 2;
+
+    for (int p = 0; p <= INTERP_SINC_PHASES; ++p) {
+        double mu = (double)p / INTERP_SINC_PHASES;
+        double h[INTERP_SINC_TAPS];
+        double sum = 0;
+
+        for (int k = 0; k < INTERP_SINC_TAPS; ++k) {
+            // Distance from the playback position to the tap.
+            double x = k - (half - 1) - mu;
+            double r = x / half;
+            double w = 0;
+            if (r * r < 1) {
+                w = _bessel_i0(SINC_BETA * sqrt(1 - r * r)) /
+                    _bessel_i0(SINC_BETA);
+            }
+            double y = 2 * M_PI * SINC_CUTOFF * x;
+            h[k] = w * (x == 0 ? 1 : sin(y) / y);
+            sum += h[k];
+        }
+
+        // Unity gain at DC for every phase.
+        for (int k = 0; k < INTERP_SINC_TAPS; ++k) {
+            _sinc[p][2 * k] = _sinc[p][2 * k + 1] = h[k] / sum;
+        }
+    }
+}
+
+// Find the first frame and the coefficient rows for a position. t is the
+// weight of the second row.
+static inline const int16_t *_sinc_pos(const int16_t *data, double pos,
+                                       const float **c, float *t)
+{
+    int j = (int)pos;
+    double ph = (pos - (double)j) * INTERP_SINC_PHASES;
+    int p = (int)ph;
+
+    *c = _sinc[p];
+    *t = ph - (double)p;
+    return data + 2 * (j - INTERP_SINC_TAPS / 2 + 1);
+}
+
+static inline __m128 _sinc_scalar(const int16_t *data, double pos)
+{
+    const float *c;
+    float t;
+    const int16_t *x = _sinc_pos(data, pos, &c, &t);
+
+    float L = 0, R = 0;
+    for (int k = 0; k < 2 * INTERP_SINC_TAPS; k += 2) {
+        float w = c[k] + t * (c[k + 2 * INTERP_SINC_TAPS] - c[k]);
+        L += w * x[k];
+        R += w * x[k + 1];
+    }
+    return (__m128) { L, R, 0, 0 };
+}
+
+__attribute__ ((target("sse4.1")))
+static inline __m128 _sinc_sse41(const int16_t *data, double pos)
+{
+    const float *c;
+    float t;
+    const int16_t *x = _sinc_pos(data, pos, &c, &t);
+
+    __m128 tt = _mm_set1_ps(t);
+    __m128 acc = _mm_setzero_ps();
+    for (int k = 0; k < 2 * INTERP_SINC_TAPS; k += 4) {
+        __m128 c0 = _mm_load_ps(c + k);
+        __m128 c1 = _mm_load_ps(c + k + 2 * INTERP_SINC_TAPS);
+        __m128 s = _mm_cvtepi32_ps(_mm_cvtepi16_epi32
+                                   (_mm_loadl_epi64((const __m128i *)(x + k))));
+        acc += (c0 + tt * (c1 - c0)) * s;
+    }
+    return acc + _mm_movehl_ps(acc, acc);
+}
+
+__attribute__ ((target("avx2,fma")))
+static inline __m128 _sinc_avx2(const int16_t *data, double pos)
+{
+    const float *c;
+    float t;
+    const int16_t *x = _sinc_pos(data, pos, &c, &t);
+
+    __m256 tt = _mm256_set1_ps(t);
+    __m256 acc = _mm256_setzero_ps();
+    for (int k = 0; k < 2 * INTERP_SINC_TAPS; k += 8) {
+        __m256 c0 = _mm256_load_ps(c + k);
+        __m256 c1 = _mm256_load_ps(c + k + 2 * INTERP_SINC_TAPS);
+        __m256 s = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32
+                                      (_mm_loadu_si128
+                                       ((const __m128i *)(x + k))));
+        __m256 w = _mm256_fmadd_ps(tt, _mm256_sub_ps(c1, c0), c0);
+        acc = _mm256_fmadd_ps(w, s, acc);
+    }
+    __m128 h = _mm_add_ps(_mm256_castps256_ps128(acc),
+                          _mm256_extractf128_ps(acc, 1));
+    return _mm_add_ps(h, _mm_movehl_ps(h, h));
+}
+
+__attribute__ ((target("avx512f,avx2,fma")))
+static inline __m128 _sinc_avx512(const int16_t *data, double pos)
+{
+    const float *c;
+    float t;
+    const int16_t *x = _sinc_pos(data, pos, &c, &t);
+
+    __m512 tt = _mm512_set1_ps(t);
+    __m512 acc = _mm512_setzero_ps();
+    for (int k = 0; k < 2 * INTERP_SINC_TAPS; k += 16) {
+        __m512 c0 = _mm512_load_ps(c + k);
+        __m512 c1 = _mm512_load_ps(c + k + 2 * INTERP_SINC_TAPS);
+        __m512 s = _mm512_cvtepi32_ps(_mm512_cvtepi16_epi32
+                                      (_mm256_loadu_si256
+                                       ((const __m256i *)(x + k))));
+        __m512 w = _mm512_fmadd_ps(tt, _mm512_sub_ps(c1, c0), c0);
+        acc = _mm512_fmadd_ps(w, s, acc);
+    }
+    __m256 h8 = _mm256_add_ps(_mm512_castps512_ps256(acc),
+                              _mm256_castpd_ps(_mm512_extractf64x4_pd
+                                               (_mm512_castps_pd(acc), 1)));
+    __m128 h = _mm_add_ps(_mm256_castps256_ps128(h8),
+                          _mm256_extractf128_ps(h8, 1));
+    return _mm_add_ps(h, _mm_movehl_ps(h, h));
+}
+
+// The bus loops. These are always inlined into the kernels below so the
+// frame function is a direct call compiled for the kernel's target.
+static inline __attribute__ ((always_inline))
+void _sincd_loop(const InterpVoiceD * v, int n, double *out,
+                 __m128(*frame) (const int16_t *, double))
+{
+    for (int i = 0; i < n; ++i) {
+        __m128d LR = _mm_cvtps_pd(frame(v->data,
+                                        v->idx + v->speed * v->offset[i]));
+        double gain = v->amp * v->keyUp[i] * (1 - v->fade * v->fadeIn[i]);
+        _mm_storeu_pd(out + 2 * i, _mm_loadu_pd(out + 2 * i) + LR * gain);
+    }
+}
+
+static inline __attribute__ ((always_inline))
+void _sincf_loop(const InterpVoiceF * v, int n, float *out,
+                 __m128(*frame) (const int16_t *, double))
+{
+    for (int i = 0; i < n; ++i) {
+        __m128 LR = frame(v->data, v->idx + v->speed * v->offset[i]);
+        float gain = v->amp * v->keyUp[i] * (1 - v->fade * v->fadeIn[i]);
+        out[2 * i] += LR[0] * gain;
+        out[2 * i + 1] += LR[1] * gain;
+    }
+}
+
+static void _sincd_scalar(const InterpVoiceD * v, int n, double *out)
+{
+    _sincd_loop(v, n, out, _sinc_scalar);
+}
+
+static void _sincf_scalar(const InterpVoiceF * v, int n, float *out)
+{
+    _sincf_loop(v, n, out, _sinc_scalar);
+}
+
+__attribute__ ((target("sse4.1")))
+static void _sincf_sse41(const InterpVoiceF * v, int n, float *out)
+{
+    _sincf_loop(v, n, out, _sinc_sse41);
+}
+
+__attribute__ ((target("avx2,fma")))
+static void _sincd_avx2(const InterpVoiceD * v, int n, double *out)
+{
+    _sincd_loop(v, n, out, _sinc_avx2);
+}
+
+__attribute__ ((target("avx2,fma")))
+static void _sincf_avx2(const InterpVoiceF * v, int n, float *out)
+{
+    _sincf_loop(v, n, out, _sinc_avx2);
+}
+
+__attribute__ ((target("avx512f,avx2,fma")))
+static void _sincd_avx512(const InterpVoiceD * v, int n, double *out)
+{
+    _sincd_loop(v, n, out, _sinc_avx512);
+}
+
+__attribute__ ((target("avx512f,avx2,fma")))
+static void _sincf_avx512(const InterpVoiceF * v, int n, float *out)
+{
+    _sincf_loop(v, n, out, _sinc_avx512);
+}
+
+// ----------------------------------------------------------------------------
+// interp_init
+// ----------------------------------------------------------------------------
+
+void interp_init()
+{
+    // The kernels may be forced for testing, e.g. JLSAMPLER_KERNEL=scalar.
+    // There is no double precision sse41 kernel; scalar is used instead.
+    char *force = getenv("JLSAMPLER_KERNEL");
+    if (force == NULL) {
+        force = "";
+    }
+
+    __builtin_cpu_init();
+
+    int level = 0;
+    if (__builtin_cpu_supports("sse4.1")) {
+        level = 1;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        level = 2;
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        level = 3;
+    }
+
+    if (strcmp(force, "scalar") == 0) {
+        level = 0;
+    } else if (strcmp(force, "sse41") == 0 && level > 1) {
+        level = 1;
+    } else if (strcmp(force, "avx2") == 0 && level > 2) {
+        level = 2;
+    }
+
+    interp_mix_d[INTERP_LINEAR] = _mixd_scalar;
+    interp_mix_d[INTERP_CUBIC] = _cubicd_scalar;
+    interp_mix_d[INTERP_SINC] = _sincd_scalar;
+    interp_mix_f[INTERP_LINEAR] = _mixf_scalar;
+    interp_mix_f[INTERP_CUBIC] = _cubicf_scalar;
+    interp_mix_f[INTERP_SINC] = _sincf_scalar;
+    _kernel = "scalar";
+
+    switch (level) {
+    case 1:
+        interp_mix_f[INTERP_LINEAR] = _mixf_sse41;
+        interp_mix_f[INTERP_CUBIC] = _cubicf_sse41;
+        interp_mix_f[INTERP_SINC] = _sincf_sse41;
+        _kernel = "sse41";
+        break;
+    case 2:
+        interp_mix_d[INTERP_LINEAR] = _mixd_avx2;
+        interp_mix_d[INTERP_CUBIC] = _cubicd_avx2;
+        interp_mix_d[INTERP_SINC] = _sincd_avx2;
+        interp_mix_f[INTERP_LINEAR] = _mixf_avx2;
+        interp_mix_f[INTERP_CUBIC] = _cubicf_avx2;
+        interp_mix_f[INTERP_SINC] = _sincf_avx2;
+        _kernel = "avx2";
+        break;
+    case 3:
+        interp_mix_d[INTERP_LINEAR] = _mixd_avx512;
+        interp_mix_d[INTERP_CUBIC] = _cubicd_avx512;
+        interp_mix_d[INTERP_SINC] = _sincd_avx512;
+        interp_mix_f[INTERP_LINEAR] = _mixf_avx512;
+        interp_mix_f[INTERP_CUBIC] = _cubicf_avx512;
+        interp_mix_f[INTERP_SINC] = _sincf_avx512;
+        _kernel = "avx512";
+        break;
+    }
+
+    _sinc_init();
+
+#ifdef FLOAT_BUS
+    printf("Mixing kernel: %s, single precision\n", _kernel);
+#else
+    printf("Mixing kernel: %s, double precision\n", _kernel);
+#endif
+}
+
+const char *interp_kernel()
+{
+    return _kernel;
+}
+
+const char *interp_quality_name(int quality)
+{
+    if (quality < 0 || quality >= INTERP_COUNT) {
+        return "unknown";
+    }
+    return _qualityNames[quality];
+}
+
+int interp_quality_parse(const char *name)
+{
+    for (int q = 0; q < INTERP_COUNT; ++q) {
+        if (strcmp(name, _qualityNames[q]) == 0) {
+            return q;
+        }
+    }
+    return -1;
+}
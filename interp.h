@@ -0,0 +1,86 @@
+#ifndef INTERP_H_
+#define INTERP_H_
+
+#include <stdint.h>
+#include <x86intrin.h>
+#include "global.h"
+
+// Interpolation qualities. These are selected per instrument with the
+// Interpolation key in config.conf.
+#define INTERP_LINEAR 0         // 2 points.
+#define INTERP_CUBIC 1          // 4 point Catmull-Rom spline.
+#define INTERP_SINC 2           // Polyphase Kaiser windowed sinc.
+#define INTERP_COUNT 3
+
+// The sinc kernel reads INTERP_SINC_TAPS frames around the playback position,
+// from idx - INTERP_SINC_TAPS / 2 + 1 to idx + INTERP_SINC_TAPS / 2. Sample
+// data must be padded by at least INTERP_SINC_TAPS / 2 frames each side.
+#define INTERP_SINC_TAPS 16
+#define INTERP_SINC_PHASES 128
+
+// InterpRamps: Per-callback values shared by every playing sample of an
+// instrument. Entry i applies to frame i of the block. The ramps that are
+// the same for every instrument are kept once, in the sampler.
+typedef struct {
+    double offset[JACK_BUF_SIZE + 1];   // Position offset at unit speed.
+    mix_t keyUp[JACK_BUF_SIZE + 1];     // Key-up decay, tauKeyUp^(i+1).
+    mix_t fadeIn[JACK_BUF_SIZE + 1];    // Fade-in decay, tauFadeIn^(i+1).
+} InterpRamps;
+
+// InterpVoiceD: A block of a single playing sample to be mixed into a double
+// precision bus. Frame i is read at position idx + speed * offset[i] and
+// amplified by amp * keyUp[i] * (1 - fade * fadeIn[i]).
+typedef struct {
+    const int16_t *data;        // Left/right interleaved sample data.
+    double idx;                 // Playback position before the block.
+    double speed;               // Playback speed multiplier.
+    double amp;                 // Amplitude before the block.
+    double fade;                // Fade-in amplitude before the block.
+    const double *offset;
+    const double *keyUp;
+    const double *fadeIn;
+} InterpVoiceD;
+
+// InterpVoiceF: As InterpVoiceD, for a single precision bus. Positions are
+// still computed in double precision.
+typedef struct {
+    const int16_t *data;
+    double idx;
+    double speed;
+    float amp;
+    float fade;
+    const double *offset;
+    const float *keyUp;
+    const float *fadeIn;
+} InterpVoiceF;
+
+// interp_init: Select the fastest mixing kernels the CPU supports and build
+// the sinc coefficient table.
+void interp_init();
+
+// interp_kernel: Return the name of the selected kernels.
+const char *interp_kernel();
+
+// interp_quality_name: Return the config name of an interpolation quality.
+const char *interp_quality_name(int quality);
+
+// interp_quality_parse: Return the quality with the given name, or -1.
+int interp_quality_parse(const char *name);
+
+// Interpolate n frames of the voice and add them to the interleaved
+// left/right bus. There is one kernel per interpolation quality.
+extern void (*interp_mix_d[INTERP_COUNT]) (const InterpVoiceD * v, int n,
+                                           double *out);
+extern void (*interp_mix_f[INTERP_COUNT]) (const InterpVoiceF * v, int n,
+                                           float *out);
+
+// The voice type and kernel matching the mix bus.
+#ifdef FLOAT_BUS
+typedef InterpVoiceF InterpVoice;
+#define interp_mix interp_mix_f
+#else
+typedef InterpVoiceD InterpVoice;
+#define interp_mix interp_mix_d
+#endif
+
+#endif                          // INTERP_H_
@@ -1,10 +1,39 @@
 #include <stdio.h>
+#include <string.h>
 #include <gtk/gtk.h>
 
 #include "gui.h"
+#include "offline.h"
+#include "sampler.h"
+
+static void _usage(char *prog)
+{
+    printf("Usage:\n");
+    printf("    %s\n", prog);
+    printf("    %s --render <instrument-dir> <midi-file> <out.wav>\n", prog);
+}
 
 int main(int argc, char *argv[])
 {
+    if (argc > 1 && strcmp(argv[1], "--render") == 0) {
+        if (argc != 5) {
+            _usage(argv[0]);
+            return 1;
+        }
+        sampler_init();
+        const char *err = offline_render(argv[2], argv[3], argv[4]);
+        if (err != NULL) {
+            printf("%s\n", err);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (argc > 1) {
+        _usage(argv[0]);
+        return 1;
+    }
+
     gui_init();
     gui_run(argc, argv);
 }
@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "global.h"
+#include "mem.h"
+#include "midifile.h"
+
+static const char *errOpen = "Failed to open MIDI file.";
+static const char *errFormat = "The MIDI file is invalid or unsupported.";
+
+// A tempo change or channel message in ticks, before conversion to frames.
+typedef struct {
+    uint64_t tick;
+    int seq;                    // Order in file, for a stable sort.
+    uint32_t tempo;             // Microseconds per quarter note, or 0.
+    uint8_t data[3];
+} _Event;
+
+typedef struct {
+    uint8_t *buf;
+    int len;
+    int pos;
+} _Reader;
+
+static int _read_u8(_Reader * r, uint8_t * x)
+{
+    if (r->pos >= r->len) {
+        return 1;
+    }
+    *x = r->buf[r->pos++];
+    return 0;
+}
+
+static int _read_be(_Reader * r, int n, uint32_t * x)
+{
+    uint8_t b;
+    *x = 0;
+    for (int i = 0; i < n; ++i) {
+        if (_read_u8(r, &b) != 0) {
+            return 1;
+        }
+        *x = (*x << 8) | b;
+    }
+    return 0;
+}
+
+static int _read_varlen(_Reader * r, uint32_t * x)
+{
+    uint8_t b;
+    *x = 0;
+    for (int i = 0; i < 4; ++i) {
+        if (_read_u8(r, &b) != 0) {
+            return 1;
+        }
+        *x = (*x << 7) | (b & 0x7F);
+        if (!(b & 0x80)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int _skip(_Reader * r, uint32_t n)
+{
+    if (n > r->len - r->pos) {
+        return 1;
+    }
+    r->pos += n;
+    return 0;
+}
+
+// Append an event to the list, growing it as necessary.
+static _Event *_append(_Event ** evs, int *count, int *cap)
+{
+    if (*count == *cap) {
+        *cap = *cap ? 2 * *cap : 1024;
+        _Event *tmp = malloc_exit(*cap * sizeof(_Event));
+        if (*count) {
+            memcpy(tmp, *evs, *count * sizeof(_Event));
+        }
+        free(*evs);
+        *evs = tmp;
+    }
+    _Event *ev = &((*evs)[*count]);
+    ev->seq = (*count)++;
+    ev->tempo = 0;
+    return ev;
+}
+
+static int _parse_track(_Reader * r, _Event ** evs, int *count, int *cap)
+{
+    uint64_t tick = 0;
+    uint8_t status = 0;
+    uint8_t b, type;
+    uint32_t delta, len, tempo;
+
+    while (r->pos < r->len) {
+        if (_read_varlen(r, &delta) != 0 || _read_u8(r, &b) != 0) {
+            return 1;
+        }
+        tick += delta;
+
+        if (b == 0xFF) {
+            // Meta event. We only care about tempo changes.
+            if (_read_u8(r, &type) != 0 || _read_varlen(r, &len) != 0) {
+                return 1;
+            }
+            if (type == 0x51 && len == 3) {
+                if (_read_be(r, 3, &tempo) != 0) {
+                    return 1;
+                }
+                _Event *ev = _append(evs, count, cap);
+                ev->tick = tick;
+                ev->tempo = tempo;
+            } else if (type == 0x2F) {
+                return _skip(r, len);
+            } else if (_skip(r, len) != 0) {
+                return 1;
+            }
+            continue;
+        }
+
+        if (b == 0xF0 || b == 0xF7) {
+            // Sysex events are skipped.
+            if (_read_varlen(r, &len) != 0 || _skip(r, len) != 0) {
+                return 1;
+            }
+            continue;
+        }
+
+        _Event *ev = _append(evs, count, cap);
+        ev->tick = tick;
+
+        // Running status: reuse the previous status byte.
+        if (b & 0x80) {
+            status = b;
+            if (_read_u8(r, &b) != 0) {
+                return 1;
+            }
+        } else if (status == 0) {
+            return 1;
+        }
+
+        ev->data[0] = status;
+        ev->data[1] = b;
+        ev->data[2] = 0;
+
+        // Program change and channel pressure have a single data byte.
+        if ((status & 0xF0) != 0xC0 && (status & 0xF0) != 0xD0) {
+            if (_read_u8(r, &(ev->data[2])) != 0) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int _cmp_event(const void *a, const void *b)
+{
+    const _Event *ea = a, *eb = b;
+    if (ea->tick != eb->tick) {
+        return ea->tick < eb->tick ? -1 : 1;
+    }
+    return ea->seq - eb->seq;
+}
+
+static uint8_t *_read_file(char *path, int *len)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    *len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint8_t *buf = malloc_exit(*len + 1);
+    if (fread(buf, 1, *len, f) != *len) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    return buf;
+}
+
+const char *midifile_load(char *path, MidiEvent ** events, int *count)
+{
+    _Reader r;
+    r.pos = 0;
+    r.buf = _read_file(path, &r.len);
+    if (r.buf == NULL) {
+        return errOpen;
+    }
+
+    _Event *evs = NULL;
+    int numEvs = 0, cap = 0;
+    uint32_t magic, len, format, numTracks, division;
+
+    if (_read_be(&r, 4, &magic) != 0 || magic != 0x4D546864 ||
+        _read_be(&r, 4, &len) != 0 || len < 6 ||
+        _read_be(&r, 2, &format) != 0 || format > 1 ||
+        _read_be(&r, 2, &numTracks) != 0 ||
+        _read_be(&r, 2, &division) != 0 || (division & 0x7FFF) == 0 ||
+        _skip(&r, len - 6) != 0) {
+        goto error;
+    }
+
+    for (int i = 0; i < numTracks; ++i) {
+        if (_read_be(&r, 4, &magic) != 0 || _read_be(&r, 4, &len) != 0 ||
+            len > r.len - r.pos) {
+            goto error;
+        }
+        if (magic != 0x4D54726B) {
+            // Unknown chunks are skipped.
+            r.pos += len;
+            continue;
+        }
+        _Reader tr = {.buf = r.buf + r.pos,.len = len,.pos = 0 };
+        if (_parse_track(&tr, &evs, &numEvs, &cap) != 0) {
+            goto error;
+        }
+        r.pos += len;
+    }
+
+    qsort(evs, numEvs, sizeof(_Event), _cmp_event);
+
+    // Convert ticks to frames, walking the tempo map.
+    double framesPerTick;
+    double tempo = 500000;      // Default is 120 bpm.
+    if (division & 0x8000) {
+        // SMPTE time: frames per second and ticks per frame.
+        int fps = -(int8_t) (division >> 8);
+        framesPerTick = SAMPLE_RATE / (double)(fps * (division & 0xFF));
+    } else {
+        framesPerTick = tempo * 1e-6 * SAMPLE_RATE / (double)division;
+    }
+
+    MidiEvent *out = malloc_exit((numEvs + 1) * sizeof(MidiEvent));
+    int numOut = 0;
+    uint64_t tick0 = 0;
+    double frame0 = 0;
+
+    for (int i = 0; i < numEvs; ++i) {
+        double frame = frame0 + (double)(evs[i].tick - tick0) * framesPerTick;
+
+        if (evs[i].tempo != 0) {
+            if (!(division & 0x8000)) {
+                tempo = evs[i].tempo;
+                framesPerTick =
+                    tempo * 1e-6 * SAMPLE_RATE / (double)division;
+            }
+            tick0 = evs[i].tick;
+            frame0 = frame;
+            continue;
+        }
+
+        out[numOut].frame = (uint64_t) (frame + 0.5);
+        memcpy(out[numOut].data, evs[i].data, 3);
+        ++numOut;
+    }
+
+    free(evs);
+    free(r.buf);
+    *events = out;
+    *count = numOut;
+    return NULL;
+
+  error:
+    free(evs);
+    free(r.buf);
+    return errFormat;
+}
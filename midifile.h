@@ -0,0 +1,18 @@
+#ifndef MIDIFILE_H_
+#define MIDIFILE_H_
+
+#include <stdint.h>
+
+// MidiEvent: A channel message with its time in frames from the start of the
+// file.
+typedef struct {
+    uint64_t frame;             // Time of the event in frames.
+    uint8_t data[3];            // Status byte followed by the data bytes.
+} MidiEvent;
+
+// midifile_load: Read the standard MIDI file (format 0 or 1) at path and
+// return its channel messages merged into a single list sorted by time. The
+// caller must free the returned events. Returns NULL if successful.
+const char *midifile_load(char *path, MidiEvent ** events, int *count);
+
+#endif                          // MIDIFILE_H_
@@ -0,0 +1,174 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <x86intrin.h>
+#include "mixpool.h"
+#include "rtcheck.h"
+
+static void _futex_wait(_Atomic uint32_t * addr, uint32_t val)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void _futex_wake(_Atomic uint32_t * addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, MIX_MAX_THREADS, NULL, NULL,
+            0);
+}
+
+static void *_worker(void *arg)
+{
+    int thread = (intptr_t) arg;
+    uint32_t gen = 0;
+
+    while (1) {
+        // Wait for the next job, spinning first.
+        uint32_t next;
+        int spin = 0;
+        while ((next = atomic_load(&_mixPool.gen)) == gen) {
+            if (++spin < MIX_SPIN) {
+                _mm_pause();
+                continue;
+            }
+            atomic_fetch_add(&_mixPool.sleepers, 1);
+            _futex_wait(&_mixPool.gen, gen);
+            atomic_fetch_sub(&_mixPool.sleepers, 1);
+        }
+        gen = next;
+
+        if (!atomic_load(&_mixPool.run)) {
+            return NULL;
+        }
+        int nthreads = gen & 0xFF;
+        if (thread < nthreads) {
+            rtcheck_enter();
+            _mixPool.job(thread, nthreads);
+            rtcheck_leave();
+            atomic_fetch_sub_explicit(&_mixPool.pending, 1,
+                                      memory_order_release);
+        }
+    }
+}
+
+void mixpool_init()
+{
+    _mixPool.numThreads = 1;
+    _mixPool.job = NULL;
+    atomic_store(&_mixPool.gen, 0);
+    atomic_store(&_mixPool.pending, 0);
+    atomic_store(&_mixPool.sleepers, 0);
+    atomic_store(&_mixPool.run, false);
+}
+
+void mixpool_start(int threads, int priority)
+{
+    // More threads than CPUs would leave the audio thread waiting on workers
+    // that aren't running.
+    cpu_set_t cpus;
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) != 0) {
+        return;
+    }
+    if (threads > CPU_COUNT(&cpus)) {
+        threads = CPU_COUNT(&cpus);
+    }
+    if (threads > MIX_MAX_THREADS) {
+        threads = MIX_MAX_THREADS;
+    }
+    if (threads <= 1) {
+        return;
+    }
+
+    // The CPUs we may run on, for pinning.
+    int cpu[CPU_SETSIZE];
+    int numCpus = 0;
+    for (int i = 0; i < CPU_SETSIZE; ++i) {
+        if (CPU_ISSET(i, &cpus)) {
+            cpu[numCpus++] = i;
+        }
+    }
+
+    // Workers start waiting for the job after gen 0.
+    atomic_store(&_mixPool.gen, 0);
+    atomic_store(&_mixPool.run, true);
+    bool schedFailed = false, pinFailed = false;
+
+    for (int i = 1; i < threads; ++i) {
+        _mixPool.bus[i] = aligned_alloc(64, 2 * JACK_BUF_SIZE * sizeof(mix_t));
+        if (_mixPool.bus[i] == NULL) {
+            printf("Failed to allocate mix bus.\n");
+            exit(1);
+        }
+
+        pthread_t *thread = &_mixPool.thread[i];
+        if (pthread_create(thread, NULL, _worker, (void *)(intptr_t) i)) {
+            printf("Mix: Failed to create worker thread.\n");
+            free(_mixPool.bus[i]);
+            break;
+        }
+        _mixPool.numThreads = i + 1;
+
+        // Real-time scheduling, if allowed.
+        struct sched_param param = {.sched_priority = priority };
+        if (priority >= 0 &&
+            pthread_setschedparam(*thread, SCHED_FIFO, &param) != 0) {
+            schedFailed = true;
+        }
+
+        // Pin each worker to its own CPU. The audio thread isn't pinned, so
+        // it's left the first one.
+        cpu_set_t pin;
+        CPU_ZERO(&pin);
+        CPU_SET(cpu[i % numCpus], &pin);
+        if (pthread_setaffinity_np(*thread, sizeof(pin), &pin) != 0) {
+            pinFailed = true;
+        }
+    }
+
+    if (schedFailed) {
+        printf("Mix: Real-time scheduling failed, check rtprio limits.\n");
+    }
+    if (pinFailed) {
+        printf("Mix: Failed to pin worker threads.\n");
+    }
+    printf("Mix threads: %i\n", _mixPool.numThreads);
+}
+
+void mixpool_stop()
+{
+    if (_mixPool.numThreads <= 1) {
+        return;
+    }
+
+    atomic_store(&_mixPool.run, false);
+    atomic_fetch_add(&_mixPool.gen, 1 << 8);
+    _futex_wake(&_mixPool.gen);
+
+    for (int i = 1; i < _mixPool.numThreads; ++i) {
+        pthread_join(_mixPool.thread[i], NULL);
+        free(_mixPool.bus[i]);
+    }
+    _mixPool.numThreads = 1;
+}
+
+void mixpool_run(MixJob job, int nthreads)
+{
+    _mixPool.job = job;
+    atomic_store(&_mixPool.pending, nthreads - 1);
+
+    // Start the workers, waking any that are asleep.
+    uint32_t gen = atomic_load(&_mixPool.gen);
+    atomic_store(&_mixPool.gen, ((gen >> 8) + 1) << 8 | nthreads);
+    if (atomic_load(&_mixPool.sleepers) > 0) {
+        _futex_wake(&_mixPool.gen);
+    }
+
+    job(0, nthreads);
+
+    while (atomic_load_explicit(&_mixPool.pending, memory_order_acquire) > 0) {
+        _mm_pause();
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef MIXPOOL_H_
+#define MIXPOOL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "global.h"
+
+#define MIX_MAX_THREADS 64
+#define MIX_MIN_VOICES 16       // Voices per thread worth waking a worker.
+#define MIX_SPIN 20000          // Polls before an idle worker sleeps.
+
+// MixJob: Work run by every thread taking part in a job. thread runs from 0,
+// the calling thread, to nthreads - 1.
+typedef void (*MixJob) (int thread, int nthreads);
+
+// MixPool: Worker threads that help the audio thread mix. Workers spin for a
+// short time after each job, then sleep on a futex, so jobs started within a
+// callback don't wait for a wake-up. Each worker has a private bus to mix
+// into. Nothing is allocated once the pool is started.
+typedef struct {
+    int numThreads;             // Including the audio thread.
+    pthread_t thread[MIX_MAX_THREADS];
+    mix_t *bus[MIX_MAX_THREADS];        // Per worker, unused for thread 0.
+
+    // The job number and the number of threads taking part are published
+    // together in gen, as job << 8 | threads. A worker that sees a job it
+    // isn't part of never reads job, which may already be changing.
+    MixJob job;
+    _Atomic uint32_t gen;
+    _Atomic int pending;        // Workers still running the current job.
+    _Atomic int sleepers;       // Workers waiting on the futex.
+    _Atomic bool run;
+} MixPool;
+
+// There is only one, global mix pool.
+MixPool _mixPool;
+
+// mixpool_init: Initialize with no workers.
+void mixpool_init();
+
+// mixpool_start: Start threads - 1 workers, limited by the number of CPUs.
+// Workers are pinned to their own CPU, and run with SCHED_FIFO at the given
+// priority, if it isn't negative and the system allows it.
+void mixpool_start(int threads, int priority);
+
+// mixpool_stop: Stop and join the workers.
+void mixpool_stop();
+
+// mixpool_threads: Return the number of threads, including the audio thread.
+static inline int mixpool_threads()
+{
+    return _mixPool.numThreads;
+}
+
+// mixpool_bus: Return the private bus of worker thread.
+static inline mix_t *mixpool_bus(int thread)
+{
+    return _mixPool.bus[thread];
+}
+
+// mixpool_run: Run job on nthreads threads, including the calling thread as
+// thread 0, and return when all of them are done. nthreads must not exceed
+// mixpool_threads.
+void mixpool_run(MixJob job, int nthreads);
+
+#endif                          // MIXPOOL_H_
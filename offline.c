@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sndfile.h>
+#include "global.h"
+#include "midifile.h"
+#include "stats.h"
+#include "offline.h"
+#include "sampler.h"
+#include "rtcheck.h"
+
+static const char *errOutFile = "Failed to open output file.";
+static const char *errWrite = "Failed to write output file.";
+static const char *errRtCheck = "Real-time check failed.";
+
+static const char *_render(SNDFILE * sndFile, MidiEvent * events, int count)
+{
+    float outL[OFFLINE_BLOCK], outR[OFFLINE_BLOCK];
+    float outLR[2 * OFFLINE_BLOCK];
+
+    uint64_t frame = 0;
+    uint64_t tailEnd = 0;
+    int ev = 0;
+
+    if (count > 0) {
+        tailEnd = events[count - 1].frame;
+    }
+    tailEnd += OFFLINE_MAX_TAIL * SAMPLE_RATE;
+
+    while (frame < tailEnd) {
+        // Queue the events in this block. They're played at their frame.
+        while (ev < count && events[ev].frame < frame + OFFLINE_BLOCK) {
+            sampler_midi_message(events[ev].data, events[ev].frame);
+            ++ev;
+        }
+
+        sampler_process(OFFLINE_BLOCK, outL, outR);
+
+        for (int i = 0; i < OFFLINE_BLOCK; ++i) {
+            outLR[2 * i] = outL[i];
+            outLR[2 * i + 1] = outR[i];
+        }
+
+        if (sf_writef_float(sndFile, outLR, OFFLINE_BLOCK) != OFFLINE_BLOCK) {
+            return errWrite;
+        }
+
+        frame += OFFLINE_BLOCK;
+
+        // Done once all events are processed and everything has faded out.
+        if (ev == count && sampler_num_playing() == 0) {
+            break;
+        }
+    }
+
+    printf("Rendered %.2f seconds.\n", (double)frame / SAMPLE_RATE);
+    printf("Callback stats: ");
+    stats_dump(stdout);
+
+    // Only counted in RT_CHECK builds, where a render is a test of the
+    // audio path.
+    if (rtcheck_violations() > 0) {
+        printf("Real-time violations: %ld\n", rtcheck_violations());
+        return errRtCheck;
+    }
+    return NULL;
+}
+
+const char *offline_render(char *dir, char *midiPath, char *outPath)
+{
+    MidiEvent *events;
+    int count;
+
+    // Read the midi file and open the output before loading, since loading
+    // changes the working directory.
+    const char *err = midifile_load(midiPath, &events, &count);
+    if (err != NULL) {
+        return err;
+    }
+    printf("Read %i midi events.\n", count);
+
+    SF_INFO fileInfo;
+    fileInfo.samplerate = SAMPLE_RATE;
+    fileInfo.channels = 2;
+    fileInfo.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+
+    SNDFILE *sndFile = sf_open(outPath, SFM_WRITE, &fileInfo);
+    if (sndFile == NULL) {
+        free(events);
+        return errOutFile;
+    }
+
+    err = sampler_load(dir);
+    if (err == NULL) {
+        err = _render(sndFile, events, count);
+        sampler_unload();
+    }
+
+    if (sf_close(sndFile) != 0 && err == NULL) {
+        err = errWrite;
+    }
+    free(events);
+    return err;
+}
@@ -0,0 +1,16 @@
+#ifndef OFFLINE_H_
+#define OFFLINE_H_
+
+// Number of frames rendered per call to sampler_process.
+#define OFFLINE_BLOCK 64
+
+// Maximum number of seconds rendered after the final midi event while
+// waiting for playing samples to finish.
+#define OFFLINE_MAX_TAIL 30
+
+// offline_render: Load the instrument in dir and render the midi file at
+// midiPath to a stereo WAV file at outPath as fast as possible. The sampler
+// must be initialized, but not connected to jack. Returns NULL if successful.
+const char *offline_render(char *dir, char *midiPath, char *outPath);
+
+#endif                          // OFFLINE_H_
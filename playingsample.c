@@ -1 +0,0 @@
-#include "playingsample.h"
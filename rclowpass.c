@@ -1,60 +1,130 @@
 #include <math.h>
+#include <string.h>
 #include <x86intrin.h>
 #include <stdint.h>
 #include "global.h"
-#include "mem.h"
+#include "rclowpass.h"
+
+#define RC_GROUPS (RC_MAX_ORDER / 4)
 
 static double _freq3db(double freq, int order) {
     return freq / sqrt(pow(2.0, 1.0/((double)order)) - 1.0);
 }
 
-static void _rcLowPass1(int16_t *x, __m128d *tmp, int len, double freq) {
-    double rc = 1.0 / (freq * 2.0 * 3.14);
-    double dt = 1.0 / SAMPLE_RATE;
-    double alpha = dt / (rc + dt);
-
-    __m128d LR;
-    __m128d max = _mm_setzero_pd();
-
-    tmp[0][0] = (double)x[0];
-    tmp[0][1] = (double)x[1];
+// A cascade of one-pole filters for one channel, run as a pipeline: lane k
+// of group g holds stage 4g + k, one frame behind the stage before it, so
+// every stage is updated by the same vector operation each frame.
+typedef struct {
+    __m128 y[RC_GROUPS];
+    __m128 alpha;
+    int groups;
+    int outGroup, outLane;      // The last stage.
+} _Cascade;
 
-    for(int i = 1; i < len; ++i) {
-        LR[0] = (double)x[2*i];
-        LR[1] = (double)x[2*i + 1];
-        tmp[i] = tmp[i-1] + (alpha*(LR - tmp[i-1]));
+static void _cascade_init(_Cascade *c, float x0, int order, float alpha) {
+    c->alpha = _mm_set1_ps(alpha);
+    c->groups = (order + 3) / 4;
+    c->outGroup = (order - 1) / 4;
+    c->outLane = (order - 1) % 4;
 
-        max = _mm_max_pd(max, tmp[i]);
-        max = _mm_max_pd(max, -tmp[i]);
+    // Every stage starts at the first input value.
+    for(int g = 0; g < c->groups; ++g) {
+        c->y[g] = _mm_set1_ps(x0);
     }
+}
 
+// Feed the next input frame to the first stage, and every other stage the
+// previous output of the stage before it.
+static inline void _cascade_step(_Cascade *c, float x) {
+    __m128 in = _mm_set_ss(x);
+    for(int g = 0; g < c->groups; ++g) {
+        __m128 y = c->y[g];
+        __m128 prev = _mm_castsi128_ps(
+            _mm_slli_si128(_mm_castps_si128(y), 4));
+        prev = _mm_move_ss(prev, in);
+        in = _mm_shuffle_ps(y, y, _MM_SHUFFLE(3, 3, 3, 3));
+        c->y[g] = _mm_add_ps(y, _mm_mul_ps(c->alpha, _mm_sub_ps(prev, y)));
+    }
+}
 
-    double dMax = max[0];
-    if(max[1] > max[0]) {
-        dMax = max[1];
+static inline float _cascade_out(const _Cascade *c) {
+    __m128 y = c->y[c->outGroup];
+    switch(c->outLane) {
+    case 1:
+        y = _mm_shuffle_ps(y, y, _MM_SHUFFLE(1, 1, 1, 1));
+        break;
+    case 2:
+        y = _mm_shuffle_ps(y, y, _MM_SHUFFLE(2, 2, 2, 2));
+        break;
+    case 3:
+        y = _mm_shuffle_ps(y, y, _MM_SHUFFLE(3, 3, 3, 3));
+        break;
     }
+    return _mm_cvtss_f32(y);
+}
 
-    double factor = INT16_MAX / dMax;
+// Run the cascade over the data. The last stage lags the input by order - 1
+// frames, so the input's last frame is repeated to flush it. If out is NULL
+// the output's peak is returned, otherwise the output is scaled and written
+// to out.
+static float _run(const int16_t *in, int16_t *out, int len, int order,
+                  float alpha, float scale) {
+    _Cascade L, R;
+    _cascade_init(&L, in[0], order, alpha);
+    _cascade_init(&R, in[1], order, alpha);
 
-    for(int i = 0; i < len; ++i) {
-        LR = tmp[i] * factor;
-        x[2*i] = (int16_t)LR[0];
-        x[2*i+1] = (int16_t)LR[1];
+    float peak = 0;
+    for(int i = 0; i < len + order - 1; ++i) {
+        if(i > 0) {
+            int j = i < len ? i : len - 1;
+            _cascade_step(&L, in[2*j]);
+            _cascade_step(&R, in[2*j + 1]);
+        }
+
+        // Writing frame t never overwrites input that's still to be read.
+        int t = i - (order - 1);
+        if(t < 0) {
+            continue;
+        }
+        float yL = _cascade_out(&L);
+        float yR = _cascade_out(&R);
+        if(out == NULL) {
+            peak = fmaxf(peak, fmaxf(fabsf(yL), fabsf(yR)));
+        } else {
+            out[2*t] = (int16_t)lrintf(yL * scale);
+            out[2*t + 1] = (int16_t)lrintf(yR * scale);
+        }
     }
+    return peak;
 }
 
-void rcLowPass(int16_t *out, int len, double freq, int order) {
+void rcLowPass(const int16_t *in, int16_t *out, int len, double freq,
+               int order) {
+    if(len <= 0) {
+        return;
+    }
+    if(order <= 0) {
+        memmove(out, in, 2 * len * sizeof(int16_t));
+        return;
+    }
+    if(order > RC_MAX_ORDER) {
+        order = RC_MAX_ORDER;
+    }
+
     // Find the 3db frequency for a given order.
     freq = _freq3db(freq, order);
+    double rc = 1.0 / (freq * 2.0 * 3.14);
+    double dt = 1.0 / SAMPLE_RATE;
+    float alpha = dt / (rc + dt);
 
-    // Allocate a temporary array for our work.
-    __m128d *tmp = malloc_exit(len * sizeof(__m128d));
-
-    // Perform the number of low-pass operations requested by `order`.
-    for(int i = 0; i < order; ++i) {
-        _rcLowPass1(out, tmp, len, freq);
+    // The filters are linear, so normalizing the output's peak to full scale
+    // once is the same as normalizing after every stage. The cascade is
+    // cheap, so it's run twice rather than keeping its output: once for the
+    // peak, then to write the output.
+    float peak = _run(in, NULL, len, order, alpha, 0);
+    if(peak == 0) {
+        memset(out, 0, 2 * len * sizeof(int16_t));
+        return;
     }
-
-    // Free our temporary memory.
-    free(tmp);
+    _run(in, out, len, order, alpha, INT16_MAX / peak);
 }
@@ -3,6 +3,12 @@
 
 #include <stdint.h>
 
-void rcLowPass(int16_t *out, int len, double freq, int order);
+#define RC_MAX_ORDER 16         // Higher orders are clamped.
+
+// rcLowPass: Filter len frames of interleaved stereo data from in to out with
+// order cascaded one-pole RC low-pass filters, normalizing the peak to full
+// scale. in and out may be the same.
+void rcLowPass(const int16_t *in, int16_t *out, int len, double freq,
+               int order);
 
 #endif // RCLOWPASS_H_
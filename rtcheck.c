@@ -0,0 +1,304 @@
+#ifdef RT_CHECK
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <execinfo.h>
+#include <sys/mman.h>
+#include "rtcheck.h"
+
+// Call sites reported, so a call made every period is only reported once.
+#define SITES 256
+#define FRAMES 32
+
+static _Thread_local bool _rt;
+static bool _abort;
+static _Atomic long _violations;
+static void *_Atomic _sites[SITES];
+
+// Load the unwinder now, as the first backtrace allocates.
+__attribute__ ((constructor))
+static void _init()
+{
+    void *frames[1];
+    backtrace(frames, 1);
+    _abort = getenv("JLSAMPLER_RT_ABORT") != NULL;
+}
+
+void rtcheck_enter()
+{
+    _rt = true;
+}
+
+void rtcheck_leave()
+{
+    _rt = false;
+}
+
+long rtcheck_violations()
+{
+    return atomic_load(&_violations);
+}
+
+// Return true if site hasn't been reported, and record it.
+static bool _new_site(void *site)
+{
+    for (int i = 0; i < SITES; ++i) {
+        void *expected = NULL;
+        if (atomic_compare_exchange_strong(&_sites[i], &expected, site)) {
+            return true;
+        }
+        if (expected == site) {
+            return false;
+        }
+    }
+    return false;
+}
+
+// Count a call to func. Not inlined, so the call site is always two frames
+// up. Reporting is done unmarked, as it prints.
+__attribute__ ((noinline))
+static void _violation(const char *func)
+{
+    atomic_fetch_add(&_violations, 1);
+    _rt = false;
+
+    void *frames[FRAMES];
+    int n = backtrace(frames, FRAMES);
+    if (n > 2 && _new_site(frames[2])) {
+        fprintf(stderr, "RT check: %s called on a real-time thread:\n", func);
+        backtrace_symbols_fd(frames + 2, n - 2, STDERR_FILENO);
+    }
+    if (_abort) {
+        abort();
+    }
+    _rt = true;
+}
+
+#define CHECK(func) do { \
+        if (_rt) { \
+            _violation(func); \
+        } \
+    } while (0)
+
+// ----------------------------------------------------------------------------
+// Allocation
+// ----------------------------------------------------------------------------
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *p, size_t size);
+void __real_free(void *p);
+int __real_posix_memalign(void **p, size_t align, size_t size);
+void *__real_aligned_alloc(size_t align, size_t size);
+void *__real_mmap(void *addr, size_t len, int prot, int flags, int fd,
+                  off_t off);
+int __real_munmap(void *addr, size_t len);
+
+void *__wrap_malloc(size_t size)
+{
+    CHECK("malloc");
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    CHECK("calloc");
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *p, size_t size)
+{
+    CHECK("realloc");
+    return __real_realloc(p, size);
+}
+
+void __wrap_free(void *p)
+{
+    if (p != NULL) {
+        CHECK("free");
+    }
+    __real_free(p);
+}
+
+int __wrap_posix_memalign(void **p, size_t align, size_t size)
+{
+    CHECK("posix_memalign");
+    return __real_posix_memalign(p, align, size);
+}
+
+void *__wrap_aligned_alloc(size_t align, size_t size)
+{
+    CHECK("aligned_alloc");
+    return __real_aligned_alloc(align, size);
+}
+
+void *__wrap_mmap(void *addr, size_t len, int prot, int flags, int fd,
+                  off_t off)
+{
+    CHECK("mmap");
+    return __real_mmap(addr, len, prot, flags, fd, off);
+}
+
+int __wrap_munmap(void *addr, size_t len)
+{
+    CHECK("munmap");
+    return __real_munmap(addr, len);
+}
+
+// ----------------------------------------------------------------------------
+// Locking and sleeping
+// ----------------------------------------------------------------------------
+
+int __real_pthread_mutex_lock(pthread_mutex_t * m);
+int __real_pthread_cond_wait(pthread_cond_t * c, pthread_mutex_t * m);
+int __real_pthread_cond_timedwait(pthread_cond_t * c, pthread_mutex_t * m,
+                                  const struct timespec *ts);
+int __real_usleep(useconds_t us);
+
+int __wrap_pthread_mutex_lock(pthread_mutex_t * m)
+{
+    CHECK("pthread_mutex_lock");
+    return __real_pthread_mutex_lock(m);
+}
+
+int __wrap_pthread_cond_wait(pthread_cond_t * c, pthread_mutex_t * m)
+{
+    CHECK("pthread_cond_wait");
+    return __real_pthread_cond_wait(c, m);
+}
+
+int __wrap_pthread_cond_timedwait(pthread_cond_t * c, pthread_mutex_t * m,
+                                  const struct timespec *ts)
+{
+    CHECK("pthread_cond_timedwait");
+    return __real_pthread_cond_timedwait(c, m, ts);
+}
+
+int __wrap_usleep(useconds_t us)
+{
+    CHECK("usleep");
+    return __real_usleep(us);
+}
+
+// ----------------------------------------------------------------------------
+// File I/O
+// ----------------------------------------------------------------------------
+
+int __real_open(const char *path, int flags, ...);
+FILE *__real_fopen(const char *path, const char *mode);
+ssize_t __real_read(int fd, void *buf, size_t count);
+ssize_t __real_write(int fd, const void *buf, size_t count);
+size_t __real_fread(void *p, size_t size, size_t n, FILE * f);
+size_t __real_fwrite(const void *p, size_t size, size_t n, FILE * f);
+
+int __wrap_open(const char *path, int flags, ...)
+{
+    CHECK("open");
+    mode_t mode = 0;
+    if (flags & O_CREAT) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+    return __real_open(path, flags, mode);
+}
+
+FILE *__wrap_fopen(const char *path, const char *mode)
+{
+    CHECK("fopen");
+    return __real_fopen(path, mode);
+}
+
+ssize_t __wrap_read(int fd, void *buf, size_t count)
+{
+    CHECK("read");
+    return __real_read(fd, buf, count);
+}
+
+ssize_t __wrap_write(int fd, const void *buf, size_t count)
+{
+    CHECK("write");
+    return __real_write(fd, buf, count);
+}
+
+size_t __wrap_fread(void *p, size_t size, size_t n, FILE * f)
+{
+    CHECK("fread");
+    return __real_fread(p, size, n, f);
+}
+
+size_t __wrap_fwrite(const void *p, size_t size, size_t n, FILE * f)
+{
+    CHECK("fwrite");
+    return __real_fwrite(p, size, n, f);
+}
+
+// ----------------------------------------------------------------------------
+// Console output. The compiler turns some printf calls into puts and
+// putchar, so those are trapped too.
+// ----------------------------------------------------------------------------
+
+int __real_vprintf(const char *fmt, va_list ap);
+int __real_vfprintf(FILE * f, const char *fmt, va_list ap);
+int __real_puts(const char *s);
+int __real_putchar(int c);
+int __real_fputs(const char *s, FILE * f);
+
+int __wrap_vprintf(const char *fmt, va_list ap)
+{
+    CHECK("vprintf");
+    return __real_vprintf(fmt, ap);
+}
+
+int __wrap_vfprintf(FILE * f, const char *fmt, va_list ap)
+{
+    CHECK("vfprintf");
+    return __real_vfprintf(f, fmt, ap);
+}
+
+int __wrap_printf(const char *fmt, ...)
+{
+    CHECK("printf");
+    va_list ap;
+    va_start(ap, fmt);
+    int ret = __real_vprintf(fmt, ap);
+    va_end(ap);
+    return ret;
+}
+
+int __wrap_fprintf(FILE * f, const char *fmt, ...)
+{
+    CHECK("fprintf");
+    va_list ap;
+    va_start(ap, fmt);
+    int ret = __real_vfprintf(f, fmt, ap);
+    va_end(ap);
+    return ret;
+}
+
+int __wrap_puts(const char *s)
+{
+    CHECK("puts");
+    return __real_puts(s);
+}
+
+int __wrap_putchar(int c)
+{
+    CHECK("putchar");
+    return __real_putchar(c);
+}
+
+int __wrap_fputs(const char *s, FILE * f)
+{
+    CHECK("fputs");
+    return __real_fputs(s, f);
+}
+
+#endif                          // RT_CHECK
@@ -0,0 +1,39 @@
+#ifndef RTCHECK_H_
+#define RTCHECK_H_
+
+// Real-time safety audit. In builds made with RT_CHECK=1, calls from our
+// code to allocation, locking, file and console I/O and sleeping functions
+// are routed through rtcheck.c by the linker. If one is made while the
+// calling thread is marked real-time, it's counted, and its call site is
+// reported on stderr with a backtrace the first time. If JLSAMPLER_RT_ABORT
+// is set in the environment, the process aborts instead, for a debugger or
+// core dump. In other builds the functions below do nothing.
+#ifdef RT_CHECK
+
+// rtcheck_enter: Mark the calling thread as real-time until rtcheck_leave.
+void rtcheck_enter();
+
+// rtcheck_leave: Unmark the calling thread.
+void rtcheck_leave();
+
+// rtcheck_violations: Return the number of calls trapped so far.
+long rtcheck_violations();
+
+#else
+
+static inline void rtcheck_enter()
+{
+}
+
+static inline void rtcheck_leave()
+{
+}
+
+static inline long rtcheck_violations()
+{
+    return 0;
+}
+
+#endif                          // RT_CHECK
+
+#endif                          // RTCHECK_H_
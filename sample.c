@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <dirent.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sndfile.h>
 #include <x86intrin.h>
 #include <stdbool.h>
@@ -13,59 +14,242 @@
 #include "conftuning.h"
 #include "rclowpass.h"
 #include "mem.h"
+#include "stats.h"
+#include "samplebuf.h"
+#include "samplemem.h"
+#include "samplecache.h"
+
+// Used for both initialization and freeing data. Only loaded samples are
+// visited, and each drops its buffer reference.
+static void _sstore_init(SampleStore * ss, int freeMem)
+{
+    int key, layer, var;
+    Sample *sample;
+
+    for (key = 0; key < 128; ++key) {
+        SampleKey *k = &(ss->key[key]);
+        for (layer = 0; freeMem && layer < k->numLayers; ++layer) {
+            for (var = 0; var < k->layer[layer].numSamples; ++var) {
+                sample = &(k->layer[layer].sample[var]);
+                sbuf_unref(sample->buf);
+            }
+            free(k->layer[layer].sample);
+        }
+        if (freeMem) {
+            free(k->layer);
+        }
+        k->numLayers = 0;
+        k->layer = NULL;
+    }
+}
+
+static void _init_sample(Sample * sample)
+{
+    sample->buf = NULL;
+    sample->copied = false;
+    sample->len = 0;
+    sample->idx0 = 0;
+    sample->rms = 0;
+    sample->speed = 1;
+    sample->data = NULL;
+    sample->pack = NULL;
+    sample->cacheOffset = SAMPLE_NOT_CACHED;
+}
 
 // ----------------------------------------------------------------------------
-// sample_interp
+// sstore_add_sample
 // ----------------------------------------------------------------------------
-inline void sample_interp(Sample * sample, double idx, __m128d * LR)
+
+Sample *sstore_add_sample(SampleStore * ss, int key, int layer, int var)
 {
-    __m128d a, b;
-    int i = (int)idx;
-    double mu = idx - (double)i;
+    SampleKey *k = &(ss->key[key]);
 
-    a[0] = (double)sample->data[2 * i];
-    a[1] = (double)sample->data[2 * i + 1];
+    if (layer >= k->numLayers) {
+        SampleLayer *layers = malloc_exit((layer + 1) * sizeof(SampleLayer));
+        if (k->numLayers) {
+            memcpy(layers, k->layer, k->numLayers * sizeof(SampleLayer));
+        }
+        for (int i = k->numLayers; i <= layer; ++i) {
+            layers[i].numSamples = 0;
+            layers[i].rrIdx = 0;
+            layers[i].sample = NULL;
+        }
+        free(k->layer);
+        k->layer = layers;
+        k->numLayers = layer + 1;
+    }
 
-    b[0] = (double)sample->data[2 * i + 2];
-    b[1] = (double)sample->data[2 * i + 3];
+    // A negative var only adds the layer.
+    if (var < 0) {
+        return NULL;
+    }
 
-    *LR = (a + mu * (b - a));
+    SampleLayer *l = &(k->layer[layer]);
+    if (var >= l->numSamples) {
+        Sample *samples = malloc_exit((var + 1) * sizeof(Sample));
+        if (l->numSamples) {
+            memcpy(samples, l->sample, l->numSamples * sizeof(Sample));
+        }
+        for (int i = l->numSamples; i <= var; ++i) {
+            _init_sample(&samples[i]);
+        }
+        free(l->sample);
+        l->sample = samples;
+        l->numSamples = var + 1;
+    }
+
+    return &(l->sample[var]);
 }
 
-// Used for both initialization and freeing data.
-static void _sstore_init(int freeMem)
+// ----------------------------------------------------------------------------
+// sample_alloc_data
+// ----------------------------------------------------------------------------
+
+int16_t *sample_alloc_data(int len)
 {
-    int key, layer, var;
-    Sample *sample;
+    int16_t *data = smem_alloc(2 * (len + 2 * SAMPLE_PAD) * sizeof(int16_t));
+    return data + 2 * SAMPLE_PAD;
+}
 
-    for (key = 0; key < 128; ++key) {
-        _sStore.numLayers[key] = 0;
-        for (layer = 0; layer < MAX_LAYERS; ++layer) {
-            _sStore.numSamples[key][layer] = 0;
-            _sStore.rrIdx[key][layer] = 0;
-            for (var = 0; var < MAX_VARS; ++var) {
-                sample = &(_sStore.sample[key][layer][var]);
-                sample->owner = 0;
-                sample->len = 0;
-                sample->idx0 = 0;
-                sample->rms = 0;
-                sample->speed = 1;
-                if (freeMem && sample->data != NULL && sample->owner) {
-                    free(sample->data);
-                }
-                sample->data = NULL;
-            }
-        }
+void sample_free_data(int16_t * data)
+{
+    smem_free(data - 2 * SAMPLE_PAD);
+}
+
+// ----------------------------------------------------------------------------
+// sample_file_stat
+// ----------------------------------------------------------------------------
+
+bool sample_file_stat(DIR * dir, const struct dirent *entry,
+                      struct stat *st)
+{
+    if (entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN) {
+        return false;
     }
+    return fstatat(dirfd(dir), entry->d_name, st, 0) == 0 &&
+        S_ISREG(st->st_mode);
 }
 
 // ----------------------------------------------------------------------------
-// sstore_init
+// sstore_init, sstore_new, sstore_free
 // ----------------------------------------------------------------------------
 
-void sstore_init()
+void sstore_init(SampleStore * ss)
+{
+    _sstore_init(ss, 0);
+}
+
+SampleStore *sstore_new()
+{
+    SampleStore *ss = malloc_exit(sizeof(SampleStore));
+    sstore_init(ss);
+    return ss;
+}
+
+void sstore_free(SampleStore * ss)
 {
-    _sstore_init(0);
+    if (ss != NULL) {
+        sstore_free_data(ss);
+        free(ss);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Sample analysis. Each sample is cropped and its RMS computed as soon as it
+// has been read, while its data is still in cache.
+// ----------------------------------------------------------------------------
+
+// Return the first frame where either channel reaches th in magnitude, or len
+// if there is none. Four frames are compared at a time.
+static int _crop_frame(const int16_t * data, int len, int th)
+{
+    if (th <= 0) {
+        return 0;
+    }
+    if (th > INT16_MAX) {
+        return len;
+    }
+
+    __m128i hi = _mm_set1_epi16(th - 1);
+    __m128i lo = _mm_set1_epi16(1 - th);
+    int i = 0;
+    for (; i + 4 <= len; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(data + 2 * i));
+        __m128i hit = _mm_or_si128(_mm_cmpgt_epi16(x, hi),
+                                   _mm_cmplt_epi16(x, lo));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask) / 4;
+        }
+    }
+    for (; i < len; ++i) {
+        if (abs(data[2 * i]) >= th || abs(data[2 * i + 1]) >= th) {
+            return i;
+        }
+    }
+    return len;
+}
+
+// Return the RMS of the interleaved values i0 to i1, scaled to 0-1. Squares
+// are summed exactly, eight values at a time.
+static double _rms(const int16_t * data, int i0, int i1)
+{
+    if (i1 <= i0) {
+        return 0;
+    }
+
+    // A pair of squares can reach 2^31, so the sums are widened unsigned.
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    int i = i0;
+    for (; i + 8 <= i1; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i sq = _mm_madd_epi16(x, x);
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, zero));
+    }
+
+    uint64_t sums[2];
+    _mm_storeu_si128((__m128i *) sums, acc);
+    uint64_t sum = sums[0] + sums[1];
+    for (; i < i1; ++i) {
+        sum += (int32_t) data[i] * data[i];
+    }
+
+    return sqrt((double)sum / (i1 - i0)) * INT16_SCALE;
+}
+
+static void _crop_sample(Sample * sample, int th)
+{
+    sample->idx0 = _crop_frame(sample->data, sample->len, th);
+}
+
+static void _compute_sample_rms(Sample * sample, int di)
+{
+    int iMax = sample->idx0 + di;
+    if (iMax > sample->len) {
+        iMax = sample->len;
+    }
+    sample->rms = _rms(sample->data, sample->idx0, 2 * iMax);
+}
+
+// Crop a sample and compute its RMS from the new start.
+static void _analyze_sample(Sample * sample, int th, int di)
+{
+    if (sample->data != NULL) {
+        _crop_sample(sample, th);
+        _compute_sample_rms(sample, di);
+    }
+}
+
+static int _crop_th(double th)
+{
+    return (int)(th / INT16_SCALE);
+}
+
+static int _rms_frames(double dt)
+{
+    return (int)(dt * SAMPLE_RATE);
 }
 
 // ----------------------------------------------------------------------------
@@ -86,7 +270,9 @@ static int _parse_sample_filename(char *name, int *key, int *layer, int *var)
     return 0;
 }
 
-static void _load_sample(Sample * s, char *fn, double st)
+// Load the sample file. Returns true if its data is shared with an identical
+// sample.
+static bool _load_sample(Sample * s, char *fn, double st)
 {
     if (s->data != NULL) {
         printf("Attempt to load already loaded sample.\n");
@@ -101,46 +287,108 @@ static void _load_sample(Sample * s, char *fn, double st)
 
     if (fileInfo.channels != 2) {
         printf("Samples must be stereo files.\n");
-        return;
+        return false;
     }
 
     if (fileInfo.samplerate != 48000) {
         printf("Samples must be 48 kHz.\n");
-        return;
+        return false;
     }
 
-    s->owner = 1;
     s->len = fileInfo.frames;
     s->idx0 = 0;
     s->rms = 1.0;
     s->speed = pow(2.0, st / 12.0);
 
-    // We over-allocate our array by one sample for each channel.
-    // This makes our interpolation code simpler, as we can rely on having an
-    // extra zero sample beyond the final one.
-    s->data = malloc_exit(2 * (s->len + 1) * sizeof(int16_t));
-    int count = sf_read_short(sndFile, s->data, 2 * fileInfo.frames);
+    // The data is padded with zeros on both sides. This makes our
+    // interpolation code simpler, as we can rely on having zero frames
+    // before the first one and beyond the final one.
+    int16_t *data = sample_alloc_data(s->len);
+    int count = sf_read_short(sndFile, data, 2 * fileInfo.frames);
     if (count != 2 * fileInfo.frames) {
         printf("Failed to read all samples for file: %s\n", fn);
         printf("    %i != %i\n", count, 2 * (int)fileInfo.frames);
         exit(1);
     }
 
+    // Files with the same content, in any instrument, share a buffer.
+    s->buf = sbuf_intern(data, s->len);
+    s->data = s->buf->data;
+
     if (sf_close(sndFile) != 0) {
         printf("Failed to close file: %s\n", fn);
+    }
+    return s->data != data;
+}
+
+// A sample file found in the samples directory.
+typedef struct {
+    char *name;
+    int64_t size;               // In bytes.
+    int key, layer, var;
+    double tuning;
+} _SampleFile;
+
+// Order files from largest to smallest.
+static int _cmp_size(const void *a, const void *b)
+{
+    int64_t sa = ((const _SampleFile *)a)->size;
+    int64_t sb = ((const _SampleFile *)b)->size;
+    return (sa < sb) - (sa > sb);
+}
+
+// Print progress every tenth of the files.
+static void _load_progress(int done, int count)
+{
+    if (done * 10 / count == (done - 1) * 10 / count) {
+        return;
+    }
+    StatsSummary s;
+    stats_summary(&s);
+    printf("Loaded %i of %i files, %.1f MB/s\n", done, count,
+           s.loadRate / 1e6);
+}
+
+// The copy in the layer above keeps the unfiltered buffer, so the reference
+// to it is dropped once filtered.
+static void _filter_sample(Sample *s, int order, int th, int di) {
+    if(s->data == NULL) {
+        return;
+    }
+    int16_t * newData = sample_alloc_data(s->len);
+    rcLowPass(s->data, newData, s->len, 10, order);
+    sbuf_unref(s->buf);
+    s->buf = sbuf_intern(newData, s->len);
+    s->data = s->buf->data;
+    _analyze_sample(s, th, di);
+}
+
+static bool _fake_rc_key(SampleStore * ss, int key)
+{
+    return sstore_num_layers(ss, key) == 1 &&
+        sstore_num_samples(ss, key, 0) != 0;
+}
+
+// Write the sample's data to the cache being built, if there is one, and
+// drop it.
+static void _spill(Sample * s, ScacheWriter * w)
+{
+    if (w == NULL || s->data == NULL) {
         return;
     }
-    // Zero out the additional left/right samples.
-    s->data[2 * s->len] = 0;
-    s->data[2 * s->len + 1] = 0;
+    s->cacheOffset = scache_writer_add(w, s->buf);
+    sbuf_unref(s->buf);
+    s->buf = NULL;
+    s->data = NULL;
 }
 
-void sstore_load()
+void sstore_load(SampleStore * ss, double th, double dt, int rcOrder,
+                 ScacheWriter * w)
 {
     DIR *dir;
     struct dirent *entry;
-    int key, layer, var, stop;
-    double tuning;
+    struct stat st;
+    int key, layer, var;
 
     dir = opendir(".");
     if (dir == NULL) {
@@ -148,26 +396,15 @@ void sstore_load()
         exit(1);
     }
 
-    stop = 0;
-#pragma omp parallel private(entry, key, layer, var, tuning)
-    while (!stop) {
-#pragma omp critical
-        {
-            entry = readdir(dir);
-            if (entry == NULL) {
-                stop = 1;
-                // This silences a warning about an uninitialized variable.
-                tuning = 0;
-            } else {
-                tuning = conftuning_semitones(entry->d_name);
-            }
-        }
+    // List the files and allocate the store first, so the store doesn't
+    // change while samples are loaded in parallel.
+    _SampleFile *files = NULL;
+    int count = 0, cap = 0;
+    int64_t bytes = 0;
 
-        if (stop) {
-            continue;
-        }
+    while ((entry = readdir(dir)) != NULL) {
         // Skip non-regular files and directories.
-        if (entry->d_type != DT_REG) {
+        if (!sample_file_stat(dir, entry, &st)) {
             continue;
         }
         // Skip incorrectly named files.
@@ -176,101 +413,121 @@ void sstore_load()
             continue;
         }
 
-        if (layer >= _sStore.numLayers[key]) {
-            _sStore.numLayers[key] = layer + 1;
-        }
-        if (var >= _sStore.numSamples[key][layer]) {
-            _sStore.numSamples[key][layer] = var + 1;
+        if (count == cap) {
+            cap = cap ? 2 * cap : 256;
+            _SampleFile *tmp = malloc_exit(cap * sizeof(_SampleFile));
+            if (count) {
+                memcpy(tmp, files, count * sizeof(_SampleFile));
+            }
+            free(files);
+            files = tmp;
         }
-        // Load sample with tuning information.
-        _load_sample(&(_sStore.sample[key][layer][var]), entry->d_name,
-                     tuning);
+
+        _SampleFile *f = &files[count++];
+        f->name = strdup(entry->d_name);
+        f->size = st.st_size;
+        f->key = key;
+        f->layer = layer;
+        f->var = var;
+        f->tuning = conftuning_semitones(entry->d_name);
+
+        bytes += st.st_size;
+
+        sstore_add_sample(ss, key, layer, var);
     }
 
     closedir(dir);
+
+    // Keys with a single layer get a low-passed copy of it below. The layer
+    // above is added now, and each sample is copied and filtered as it's
+    // loaded.
+    bool rc[128];
+    for (key = 0; key < 128; ++key) {
+        rc[key] = rcOrder != 0 && _fake_rc_key(ss, key);
+        if (rc[key]) {
+            sstore_add_sample(ss, key, 1, sstore_num_samples(ss, key, 0) - 1);
+        }
+    }
+    if (rcOrder != 0) {
+        printf("Creating fake RC layer, order %i...\n", rcOrder);
+    }
+
+    // Start with the largest files, so the last ones to finish are small
+    // and the threads finish together. Each file is read straight into its
+    // sample's data, so nothing beyond the store itself is allocated. When
+    // building a cache, the data is written and dropped as soon as it's
+    // processed, so only the samples being loaded are in memory.
+    qsort(files, count, sizeof(_SampleFile), _cmp_size);
+    stats_load_start(count, bytes);
+
+    // Load samples with tuning information.
+    int i, shared = 0;
+#pragma omp parallel for schedule(dynamic, 1) reduction(+:shared)
+    for (i = 0; i < count; ++i) {
+        _SampleFile *f = &files[i];
+        Sample *s = sstore_sample(ss, f->key, f->layer, f->var);
+        shared += _load_sample(s, f->name, f->tuning);
+        _analyze_sample(s, _crop_th(th), _rms_frames(dt));
+        if (rc[f->key]) {
+            // Copy to layer 2, and filter the original in layer 1.
+            Sample *copy = sstore_sample(ss, f->key, 1, f->var);
+            *copy = *s;
+            sbuf_ref(s->buf);
+            _spill(copy, w);
+            _filter_sample(s, rcOrder, _crop_th(th), _rms_frames(dt));
+        }
+        _spill(s, w);
+        _load_progress(stats_load_file(f->size), count);
+    }
+    stats_load_end();
+    if (shared > 0) {
+        printf("Shared data of %i identical samples.\n", shared);
+    }
+
+    for (i = 0; i < count; ++i) {
+        free(files[i].name);
+    }
+    free(files);
 }
 
 // ----------------------------------------------------------------------------
 // sstore_free_data
 // ----------------------------------------------------------------------------
 
-void sstore_free_data()
+void sstore_free_data(SampleStore * ss)
 {
-    _sstore_init(1);
+    _sstore_init(ss, 1);
 }
 
 // ----------------------------------------------------------------------------
-// sstore_crop
+// sstore_crop, sstore_compute_rms
 // ----------------------------------------------------------------------------
 
-static void _crop_sample(Sample * sample, int th)
-{
-    int i;
-
-    for (i = 0; i < sample->len; ++i) {
-        if (sample->data[2 * i] >= th ||
-            sample->data[2 * i] <= -th ||
-            sample->data[2 * i + 1] >= th || sample->data[2 * i + 1] <= -th) {
-            break;
-        }
-    }
-    sample->idx0 = i;
-}
-
-void sstore_crop(double thF)
+void sstore_crop(SampleStore * ss, double thF)
 {
-    int th = (int)(thF / INT16_SCALE);
+    int th = _crop_th(thF);
     int key, layer, var;
 
 #pragma omp parallel for private(key, layer, var) schedule(dynamic)
     for (key = 0; key < 128; ++key) {
-        for (layer = 0; layer < _sStore.numLayers[key]; ++layer) {
-            for (var = 0; var < _sStore.numSamples[key][layer]; ++var) {
-                _crop_sample(&(_sStore.sample[key][layer][var]), th);
+        for (layer = 0; layer < sstore_num_layers(ss, key); ++layer) {
+            for (var = 0; var < sstore_num_samples(ss, key, layer); ++var) {
+                _crop_sample(sstore_sample(ss, key, layer, var), th);
             }
         }
     }
 }
 
-// ----------------------------------------------------------------------------
-// sstore_compute_rms
-// ----------------------------------------------------------------------------
-
-void _compute_sample_rms(Sample * sample, int di)
-{
-    int iMax = sample->idx0 + di;
-    if (iMax > sample->len) {
-        iMax = sample->len;
-    }
-
-    iMax *= 2;
-
-    double x;
-    double rms = 0;
-    double count = 0;
-
-    int i;
-    for (i = sample->idx0; i < iMax; ++i) {
-        ++count;
-        x = (double)(sample->data[i] * INT16_SCALE);
-        rms += x * x;
-    }
-
-    rms /= count;
-    rms = sqrt(rms);
-    sample->rms = rms;
-}
-
-void sstore_compute_rms(double dt)
+void sstore_compute_rms(SampleStore * ss, double dt)
 {
     int key, layer, var;
-    int di = (int)(dt * SAMPLE_RATE);
+    int di = _rms_frames(dt);
 
 #pragma omp parallel for private(key, layer, var) schedule(dynamic)
     for (key = 0; key < 128; ++key) {
-        for (layer = 0; layer < _sStore.numLayers[key]; ++layer) {
-            for (var = 0; var < _sStore.numSamples[key][layer]; ++var) {
-                _compute_sample_rms(&(_sStore.sample[key][layer][var]), di);
+        for (layer = 0; layer < sstore_num_layers(ss, key); ++layer) {
+            for (var = 0; var < sstore_num_samples(ss, key, layer); ++var) {
+                _compute_sample_rms(sstore_sample(ss, key, layer, var), di);
             }
         }
     }
@@ -280,49 +537,66 @@ void sstore_compute_rms(double dt)
 // sstore_fill_samples
 // ----------------------------------------------------------------------------
 
-// Return true if a sample was coppied.
-static bool _copy_samples(int toKey, int fromKey, bool owned) {
+// Return true if a sample was coppied. Each copy takes a reference to the
+// buffer of the sample it was copied from.
+static bool _copy_samples(SampleStore * ss, int toKey, int fromKey,
+                          bool originals)
+{
     if(toKey < 0 || toKey > 127 || fromKey < 0 ||
        fromKey > 127 || toKey == fromKey) {
         return false;
     }
 
     // If fromKey doesn't have any layers, we can't do anything.
-    if(!_sStore.numLayers[fromKey]) {
+    if(!sstore_num_layers(ss, fromKey)) {
         return false;
     }
 
     // toKey should have the same number of layers. If it has 0, we'll do
     // a full copy.
-    if(_sStore.numLayers[toKey] == 0) {
-        _sStore.numLayers[toKey] = _sStore.numLayers[fromKey];
+    int numLayers = sstore_num_layers(ss, fromKey);
+    if(sstore_num_layers(ss, toKey) == 0) {
+        for(int layer = 0; layer < numLayers; ++layer) {
+            sstore_add_sample(ss, toKey, layer, -1);
+        }
     }
 
     // The number of layers must be the same - this is true when doing
     // borrowing.
-    if(_sStore.numLayers[toKey] != _sStore.numLayers[fromKey]) {
+    if(sstore_num_layers(ss, toKey) != numLayers) {
         return false;
     }
 
     bool coppied = false;
+    double speed = pow(2, (double)(toKey - fromKey) / 12);
+
+    for(int layer = 0; layer < numLayers; ++layer) {
+        // If we're doing borrowing for round-robbin, we only want the
+        // key's original samples.
+        int count = 0;
+        for(int var = 0; var < sstore_num_samples(ss, fromKey, layer); ++var) {
+            count += !originals ||
+                !sstore_sample(ss, fromKey, layer, var)->copied;
+        }
+        if(count == 0) {
+            continue;
+        }
 
-    for(int layer = 0; layer < _sStore.numLayers[toKey]; ++layer) {
-        for(int var = 0; var < _sStore.numSamples[fromKey][layer]; ++var) {
-            Sample *fromSample = &(_sStore.sample[fromKey][layer][var]);
+        // Grow the layer once for all the copies.
+        int toVar = sstore_num_samples(ss, toKey, layer);
+        sstore_add_sample(ss, toKey, layer, toVar + count - 1);
 
-            // If we're doing borrowing for round-robbin, we only want owned
-            // samples.
-            if(owned && !fromSample->owner) {
+        for(int var = 0; var < sstore_num_samples(ss, fromKey, layer); ++var) {
+            Sample *fromSample = sstore_sample(ss, fromKey, layer, var);
+            if(originals && fromSample->copied) {
                 continue;
             }
 
-            int toVar = _sStore.numSamples[toKey][layer];
-            Sample *toSample = &(_sStore.sample[toKey][layer][toVar]);
+            Sample *toSample = sstore_sample(ss, toKey, layer, toVar++);
             *toSample = *fromSample;
-            toSample->owner = false;
-            toSample->speed =
-                fromSample->speed * pow(2, (double)(toKey - fromKey) / 12);
-            _sStore.numSamples[toKey][layer]++;
+            toSample->copied = true;
+            sbuf_ref(toSample->buf);
+            toSample->speed = fromSample->speed * speed;
             coppied = true;
         }
     }
@@ -330,27 +604,33 @@ static bool _copy_samples(int toKey, int fromKey, bool owned) {
     return coppied;
 }
 
-void sstore_fill_samples()
+void sstore_fill_samples(SampleStore * ss)
 {
-    for(int i = 1; i < 127; ++i) {
-
-        // Fill from lower key.
-        int fromKey = 127;
-        while(--fromKey) {
-            int toKey = fromKey + 1;
-            if(_sStore.numLayers[toKey] == 0 &&
-               _sStore.numLayers[fromKey] != 0) {
-                _copy_samples(toKey, fromKey, false);
-            }
+    // Map every key to the nearest key with samples, preferring the lower
+    // key when both are as near.
+    int from[128];
+    int below = -1;
+    for(int key = 0; key < 128; ++key) {
+        if(sstore_num_layers(ss, key) != 0) {
+            below = key;
+        }
+        from[key] = below;
+    }
+    int above = -1;
+    for(int key = 127; key >= 0; --key) {
+        if(sstore_num_layers(ss, key) != 0) {
+            above = key;
+        }
+        if(above >= 0 && (from[key] < 0 || above - key < key - from[key])) {
+            from[key] = above;
         }
+    }
 
-        // Fill from upper key.
-        for(int fromKey = 0; fromKey < 127; ++fromKey) {
-            int toKey = fromKey - 1;
-            if(_sStore.numLayers[toKey] == 0 &&
-               _sStore.numLayers[fromKey] != 0) {
-                _copy_samples(toKey, fromKey, false);
-            }
+    // Copy in a single pass. Only keys that had samples are copied from, so
+    // the order doesn't matter.
+    for(int key = 0; key < 128; ++key) {
+        if(sstore_num_layers(ss, key) == 0 && from[key] >= 0) {
+            _copy_samples(ss, key, from[key], false);
         }
     }
 }
@@ -359,15 +639,17 @@ void sstore_fill_samples()
 // sstore_borrow_samples
 // ----------------------------------------------------------------------------
 
-void sstore_borrow_samples(int maxDist)
+void sstore_borrow_samples(SampleStore * ss, int maxDist)
 {
-    for(int dist = 1; dist < maxDist + 1; ++dist) {
-        for(int toKey = 0; toKey < 128; ++toKey) {
-            if(_sStore.numLayers[toKey] == 0) {
-                continue;
-            }
-            _copy_samples(toKey, toKey - dist, true);
-            _copy_samples(toKey, toKey + dist, true);
+    // Only original samples are borrowed, so a key's borrowed samples are
+    // never passed on, and each key is done in one go, nearest keys first.
+    for(int toKey = 0; toKey < 128; ++toKey) {
+        if(sstore_num_layers(ss, toKey) == 0) {
+            continue;
+        }
+        for(int dist = 1; dist < maxDist + 1; ++dist) {
+            _copy_samples(ss, toKey, toKey - dist, true);
+            _copy_samples(ss, toKey, toKey + dist, true);
         }
     }
 }
@@ -376,19 +658,21 @@ void sstore_borrow_samples(int maxDist)
 // sstore_get_samples
 // ----------------------------------------------------------------------------
 
-void _update_rrIdx(int key, int layer) {
-    int rrIdx = _sStore.rrIdx[key][layer] + 1;
-    _sStore.rrIdx[key][layer] = rrIdx  % _sStore.numSamples[key][layer];
+void _update_rrIdx(SampleLayer *l) {
+    int rrIdx = l->rrIdx + 1;
+    l->rrIdx = rrIdx  % l->numSamples;
 }
 
 // Returns sample 1 mix amplification.
-double sstore_get_samples(int key, double vel, Sample **s1, Sample **s2)
+double sstore_get_samples(SampleStore * ss, Controls * ctrls, int key,
+                          double vel, Sample ** s1, Sample ** s2)
 {
     *s1 = *s2 = NULL;
 
-    bool mixLayers = ctrls_value(CTRL_MIX_LAYERS) > 0.5;
+    bool mixLayers = ctrls_value(ctrls, CTRL_MIX_LAYERS) > 0.5;
 
-    int numLayers = _sStore.numLayers[key];
+    SampleKey *k = &(ss->key[key]);
+    int numLayers = k->numLayers;
     if(numLayers == 0) {
         return 0;
     }
@@ -399,17 +683,18 @@ double sstore_get_samples(int key, double vel, Sample **s1, Sample **s2)
     }
 
     // Scale the velocity to find the appropriate layer.
-    vel = pow(vel, ctrls_value(CTRL_GAMMA_LAYER));
+    vel = pow(vel, ctrls_value(ctrls, CTRL_GAMMA_LAYER));
     double layer = ((double)numLayers * vel);
 
     // This is the lower layer.
     int layer0 = (int)layer;
-    if(layer0 == _sStore.numLayers[key]) {
+    if(layer0 == k->numLayers) {
         --layer0;
     }
-    _update_rrIdx(key, layer0);
+    SampleLayer *l0 = &(k->layer[layer0]);
+    _update_rrIdx(l0);
 
-    *s1 = &(_sStore.sample[key][layer0][_sStore.rrIdx[key][layer0]]);
+    *s1 = &(l0->sample[l0->rrIdx]);
 
     // If not mixing layers, we're done.
     if(!mixLayers) {
@@ -422,49 +707,91 @@ double sstore_get_samples(int key, double vel, Sample **s1, Sample **s2)
     }
 
     // If the number of samples doesn't match, we don't mix.
-    if(_sStore.numSamples[key][layer0] !=
-       _sStore.numSamples[key][layer0 + 1]) {
+    SampleLayer *l1 = &(k->layer[layer0 + 1]);
+    if(l0->numSamples != l1->numSamples) {
         return 1;
     }
 
-    *s2 = &(_sStore.sample[key][layer0 + 1][_sStore.rrIdx[key][layer0]]);
+    *s2 = &(l1->sample[l0->rrIdx]);
 
     return 1 - (layer - (double)layer0);
 }
 
 // ----------------------------------------------------------------------------
-// sstore_fake_rc_layer
+// sstore_pack
 // ----------------------------------------------------------------------------
 
-static void _filter_sample(Sample *s, int order) {
-    int16_t * newData = malloc_exit((2 * s->len + 2) * sizeof(int16_t));
-
-    for(int i = 0; i < 2*s->len + 2; ++i) {
-        newData[i] = s->data[i];
-    }
-
-    rcLowPass(newData, s->len, 10, order);
-    s->data = newData;
-    s->owner = true;
+static int _cmp_data(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t) (*(Sample * const *)a)->data;
+    uintptr_t y = (uintptr_t) (*(Sample * const *)b)->data;
+    return (x > y) - (x < y);
 }
 
-void sstore_fake_rc_layer(int order)
+void sstore_pack(SampleStore * ss)
 {
-    for(int key = 0; key < 128; ++key) {
-        if(_sStore.numLayers[key] != 1 || _sStore.numSamples[key][0] == 0) {
-            continue;
+    // Borrowed and filled samples share data with the sample they were copied
+    // from, so samples are sorted by their data and each is packed once.
+    int count = 0;
+    for (int key = 0; key < 128; ++key) {
+        SampleKey *k = &(ss->key[key]);
+        for (int layer = 0; layer < k->numLayers; ++layer) {
+            for (int var = 0; var < k->layer[layer].numSamples; ++var) {
+                count += k->layer[layer].sample[var].data != NULL;
+            }
         }
+    }
+    if (count == 0) {
+        return;
+    }
+    Sample **samples = malloc_exit(count * sizeof(Sample *));
+    SampleBuf **packs = calloc_exit(count, sizeof(SampleBuf *));
+
+    count = 0;
+    for (int key = 0; key < 128; ++key) {
+        SampleKey *k = &(ss->key[key]);
+        for (int layer = 0; layer < k->numLayers; ++layer) {
+            for (int var = 0; var < k->layer[layer].numSamples; ++var) {
+                Sample *s = &(k->layer[layer].sample[var]);
+                if (s->data != NULL) {
+                    samples[count++] = s;
+                }
+            }
+        }
+    }
+    qsort(samples, count, sizeof(Sample *), _cmp_data);
 
-        _sStore.numLayers[key] = 2;
-
-        // Copy samples to layer 2.
-        _sStore.numSamples[key][1] = _sStore.numSamples[key][0];
-        for(int var = 0; var < _sStore.numSamples[key][0]; ++var) {
-            Sample *s0 = &(_sStore.sample[key][0][var]);
-            Sample *s1 = &(_sStore.sample[key][1][var]);
+    // Pack the first sample of each group. Samples aren't changed until
+    // they're all packed, as other threads compare their data.
+    int i;
+#pragma omp parallel for schedule(dynamic, 1)
+    for (i = 0; i < count; ++i) {
+        if (i == 0 || samples[i]->data != samples[i - 1]->data) {
+            packs[i] = sbuf_pack(samples[i]->data, samples[i]->len);
+        }
+    }
 
-            *s1 = *s0;
-            _filter_sample(s0, order);
+    // Swap each sample's reference to its data for one to the pack. The
+    // first sample of a group takes the reference sbuf_pack returned.
+    double rawSize = 0, packSize = 0;
+    SampleBuf *pack = NULL;
+    for (i = 0; i < count; ++i) {
+        Sample *s = samples[i];
+        if (packs[i] != NULL) {
+            pack = packs[i];
+            rawSize += 4.0 * s->len;
+            packSize += spack_size(pack->pack);
+        } else {
+            sbuf_ref(pack);
         }
+        sbuf_unref(s->buf);
+        s->buf = pack;
+        s->data = NULL;
+        s->pack = pack->pack;
     }
+
+    printf("Packed samples: %.1f MB to %.1f MB (%.0f%%)\n", rawSize / 1e6,
+           packSize / 1e6, 100 * packSize / rawSize);
+    free(packs);
+    free(samples);
 }
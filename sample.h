@@ -3,49 +3,130 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include <x86intrin.h>
 #include "global.h"
+#include "controls.h"
+#include "samplepack.h"
+#include "samplebuf.h"
 
+// Sample: A sample of a key, played from data or pack. Samples hold a
+// reference to the buffer their data is in, unless it's mapped from the
+// sample cache.
 typedef struct {
-    bool owner;                 // true if sample owns data.
+    SampleBuf *buf;             // Holds data or pack, or NULL.
+    bool copied;                // Borrowed or filled from another key.
     int len;                    // The number of samples in each channel.
     int idx0;                   // The first sample to play.
     double rms;                 // The RMS value of the initial samples.
     double speed;               // The playback speed multiplier.
     int16_t *data;              // Left/right interleaved data.
+    SamplePack *pack;           // Compressed data, or NULL. Replaces data.
+    uint64_t cacheOffset;       // Of the data in a cache being written.
 } Sample;
 
-void sample_interp(Sample * sample, double idx, __m128d * LR);
+// The cacheOffset of a sample whose data isn't in the cache being written.
+#define SAMPLE_NOT_CACHED UINT64_MAX
 
+// A cache file being written, see samplecache.h.
+typedef struct ScacheWriter ScacheWriter;
+
+// SampleLayer: The variations of one velocity layer of a key.
 typedef struct {
-    int numLayers[128];
+    int numSamples;
+    int rrIdx;                  // Round-robin index.
+    Sample *sample;             // numSamples samples.
+} SampleLayer;
 
-    int numSamples[128][MAX_LAYERS];
-    int rrIdx[128][MAX_LAYERS];
+// SampleKey: The velocity layers of a key.
+typedef struct {
+    int numLayers;
+    SampleLayer *layer;         // numLayers layers.
+} SampleKey;
 
-    Sample sample[128][MAX_LAYERS][MAX_VARS];
+// SampleStore: Samples for every key. Layers and variations are allocated
+// as they are loaded, so only loaded samples take memory. Each loaded
+// instrument has its own store.
+typedef struct {
+    SampleKey key[128];
 } SampleStore;
 
-// There is only one, global SampleStore.
-SampleStore _sStore;
-
-void sstore_init();
-
-void sstore_load();
-
-void sstore_free_data();
-
-void sstore_crop(double th);
-
-void sstore_compute_rms(double dt);
-
-void sstore_fill_samples();
-
-void sstore_borrow_samples(int maxNotes);
-
-void sstore_fake_rc_layer(int order);
-
-// Return sample 1 mix amplification.
-double sstore_get_samples(int key, double vel, Sample **s1, Sample **s2);
+static inline int sstore_num_layers(const SampleStore * ss, int key)
+{
+    return ss->key[key].numLayers;
+}
+
+static inline int sstore_num_samples(const SampleStore * ss, int key,
+                                     int layer)
+{
+    return ss->key[key].layer[layer].numSamples;
+}
+
+static inline Sample *sstore_sample(const SampleStore * ss, int key,
+                                    int layer, int var)
+{
+    return &(ss->key[key].layer[layer].sample[var]);
+}
+
+// sstore_add_sample: Return the given sample, adding empty layers and
+// samples to the key as needed. A negative var only adds layers. Pointers to
+// other samples in the same layer may be invalidated.
+Sample *sstore_add_sample(SampleStore * ss, int key, int layer, int var);
+
+// sample_alloc_data: Allocate zeroed data for len frames from sample memory.
+// The data is padded with SAMPLE_PAD zero frames before and after, so
+// interpolation kernels can read past either end.
+int16_t *sample_alloc_data(int len);
+
+// sample_free_data: Free data returned by sample_alloc_data.
+void sample_free_data(int16_t * data);
+
+// sample_file_stat: Stat the entry read from dir into st. Returns false if
+// it isn't a regular file. Some file systems don't give the type, and it's
+// found with the size.
+bool sample_file_stat(DIR * dir, const struct dirent *entry,
+                      struct stat *st);
+
+// sstore_init: Initialize an empty store.
+void sstore_init(SampleStore * ss);
+
+// sstore_new: Allocate an empty store.
+SampleStore *sstore_new();
+
+// sstore_free: Free a store from sstore_new and all of its data. NULL is
+// ignored.
+void sstore_free(SampleStore * ss);
+
+// sstore_load: Load every sample file in the working directory. Each sample
+// is cropped to start at the first frame reaching th, and its RMS is computed
+// over the dt seconds from there, as it's read. Files with the same content
+// as a registered buffer share it. If rcOrder isn't 0, keys with a single
+// layer get a layer below it, low-passed with that order. If w isn't NULL,
+// each sample's data is written to it and dropped, leaving its cacheOffset.
+void sstore_load(SampleStore * ss, double th, double dt, int rcOrder,
+                 ScacheWriter * w);
+
+// sstore_free_data: Drop the samples and their buffer references, leaving the
+// store empty.
+void sstore_free_data(SampleStore * ss);
+
+void sstore_crop(SampleStore * ss, double th);
+
+void sstore_compute_rms(SampleStore * ss, double dt);
+
+void sstore_fill_samples(SampleStore * ss);
+
+void sstore_borrow_samples(SampleStore * ss, int maxNotes);
+
+// sstore_pack: Compress the data of every sample, dropping its reference to
+// the unpacked data. Samples with the same content share a pack. Called once
+// the samples are final.
+void sstore_pack(SampleStore * ss);
+
+// Return sample 1 mix amplification. Layers are chosen and mixed using the
+// given controls.
+double sstore_get_samples(SampleStore * ss, Controls * ctrls, int key,
+                          double vel, Sample ** s1, Sample ** s2);
 
 #endif                          // SAMPLE_H_
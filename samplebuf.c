@@ -0,0 +1,162 @@
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "samplebuf.h"
+#include "sample.h"
+#include "mem.h"
+
+#define BUCKETS 4096
+
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+static SampleBuf *_table[BUCKETS];
+
+// Hash the data eight bytes at a time.
+static uint64_t _hash(const int16_t * data, int len)
+{
+    const uint64_t k1 = 0x9E3779B97F4A7C15ull, k2 = 0xC2B2AE3D27D4EB4Full;
+    const char *p = (const char *)data;
+    size_t size = 2 * (size_t) len * sizeof(int16_t);
+    uint64_t h = len * k1;
+
+    size_t i;
+    for (i = 0; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t x;
+        memcpy(&x, p + i, sizeof(x));
+        h ^= x * k1;
+        h = ((h << 27) | (h >> 37)) * k2;
+    }
+    if (i < size) {
+        uint32_t x;
+        memcpy(&x, p + i, sizeof(x));
+        h ^= x * k1;
+        h = ((h << 27) | (h >> 37)) * k2;
+    }
+    return h ^ (h >> 29);
+}
+
+static bool _same_pack(const SamplePack * a, const SamplePack * b)
+{
+    return a->numBlocks == b->numBlocks &&
+        memcmp(a->index, b->index,
+               (a->numBlocks + 1) * sizeof(uint32_t)) == 0 &&
+        memcmp(a->bytes, b->bytes, a->index[a->numBlocks]) == 0;
+}
+
+// Return the registered buffer with the same content, or NULL. A packed
+// buffer is looked for if pack is given, otherwise an unpacked one. Called
+// with the lock held.
+static SampleBuf *_find(uint64_t hash, int len, const int16_t * data,
+                        const SamplePack * pack)
+{
+    for (SampleBuf * b = _table[hash % BUCKETS]; b != NULL; b = b->next) {
+        if (b->hash != hash || b->len != len ||
+            (b->pack != NULL) != (pack != NULL)) {
+            continue;
+        }
+        if (pack != NULL ? _same_pack(b->pack, pack) :
+            memcmp(b->data, data, 2 * (size_t) len * sizeof(int16_t)) == 0) {
+            return b;
+        }
+    }
+    return NULL;
+}
+
+// Register a new buffer with one reference. Called with the lock held.
+static SampleBuf *_add(uint64_t hash, int len, int16_t * data,
+                       SamplePack * pack)
+{
+    SampleBuf *b = malloc_exit(sizeof(SampleBuf));
+    b->hash = hash;
+    b->len = len;
+    b->refs = 1;
+    b->data = data;
+    b->pack = pack;
+    b->next = _table[hash % BUCKETS];
+    _table[hash % BUCKETS] = b;
+    return b;
+}
+
+// ----------------------------------------------------------------------------
+// sbuf_intern, sbuf_pack
+// ----------------------------------------------------------------------------
+
+SampleBuf *sbuf_intern(int16_t * data, int len)
+{
+    uint64_t hash = _hash(data, len);
+
+    pthread_mutex_lock(&_lock);
+    SampleBuf *b = _find(hash, len, data, NULL);
+    if (b != NULL) {
+        b->refs++;
+    } else {
+        b = _add(hash, len, data, NULL);
+    }
+    pthread_mutex_unlock(&_lock);
+
+    if (b->data != data) {
+        sample_free_data(data);
+    }
+    return b;
+}
+
+SampleBuf *sbuf_pack(const int16_t * data, int len)
+{
+    // Packing is deterministic, so equal content gives equal packs. The
+    // packing is done outside the lock, as it's the slow part.
+    uint64_t hash = _hash(data, len);
+    SamplePack *pack = spack_new(data, len);
+
+    pthread_mutex_lock(&_lock);
+    SampleBuf *b = _find(hash, len, data, pack);
+    if (b != NULL) {
+        b->refs++;
+    } else {
+        b = _add(hash, len, NULL, pack);
+    }
+    pthread_mutex_unlock(&_lock);
+
+    if (b->pack != pack) {
+        spack_free(pack);
+    }
+    return b;
+}
+
+// ----------------------------------------------------------------------------
+// sbuf_ref, sbuf_unref
+// ----------------------------------------------------------------------------
+
+SampleBuf *sbuf_ref(SampleBuf * buf)
+{
+    if (buf != NULL) {
+        pthread_mutex_lock(&_lock);
+        buf->refs++;
+        pthread_mutex_unlock(&_lock);
+    }
+    return buf;
+}
+
+void sbuf_unref(SampleBuf * buf)
+{
+    if (buf == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&_lock);
+    bool last = --buf->refs == 0;
+    if (last) {
+        SampleBuf **p = &_table[buf->hash % BUCKETS];
+        while (*p != buf) {
+            p = &(*p)->next;
+        }
+        *p = buf->next;
+    }
+    pthread_mutex_unlock(&_lock);
+
+    if (last) {
+        if (buf->data != NULL) {
+            sample_free_data(buf->data);
+        }
+        spack_free(buf->pack);
+        free(buf);
+    }
+}
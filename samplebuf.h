@@ -0,0 +1,42 @@
+#ifndef SAMPLEBUF_H_
+#define SAMPLEBUF_H_
+
+#include <stdint.h>
+#include "samplepack.h"
+
+// SampleBuf: Sample data shared by every sample with the same content, in
+// any store. Buffers are registered by a hash of their content, and counted:
+// each sample holding one has a reference, and the buffer is freed with the
+// last. Voices don't hold references, as a store isn't freed while its
+// instrument has voices. Packed and unpacked buffers are registered
+// separately, so a store can pack its samples while another plays them
+// unpacked.
+typedef struct SampleBuf SampleBuf;
+
+struct SampleBuf {
+    uint64_t hash;              // Of the unpacked content.
+    int len;                    // Frames.
+    int refs;                   // Guarded by the registry's lock.
+    int16_t *data;              // From sample_alloc_data, or NULL if packed.
+    SamplePack *pack;           // NULL unless packed.
+    SampleBuf *next;            // In the registry's hash chain.
+};
+
+// sbuf_intern: Return a reference to the buffer holding len frames of data,
+// which must be from sample_alloc_data. If a buffer with the same content is
+// registered, data is freed and that buffer is returned, otherwise data is
+// registered in a new one. Thread safe, like the rest of the registry.
+SampleBuf *sbuf_intern(int16_t * data, int len);
+
+// sbuf_pack: Return a reference to a packed buffer with the same content as
+// len frames of data, packing it if there isn't one registered.
+SampleBuf *sbuf_pack(const int16_t * data, int len);
+
+// sbuf_ref: Add a reference to buf and return it. NULL is ignored.
+SampleBuf *sbuf_ref(SampleBuf * buf);
+
+// sbuf_unref: Drop a reference to buf, freeing it if it was the last. NULL is
+// ignored.
+void sbuf_unref(SampleBuf * buf);
+
+#endif                          // SAMPLEBUF_H_
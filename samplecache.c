@@ -0,0 +1,456 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "global.h"
+#include "mem.h"
+#include "sample.h"
+#include "samplecache.h"
+#include "samplebuf.h"
+#include "samplemem.h"
+
+#define SCACHE_MAGIC "JLSCACHE"
+#define SCACHE_ALIGN 64
+#define SCACHE_NONE SAMPLE_NOT_CACHED   // Offset of a sample without data.
+
+// The file starts with a header, followed by the sample data at a
+// page-aligned offset and then the index. Data shared by samples is stored
+// once, with its SAMPLE_PAD zero frames on both sides, so mapped data can be
+// played directly. The index comes last, as it's only known once every
+// sample has been written.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;             // Number of index entries.
+    uint64_t fingerprint;
+    uint64_t dataOffset;        // Start of the data section in the file.
+    uint64_t indexOffset;       // Start of the index, after the data.
+    uint64_t size;              // Total file size.
+} ScacheHeader;
+
+typedef struct {
+    int32_t key;
+    int32_t layer;
+    int32_t var;
+    int32_t len;
+    int32_t idx0;
+    int32_t unused;
+    double rms;
+    double speed;
+    uint64_t offset;            // First frame, from the start of the data.
+} ScacheEntry;
+
+// ----------------------------------------------------------------------------
+// scache_fingerprint
+// ----------------------------------------------------------------------------
+
+static uint64_t _fnv(uint64_t h, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint64_t _fnv_file(uint64_t h, const char *path)
+{
+    char buf[4096];
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return h;
+    }
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        h = _fnv(h, buf, n);
+    }
+    fclose(f);
+    return h;
+}
+
+uint64_t scache_fingerprint()
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    uint32_t version = SCACHE_VERSION;
+
+    h = _fnv(h, &version, sizeof(version));
+    h = _fnv_file(h, "config.conf");
+    h = _fnv_file(h, "tuning.conf");
+
+    DIR *dir = opendir("samples");
+    if (dir == NULL) {
+        return h;
+    }
+
+    // Directory order isn't stable, so sample files are summed.
+    uint64_t files = 0;
+    struct dirent *entry;
+    struct stat st;
+
+    // Files are found as sstore_load finds them.
+    while ((entry = readdir(dir)) != NULL) {
+        if (!sample_file_stat(dir, entry, &st)) {
+            continue;
+        }
+        uint64_t fh = _fnv(0xcbf29ce484222325ULL, entry->d_name,
+                           strlen(entry->d_name));
+        fh = _fnv(fh, &st.st_size, sizeof(st.st_size));
+        fh = _fnv(fh, &st.st_mtim, sizeof(st.st_mtim));
+        files += fh;
+    }
+    closedir(dir);
+
+    return _fnv(h, &files, sizeof(files));
+}
+
+// ----------------------------------------------------------------------------
+// scache_load
+// ----------------------------------------------------------------------------
+
+static bool _valid(const ScacheHeader * hdr, size_t size)
+{
+    if (size < sizeof(ScacheHeader) ||
+        memcmp(hdr->magic, SCACHE_MAGIC, 8) != 0 ||
+        hdr->version != SCACHE_VERSION || hdr->size != size ||
+        hdr->dataOffset < sizeof(ScacheHeader) ||
+        hdr->indexOffset < hdr->dataOffset || hdr->indexOffset > size ||
+        (size - hdr->indexOffset) / sizeof(ScacheEntry) < hdr->count) {
+        return false;
+    }
+
+    const ScacheEntry *idx =
+        (const ScacheEntry *)((const char *)hdr + hdr->indexOffset);
+    uint64_t dataLen = hdr->indexOffset - hdr->dataOffset;
+    uint64_t pad = 2 * SAMPLE_PAD * sizeof(int16_t);
+
+    for (uint32_t i = 0; i < hdr->count; ++i) {
+        const ScacheEntry *e = &idx[i];
+        // A layer can't have more variations than there are entries.
+        if (e->key < 0 || e->key > 127 || e->layer < 0 ||
+            e->layer >= MAX_LAYERS || e->var < 0 ||
+            e->var >= (int64_t) hdr->count || e->len < 0) {
+            return false;
+        }
+        if (e->offset == SCACHE_NONE) {
+            continue;
+        }
+        if (e->offset < pad ||
+            e->offset + 2 * (uint64_t) e->len * sizeof(int16_t) + pad >
+            dataLen) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Read the data section of the cache, len bytes at offset, into sample
+// memory. Returns NULL on failure.
+static char *_copy_data(int fd, uint64_t offset, size_t len)
+{
+    char *mem = smem_alloc(len);
+    for (size_t done = 0; done < len;) {
+        ssize_t n = pread(fd, mem + done, len - done, offset + done);
+        if (n <= 0) {
+            smem_free(mem);
+            return NULL;
+        }
+        done += n;
+    }
+    return mem;
+}
+
+bool scache_load(SampleStore * ss, ScacheMap * map, const char *path,
+                 uint64_t fingerprint, bool copy)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(ScacheHeader)) {
+        close(fd);
+        return false;
+    }
+
+    // Check the header before mapping everything.
+    ScacheHeader hdr;
+    if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        hdr.fingerprint != fingerprint) {
+        close(fd);
+        return false;
+    }
+
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    if (!_valid(base, st.st_size)) {
+        printf("Invalid sample cache: %s\n", path);
+        munmap(base, st.st_size);
+        close(fd);
+        return false;
+    }
+
+    const ScacheHeader *h = base;
+    const ScacheEntry *idx =
+        (const ScacheEntry *)((char *)base + h->indexOffset);
+    int16_t *data = (int16_t *) ((char *)base + h->dataOffset);
+
+    // Copied data is read in from the file rather than faulted in from the
+    // mapping, which is only kept for the index.
+    char *mem = NULL;
+    if (copy) {
+        mem = _copy_data(fd, h->dataOffset, h->indexOffset - h->dataOffset);
+        if (mem == NULL) {
+            munmap(base, st.st_size);
+            close(fd);
+            return false;
+        }
+        data = (int16_t *) mem;
+    }
+    close(fd);
+
+    for (uint32_t i = 0; i < h->count; ++i) {
+        const ScacheEntry *e = &idx[i];
+        Sample *s = sstore_add_sample(ss, e->key, e->layer, e->var);
+
+        // Cached data has no buffer, so it isn't freed with the store.
+        s->buf = NULL;
+        s->len = e->len;
+        s->idx0 = e->idx0;
+        s->rms = e->rms;
+        s->speed = e->speed;
+        s->data = NULL;
+        if (e->offset != SCACHE_NONE) {
+            s->data = (int16_t *) ((char *)data + e->offset);
+        }
+    }
+
+    if (copy) {
+        munmap(base, st.st_size);
+        map->base = NULL;
+        map->size = 0;
+    } else {
+        map->base = base;
+        map->size = st.st_size;
+    }
+    map->mem = mem;
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// scache_writer_open, scache_writer_add, scache_writer_close
+// ----------------------------------------------------------------------------
+
+// Data written, found by the hash of its buffer.
+typedef struct _ScacheData {
+    uint64_t hash;
+    int len;
+    uint64_t offset;
+    bool written;               // False while another thread writes it.
+} _ScacheData;
+
+static uint64_t _align(uint64_t x, uint64_t a)
+{
+    return (x + a - 1) / a * a;
+}
+
+// The data starts on the second page, after the header.
+static uint64_t _data_offset()
+{
+    return sysconf(_SC_PAGESIZE);
+}
+
+static bool _pwrite(int fd, const void *buf, size_t len, uint64_t offset)
+{
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = pwrite(fd, p, len, offset);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// Return true if the file holds len frames of data at offset, which is from
+// the start of the data section.
+static bool _same(int fd, uint64_t offset, const int16_t * data, int len)
+{
+    char buf[65536];
+    const char *p = (const char *)data;
+    uint64_t size = 2 * (uint64_t) len * sizeof(int16_t);
+    offset += _data_offset();
+
+    while (size > 0) {
+        size_t n = size < sizeof(buf) ? size : sizeof(buf);
+        if (pread(fd, buf, n, offset) != (ssize_t) n ||
+            memcmp(buf, p, n) != 0) {
+            return false;
+        }
+        p += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+bool scache_writer_open(ScacheWriter * w, const char *path)
+{
+    // Write to a temporary file and rename it, so a crash can't leave a
+    // truncated cache behind.
+    snprintf(w->tmpPath, sizeof(w->tmpPath), "%s.tmp", path);
+    w->fd = open(w->tmpPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (w->fd < 0) {
+        printf("Failed to open sample cache for writing: %s\n", w->tmpPath);
+        return false;
+    }
+    pthread_mutex_init(&w->lock, NULL);
+    w->end = 0;
+    w->ok = true;
+    w->data = NULL;
+    w->numData = 0;
+    w->capData = 0;
+    return true;
+}
+
+uint64_t scache_writer_add(ScacheWriter * w, const SampleBuf * buf)
+{
+    // Identical files were given the same buffer when loaded, but buffers
+    // are dropped once written, so data is matched by its hash and then
+    // compared with the file.
+    uint64_t found = SCACHE_NONE;
+    pthread_mutex_lock(&w->lock);
+    for (int i = 0; i < w->numData && found == SCACHE_NONE; ++i) {
+        _ScacheData *d = &w->data[i];
+        if (d->hash == buf->hash && d->len == buf->len && d->written) {
+            found = d->offset;
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    if (found != SCACHE_NONE && _same(w->fd, found, buf->data, buf->len)) {
+        return found;
+    }
+
+    // Reserve room for the data and its padding, then write it unlocked.
+    uint64_t pad = 2 * SAMPLE_PAD * sizeof(int16_t);
+    uint64_t len = 2 * pad + 2 * (uint64_t) buf->len * sizeof(int16_t);
+
+    pthread_mutex_lock(&w->lock);
+    uint64_t offset = w->end + pad;
+    w->end = _align(w->end + len, SCACHE_ALIGN);
+    if (w->numData == w->capData) {
+        w->capData = w->capData ? 2 * w->capData : 256;
+        _ScacheData *tmp = malloc_exit(w->capData * sizeof(_ScacheData));
+        if (w->numData) {
+            memcpy(tmp, w->data, w->numData * sizeof(_ScacheData));
+        }
+        free(w->data);
+        w->data = tmp;
+    }
+    _ScacheData *d = &w->data[w->numData++];
+    d->hash = buf->hash;
+    d->len = buf->len;
+    d->offset = offset;
+    d->written = false;
+    int i = d - w->data;
+    pthread_mutex_unlock(&w->lock);
+
+    bool ok = _pwrite(w->fd, buf->data - 2 * SAMPLE_PAD, len,
+                      _data_offset() + offset - pad);
+
+    pthread_mutex_lock(&w->lock);
+    w->data[i].written = true;
+    w->ok = w->ok && ok;
+    pthread_mutex_unlock(&w->lock);
+    return offset;
+}
+
+bool scache_writer_close(ScacheWriter * w, SampleStore * ss,
+                         const char *path, uint64_t fingerprint)
+{
+    bool ok = w->ok && ss != NULL;
+
+    int count = 0;
+    for (int key = 0; ok && key < 128; ++key) {
+        for (int layer = 0; layer < sstore_num_layers(ss, key); ++layer) {
+            count += sstore_num_samples(ss, key, layer);
+        }
+    }
+
+    ScacheEntry *idx = calloc_exit(count > 0 ? count : 1, sizeof(ScacheEntry));
+    int i = 0;
+    for (int key = 0; ok && key < 128; ++key) {
+        for (int layer = 0; layer < sstore_num_layers(ss, key); ++layer) {
+            for (int var = 0; var < sstore_num_samples(ss, key, layer);
+                 ++var) {
+                Sample *s = sstore_sample(ss, key, layer, var);
+                ScacheEntry *e = &idx[i++];
+                e->key = key;
+                e->layer = layer;
+                e->var = var;
+                e->len = s->len;
+                e->idx0 = s->idx0;
+                e->rms = s->rms;
+                e->speed = s->speed;
+                e->offset = s->cacheOffset;
+            }
+        }
+    }
+
+    ScacheHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SCACHE_MAGIC, 8);
+    hdr.version = SCACHE_VERSION;
+    hdr.count = count;
+    hdr.fingerprint = fingerprint;
+    hdr.dataOffset = _data_offset();
+    hdr.indexOffset = hdr.dataOffset + w->end;
+    hdr.size = hdr.indexOffset + count * sizeof(ScacheEntry);
+
+    ok = ok && _pwrite(w->fd, idx, count * sizeof(ScacheEntry),
+                       hdr.indexOffset) &&
+        _pwrite(w->fd, &hdr, sizeof(hdr), 0);
+
+    if (close(w->fd) != 0 || !ok || rename(w->tmpPath, path) != 0) {
+        if (ss != NULL) {
+            printf("Failed to write sample cache: %s\n", path);
+        }
+        unlink(w->tmpPath);
+        ok = false;
+    } else {
+        printf("Wrote sample cache: %s, %.1f MB\n", path, hdr.size / 1e6);
+    }
+
+    pthread_mutex_destroy(&w->lock);
+    free(w->data);
+    free(idx);
+    return ok;
+}
+
+// ----------------------------------------------------------------------------
+// scache_free
+// ----------------------------------------------------------------------------
+
+void scache_free(ScacheMap * map)
+{
+    if (map->base != NULL) {
+        munmap(map->base, map->size);
+        map->base = NULL;
+        map->size = 0;
+    }
+    smem_free(map->mem);
+    map->mem = NULL;
+}
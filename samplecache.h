@@ -0,0 +1,71 @@
+#ifndef SAMPLECACHE_H_
+#define SAMPLECACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "sample.h"
+
+// The cache file, relative to the instrument directory.
+#define SCACHE_FILE "samples.cache"
+
+// Bump when the file layout, or how samples are processed, changes.
+#define SCACHE_VERSION 4
+
+// ScacheMap: A mapped cache file, or its data copied into sample memory.
+typedef struct {
+    char *base;                 // NULL if nothing is mapped.
+    size_t size;
+    char *mem;                  // Copied data from smem_alloc, or NULL.
+} ScacheMap;
+
+// scache_fingerprint: Return a hash of everything the sample store is built
+// from: the names, sizes and modification times of the sample files and the
+// contents of config.conf and tuning.conf. Call from the instrument
+// directory.
+uint64_t scache_fingerprint();
+
+// scache_load: Map the cache file at path into map and point the sample store
+// at it, without copying. If copy is true, the sample data is instead read
+// into sample memory, so it's locked and on huge pages like loaded samples,
+// and the file is unmapped. The store must be empty. Returns false, leaving
+// the store empty, if there is no valid cache matching the fingerprint.
+bool scache_load(SampleStore * ss, ScacheMap * map, const char *path,
+                 uint64_t fingerprint, bool copy);
+
+// ScacheWriter: A cache file written while the samples load. Each sample's
+// data is written as soon as it's processed, and dropped, so only the
+// samples being loaded are in memory at once.
+struct ScacheWriter {
+    int fd;
+    char tmpPath[4096];
+    pthread_mutex_t lock;       // Guards the rest.
+    uint64_t end;               // Of the data written, from its start.
+    bool ok;
+
+    // Data written, to store identical data once.
+    struct _ScacheData *data;
+    int numData, capData;
+};
+
+// scache_writer_open: Start writing a cache to a temporary file next to
+// path. Returns false if it can't be created.
+bool scache_writer_open(ScacheWriter * w, const char *path);
+
+// scache_writer_add: Write the data of buf, unless identical data has been
+// written, and return its offset for Sample.cacheOffset. Thread safe.
+uint64_t scache_writer_add(ScacheWriter * w, const SampleBuf * buf);
+
+// scache_writer_close: Write the index of the store, whose samples have
+// offsets from scache_writer_add, and move the file into place at path.
+// The store is left as it is. If ss is NULL, or anything failed, the
+// temporary file is removed and false returned.
+bool scache_writer_close(ScacheWriter * w, SampleStore * ss,
+                         const char *path, uint64_t fingerprint);
+
+// scache_free: Unmap the cache file, or free its copied data. Call after the
+// sample store pointing into it has been cleared.
+void scache_free(ScacheMap * map);
+
+#endif                          // SAMPLECACHE_H_
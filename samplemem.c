@@ -0,0 +1,248 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "samplemem.h"
+#include "stats.h"
+#include "mem.h"
+
+#define MPOL_BIND 2             // From linux/mempolicy.h.
+
+// Allocations larger than this get a chunk of their own.
+#define LARGE (SMEM_CHUNK / 4)
+
+typedef struct _Chunk {
+    char *base;
+    size_t size;
+    size_t used;
+    int live;                   // Allocations not yet freed.
+    bool locked;
+    bool huge;                  // Explicit huge pages.
+    struct _Chunk *next;
+} _Chunk;
+
+// The lock guards the chunk list and allocation within chunks. Chunks are
+// mapped and faulted in without it, so loading threads don't wait on each
+// other's page faults.
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;
+static _Chunk *_chunks;
+static _Chunk *_current;        // Small allocations come from here.
+static _Atomic bool _bind;
+static _Atomic bool _lockWarned;
+
+// One more than the CPU the audio thread last ran on, or 0 if it hasn't.
+static _Atomic int _audioCpu;
+
+void smem_audio_cpu()
+{
+    atomic_store_explicit(&_audioCpu, sched_getcpu() + 1,
+                          memory_order_relaxed);
+}
+
+void smem_bind(bool bind)
+{
+    atomic_store(&_bind, bind);
+}
+
+// ----------------------------------------------------------------------------
+// Mapping chunks
+// ----------------------------------------------------------------------------
+
+// Return the NUMA node of cpu, or -1 if it isn't known.
+static int _cpu_node(int cpu)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        return -1;
+    }
+    int node = -1;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (sscanf(entry->d_name, "node%d", &node) == 1) {
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+// Bind the range to the audio thread's node. Binding is only a hint for
+// performance, so failures are ignored.
+static void _bind_node(char *p, size_t size)
+{
+    int cpu = atomic_load(&_audioCpu) - 1;
+    if (cpu < 0) {
+        cpu = sched_getcpu();
+    }
+    int node = _cpu_node(cpu);
+    if (node < 0 || node >= 8 * (int)sizeof(unsigned long)) {
+        return;
+    }
+    unsigned long mask = 1UL << node;
+    syscall(SYS_mbind, p, size, MPOL_BIND, &mask, 8 * sizeof(mask) + 1, 0);
+}
+
+// Map a chunk of at least size bytes, locked and faulted in. It isn't linked
+// into the list, so the lock isn't needed.
+static _Chunk *_map(size_t size)
+{
+    _Chunk *c = malloc_exit(sizeof(_Chunk));
+    c->size = (size + SMEM_HUGE_PAGE - 1) / SMEM_HUGE_PAGE * SMEM_HUGE_PAGE;
+    c->used = 0;
+    c->live = 0;
+
+    // Explicit huge pages are only there if the admin reserved some.
+    // Otherwise the chunk is aligned to a huge page and transparent huge
+    // pages are asked for.
+    c->base = mmap(NULL, c->size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    c->huge = c->base != MAP_FAILED;
+    if (!c->huge) {
+        char *p = mmap(NULL, c->size + SMEM_HUGE_PAGE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            printf("Failed to map sample memory.\n");
+            exit(1);
+        }
+        c->base = (char *)(((uintptr_t) p + SMEM_HUGE_PAGE - 1) &
+                           ~(uintptr_t) (SMEM_HUGE_PAGE - 1));
+        if (c->base != p) {
+            munmap(p, c->base - p);
+        }
+        munmap(c->base + c->size, p + SMEM_HUGE_PAGE - c->base);
+        madvise(c->base, c->size, MADV_HUGEPAGE);
+    }
+
+    if (atomic_load(&_bind)) {
+        _bind_node(c->base, c->size);
+    }
+
+    // Locking faults every page in. Without it, they're touched instead, but
+    // may still be swapped out later.
+    c->locked = mlock(c->base, c->size) == 0;
+    if (!c->locked) {
+        if (!atomic_exchange(&_lockWarned, true)) {
+            printf("Sample memory: mlock failed, check the memlock limit. "
+                   "Samples may be swapped out.\n");
+        }
+        long page = sysconf(_SC_PAGESIZE);
+        for (size_t i = 0; i < c->size; i += page) {
+            ((volatile char *)c->base)[i] = 0;
+        }
+    }
+
+    stats_sample_memory(c->size, c->locked ? c->size : 0,
+                        c->huge ? c->size : 0);
+    return c;
+}
+
+// Add a mapped chunk to the list. Called with the lock held.
+static void _link(_Chunk * c)
+{
+    c->next = _chunks;
+    _chunks = c;
+}
+
+// Unmap a chunk that isn't in the list.
+static void _release(_Chunk * c)
+{
+    stats_sample_memory(-(int64_t) c->size,
+                        c->locked ? -(int64_t) c->size : 0,
+                        c->huge ? -(int64_t) c->size : 0);
+    munmap(c->base, c->size);
+    free(c);
+}
+
+// Remove a chunk from the list and unmap it. Called with the lock held.
+static void _unmap(_Chunk * c)
+{
+    _Chunk **p = &_chunks;
+    while (*p != c) {
+        p = &(*p)->next;
+    }
+    *p = c->next;
+    if (c == _current) {
+        _current = NULL;
+    }
+    _release(c);
+}
+
+// True if the current chunk has room for size bytes. Called with the lock
+// held.
+static bool _room(size_t size)
+{
+    return _current != NULL && _current->used + size <= _current->size;
+}
+
+// ----------------------------------------------------------------------------
+// smem_alloc, smem_free
+// ----------------------------------------------------------------------------
+
+void *smem_alloc(size_t size)
+{
+    size = (size + SMEM_ALIGN - 1) / SMEM_ALIGN * SMEM_ALIGN;
+
+    _Chunk *c;
+    _Chunk *spare = NULL;
+    if (size > LARGE) {
+        c = _map(size);
+        pthread_mutex_lock(&_lock);
+        _link(c);
+    } else {
+        pthread_mutex_lock(&_lock);
+        if (!_room(size)) {
+            // Map a new chunk unlocked. Another thread may have mapped one
+            // meanwhile, in which case this one is spare.
+            pthread_mutex_unlock(&_lock);
+            spare = _map(SMEM_CHUNK);
+            pthread_mutex_lock(&_lock);
+            if (!_room(size)) {
+                _link(spare);
+                _current = spare;
+                spare = NULL;
+            }
+        }
+        c = _current;
+    }
+    void *p = c->base + c->used;
+    c->used += size;
+    c->live++;
+    pthread_mutex_unlock(&_lock);
+
+    if (spare != NULL) {
+        _release(spare);
+    }
+    return p;
+}
+
+void smem_free(void *p)
+{
+    if (p == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&_lock);
+    _Chunk *c = _chunks;
+    while (c != NULL && ((char *)p < c->base || (char *)p >= c->base +
+                         c->size)) {
+        c = c->next;
+    }
+    if (c == NULL) {
+        printf("Sample memory: freeing unknown pointer.\n");
+        exit(1);
+    }
+    if (--c->live == 0) {
+        _unmap(c);
+    }
+    pthread_mutex_unlock(&_lock);
+}
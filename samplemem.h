@@ -0,0 +1,34 @@
+#ifndef SAMPLEMEM_H_
+#define SAMPLEMEM_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#define SMEM_HUGE_PAGE (2 << 20)
+#define SMEM_CHUNK (16 * SMEM_HUGE_PAGE)        // Arena chunk size.
+#define SMEM_ALIGN 64
+
+// Sample memory: the arena sample data and packs are allocated from, so the
+// audio thread never faults them in. Memory is mapped in chunks backed by
+// huge pages where the system has them, locked, and touched before use.
+// Small allocations share chunks, which are unmapped once everything in them
+// is freed; large ones get chunks of their own. Memory in a chunk isn't
+// reused, so allocations are always zeroed.
+
+// smem_alloc: Return size zeroed bytes aligned to SMEM_ALIGN. Thread safe.
+// Exits if the memory can't be mapped.
+void *smem_alloc(size_t size);
+
+// smem_free: Free memory from smem_alloc. NULL is ignored.
+void smem_free(void *p);
+
+// smem_bind: If bind is true, bind chunks mapped from now on to the NUMA
+// node of the CPU the audio thread last ran on, or of the calling thread's if
+// it hasn't run yet. If false, chunks use the default policy.
+void smem_bind(bool bind);
+
+// smem_audio_cpu: Note the CPU the audio thread is running on, for binding.
+// Doesn't make a system call. Audio thread.
+void smem_audio_cpu();
+
+#endif                          // SAMPLEMEM_H_
@@ -0,0 +1,306 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <x86intrin.h>
+#include "samplepack.h"
+#include "samplemem.h"
+#include "mem.h"
+
+#define GROUPS (SPACK_BLOCK / SPACK_GROUP)
+
+// Per channel: the predictor order, the last value and difference before the
+// block, and the width of each group.
+#define HEADER_SIZE (1 + 2 * sizeof(int32_t) + GROUPS)
+
+// The largest a block can be, with every residual taking 32 bits.
+#define MAX_BLOCK_SIZE (2 * (HEADER_SIZE + SPACK_BLOCK * sizeof(uint32_t)))
+
+// Unpacking a value reads 8 bytes from its first byte.
+#define READ_SLACK 8
+
+// ----------------------------------------------------------------------------
+// Encoding
+// ----------------------------------------------------------------------------
+
+static inline uint32_t _zigzag(int32_t x)
+{
+    return ((uint32_t) x << 1) ^ (uint32_t) (x >> 31);
+}
+
+static inline int _width(uint32_t x)
+{
+    return x == 0 ? 0 : 32 - __builtin_clz(x);
+}
+
+// Compute the zigzagged residuals of the block predicted with the given
+// order, where x1 and x2 are the two values before the block.
+static void _residuals(const int32_t * x, int32_t x1, int32_t x2, int order,
+                       uint32_t * res)
+{
+    for (int i = 0; i < SPACK_BLOCK; ++i) {
+        int32_t e = x[i];
+        if (order >= 1) {
+            e -= x1;
+        }
+        if (order >= 2) {
+            e -= x1 - x2;
+        }
+        res[i] = _zigzag(e);
+        x2 = x1;
+        x1 = x[i];
+    }
+}
+
+static int _group_width(const uint32_t * res)
+{
+    uint32_t bits = 0;
+    for (int i = 0; i < SPACK_GROUP; ++i) {
+        bits |= res[i];
+    }
+    return _width(bits);
+}
+
+// Return the packed size of the residuals in bits per group value.
+static int _packed_size(const uint32_t * res)
+{
+    int size = 0;
+    for (int g = 0; g < GROUPS; ++g) {
+        size += _group_width(res + g * SPACK_GROUP);
+    }
+    return size;
+}
+
+// Pack a group of values with w bits each. SPACK_GROUP values always fill a
+// whole number of bytes.
+static uint8_t *_pack(const uint32_t * res, int w, uint8_t * out)
+{
+    uint64_t acc = 0;
+    int bits = 0;
+    for (int i = 0; i < SPACK_GROUP; ++i) {
+        acc |= (uint64_t) res[i] << bits;
+        bits += w;
+        for (; bits >= 8; bits -= 8) {
+            *out++ = (uint8_t) acc;
+            acc >>= 8;
+        }
+    }
+    return out;
+}
+
+// Encode one channel of a block, where x1 and x2 are the two values before
+// it. Returns the end of the encoded channel.
+static uint8_t *_encode_channel(const int32_t * x, int32_t x1, int32_t x2,
+                                uint8_t * out)
+{
+    uint32_t res[SPACK_BLOCK];
+    int best = 0, bestSize = INT_MAX;
+    for (int order = 0; order <= 2; ++order) {
+        _residuals(x, x1, x2, order, res);
+        int size = _packed_size(res);
+        if (size < bestSize) {
+            best = order;
+            bestSize = size;
+        }
+    }
+    _residuals(x, x1, x2, best, res);
+
+    int32_t d1 = x1 - x2;
+    out[0] = best;
+    memcpy(out + 1, &x1, sizeof(x1));
+    memcpy(out + 1 + sizeof(x1), &d1, sizeof(d1));
+    uint8_t *width = out + 1 + 2 * sizeof(int32_t);
+    out += HEADER_SIZE;
+
+    for (int g = 0; g < GROUPS; ++g) {
+        width[g] = _group_width(res + g * SPACK_GROUP);
+        out = _pack(res + g * SPACK_GROUP, width[g], out);
+    }
+    return out;
+}
+
+// ----------------------------------------------------------------------------
+// spack_new, spack_free, spack_size
+// ----------------------------------------------------------------------------
+
+SamplePack *spack_new(const int16_t * data, int len)
+{
+    SamplePack *p = malloc_exit(sizeof(SamplePack));
+    p->len = len;
+    p->numBlocks = (len + SPACK_BLOCK - 1) / SPACK_BLOCK;
+    uint32_t *index = malloc_exit((p->numBlocks + 1) * sizeof(uint32_t));
+
+    // Encode into the worst case size, then copy to sample memory.
+    uint8_t *bytes = malloc_exit(p->numBlocks * MAX_BLOCK_SIZE + READ_SLACK);
+    uint8_t *out = bytes;
+
+    // Mid and side, and the two values before the block of each.
+    int32_t x[2][SPACK_BLOCK];
+    int32_t x1[2] = { 0, 0 }, x2[2] = { 0, 0 };
+
+    for (int b = 0; b < p->numBlocks; ++b) {
+        index[b] = out - bytes;
+
+        // Frames past the end are zeros.
+        for (int i = 0; i < SPACK_BLOCK; ++i) {
+            int f = b * SPACK_BLOCK + i;
+            int32_t L = f < len ? data[2 * f] : 0;
+            int32_t R = f < len ? data[2 * f + 1] : 0;
+            x[1][i] = L - R;
+            x[0][i] = R + (x[1][i] >> 1);
+        }
+
+        for (int c = 0; c < 2; ++c) {
+            out = _encode_channel(x[c], x1[c], x2[c], out);
+            x1[c] = x[c][SPACK_BLOCK - 1];
+            x2[c] = x[c][SPACK_BLOCK - 2];
+        }
+    }
+    index[p->numBlocks] = out - bytes;
+
+    // The index and bytes share one allocation, the bytes after the index.
+    size_t indexSize = (p->numBlocks + 1) * sizeof(uint32_t);
+    p->index = smem_alloc(indexSize + (out - bytes) + READ_SLACK);
+    p->bytes = (uint8_t *) p->index + indexSize;
+    memcpy(p->index, index, indexSize);
+    memcpy(p->bytes, bytes, out - bytes);
+    free(index);
+    free(bytes);
+    return p;
+}
+
+void spack_free(SamplePack * p)
+{
+    if (p != NULL) {
+        smem_free(p->index);
+        free(p);
+    }
+}
+
+size_t spack_size(const SamplePack * p)
+{
+    return sizeof(SamplePack) + (p->numBlocks + 1) * sizeof(uint32_t) +
+        p->index[p->numBlocks] + READ_SLACK;
+}
+
+// ----------------------------------------------------------------------------
+// spack_decode
+// ----------------------------------------------------------------------------
+
+// Unpack a group of values with w bits each. Every eight values take w
+// bytes, and a value never spans more than the 8 bytes from its first byte.
+// Inlined for each width, so the shifts and offsets are constants.
+static inline __attribute__ ((always_inline))
+void _unpack_width(const uint8_t * in, const int w, uint32_t * out)
+{
+    const uint64_t mask = ((uint64_t) 1 << w) - 1;
+    for (int k = 0; k < SPACK_GROUP; k += 8, in += w) {
+        for (int i = 0; i < 8; ++i) {
+            uint64_t x;
+            memcpy(&x, in + (i * w >> 3), sizeof(x));
+            out[k + i] = (x >> (i * w & 7)) & mask;
+        }
+    }
+}
+
+#define UNPACK_CASE(w) case w: _unpack_width(in, w, out); break;
+
+static void _unpack(const uint8_t * in, int w, uint32_t * out)
+{
+    switch (w) {
+        UNPACK_CASE(0) UNPACK_CASE(1) UNPACK_CASE(2) UNPACK_CASE(3)
+        UNPACK_CASE(4) UNPACK_CASE(5) UNPACK_CASE(6) UNPACK_CASE(7)
+        UNPACK_CASE(8) UNPACK_CASE(9) UNPACK_CASE(10) UNPACK_CASE(11)
+        UNPACK_CASE(12) UNPACK_CASE(13) UNPACK_CASE(14) UNPACK_CASE(15)
+        UNPACK_CASE(16) UNPACK_CASE(17) UNPACK_CASE(18) UNPACK_CASE(19)
+        UNPACK_CASE(20) UNPACK_CASE(21) UNPACK_CASE(22) UNPACK_CASE(23)
+        UNPACK_CASE(24) UNPACK_CASE(25) UNPACK_CASE(26) UNPACK_CASE(27)
+        UNPACK_CASE(28) UNPACK_CASE(29) UNPACK_CASE(30) UNPACK_CASE(31)
+        UNPACK_CASE(32)
+    }
+}
+
+// Add carry and the values before it in the vector to each value. The sum
+// within the vector takes two shifted adds.
+static inline __m128i _prefix_sum(__m128i v, __m128i carry)
+{
+    v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+    v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+    return _mm_add_epi32(v, carry);
+}
+
+// Undo the zigzag and the prediction in place, four values at a time.
+// Second order residuals sum to differences, starting from d1, and
+// differences to values, starting from x1.
+static void _unpredict(int32_t * x, int order, int32_t x1, int32_t d1)
+{
+    __m128i one = _mm_set1_epi32(1);
+    __m128i d = _mm_set1_epi32(d1);
+    __m128i c = _mm_set1_epi32(x1);
+
+    for (int i = 0; i < SPACK_BLOCK; i += 4) {
+        __m128i v = _mm_load_si128((const __m128i *)(x + i));
+        v = _mm_xor_si128(_mm_srli_epi32(v, 1),
+                          _mm_sub_epi32(_mm_setzero_si128(),
+                                        _mm_and_si128(v, one)));
+        if (order >= 2) {
+            v = _prefix_sum(v, d);
+            d = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3));
+        }
+        if (order >= 1) {
+            v = _prefix_sum(v, c);
+            c = _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3));
+        }
+        _mm_store_si128((__m128i *) (x + i), v);
+    }
+}
+
+// Decode one channel of a block into x. Returns the end of the channel.
+static const uint8_t *_decode_channel(const uint8_t * in, int32_t * x)
+{
+    int order = in[0];
+    int32_t x1, d1;
+    memcpy(&x1, in + 1, sizeof(x1));
+    memcpy(&d1, in + 1 + sizeof(x1), sizeof(d1));
+    const uint8_t *width = in + 1 + 2 * sizeof(int32_t);
+    in += HEADER_SIZE;
+
+    for (int g = 0; g < GROUPS; ++g) {
+        _unpack(in, width[g], (uint32_t *) x + g * SPACK_GROUP);
+        in += width[g] * SPACK_GROUP / 8;
+    }
+
+    _unpredict(x, order, x1, d1);
+    return in;
+}
+
+void spack_decode(const SamplePack * p, int b, int16_t * out)
+{
+    if (b < 0 || b >= p->numBlocks) {
+        memset(out, 0, 2 * SPACK_BLOCK * sizeof(int16_t));
+        return;
+    }
+
+    int32_t mid[SPACK_BLOCK] __attribute__ ((aligned(16)));
+    int32_t side[SPACK_BLOCK] __attribute__ ((aligned(16)));
+    const uint8_t *in = p->bytes + p->index[b];
+    in = _decode_channel(in, mid);
+    _decode_channel(in, side);
+
+    // Back to left and right, eight frames at a time. The values are in
+    // range, so packing doesn't saturate.
+    for (int i = 0; i < SPACK_BLOCK; i += 8) {
+        __m128i m0 = _mm_load_si128((const __m128i *)(mid + i));
+        __m128i m1 = _mm_load_si128((const __m128i *)(mid + i + 4));
+        __m128i s0 = _mm_load_si128((const __m128i *)(side + i));
+        __m128i s1 = _mm_load_si128((const __m128i *)(side + i + 4));
+        __m128i r0 = _mm_sub_epi32(m0, _mm_srai_epi32(s0, 1));
+        __m128i r1 = _mm_sub_epi32(m1, _mm_srai_epi32(s1, 1));
+        __m128i l0 = _mm_add_epi32(s0, r0);
+        __m128i l1 = _mm_add_epi32(s1, r1);
+        __m128i L = _mm_packs_epi32(l0, l1);
+        __m128i R = _mm_packs_epi32(r0, r1);
+        _mm_storeu_si128((__m128i *) (out + 2 * i), _mm_unpacklo_epi16(L, R));
+        _mm_storeu_si128((__m128i *) (out + 2 * i + 8),
+                         _mm_unpackhi_epi16(L, R));
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef SAMPLEPACK_H_
+#define SAMPLEPACK_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SPACK_BLOCK 1024        // Frames per block.
+#define SPACK_GROUP 64          // Values per bit-packed group.
+
+// SamplePack: Losslessly compressed sample data. The data is split into
+// blocks of SPACK_BLOCK frames that each decode on their own, found through
+// an index, so playback can start anywhere. Blocks outside the sample decode
+// as zeros, like the padding around uncompressed data.
+//
+// Each block stores the channels as mid and side. Each is predicted from the
+// frames before it, with the best of three fixed predictors for the block,
+// and the residuals are bit-packed in groups of SPACK_GROUP, each with its
+// own width.
+typedef struct {
+    int len;                    // Frames.
+    int numBlocks;
+    uint32_t *index;            // Offset of each block in bytes, and the end.
+    uint8_t *bytes;
+} SamplePack;
+
+// spack_new: Compress len frames of left/right interleaved data.
+SamplePack *spack_new(const int16_t * data, int len);
+
+// spack_free: Free a pack from spack_new. NULL is ignored.
+void spack_free(SamplePack * p);
+
+// spack_size: Return the memory used by the pack, in bytes.
+size_t spack_size(const SamplePack * p);
+
+// spack_decode: Decode block b into out, which holds 2 * SPACK_BLOCK
+// interleaved values. Safe to call from the audio thread.
+void spack_decode(const SamplePack * p, int b, int16_t * out);
+
+#endif                          // SAMPLEPACK_H_
@@ -1,20 +1,32 @@
 #include <unistd.h>
 #include <stdio.h>
-#include <pthread.h>
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
 #include <alsa/asoundlib.h>
+#include <jack/midiport.h>
 #include "global.h"
 #include "sampler.h"
 #include "confconfig.h"
 #include "conftuning.h"
 #include "confcontrols.h"
-#include "playingsample.h"
+#include "confpresets.h"
+#include "samplecache.h"
+#include "stream.h"
+#include "mixpool.h"
+#include "stats.h"
 #include "mem.h"
+#include "samplemem.h"
+#include "rtcheck.h"
 
 void sampler_init()
 {
     errBadState = "The sampler is in the incorrect state.";
     errBadDir = "The directory appears to be invalid.";
+    errNoSlot = "Every instrument slot is in use.";
 
     if (pthread_mutex_init(&_sampler.mutex, NULL) != 0) {
         printf("Failed to initialize mutex.\n");
@@ -25,39 +37,66 @@ void sampler_init()
 
     _sampler.peak = _mm_setzero_pd();
 
-    // Intialize controls and sample storage.
-    ctrls_load_defaults();
-    sstore_init();
+    // Intialize the instrument slots, mixing kernels and constant ramps.
+    interp_init();
+    mix_t tauSteal = exp(-1000.0 / (SAMPLE_RATE * VOICE_STEAL_TAU));
+    mix_t steal = 1;
+    for (int i = 0; i < JACK_BUF_SIZE + 1; ++i) {
+        steal *= tauSteal;
+        _sampler.rampOne[i] = 1;
+        _sampler.rampSteal[i] = steal;
+    }
+    for (int i = 0; i < SAMPLER_SLOTS; ++i) {
+        inst_init(&_sampler.slot[i]);
+    }
+    for (int ch = 0; ch < MIDI_CHANNELS; ++ch) {
+        atomic_store(&_sampler.active[ch], NULL);
+    }
+    atomic_store(&_sampler.next, NULL);
+    atomic_store(&_sampler.reclaimRun, false);
+    for (int i = 0; i < 128; ++i) {
+        _sampler.program[i] = NULL;
+    }
 
     // Initialize config files.
     confconfig_init();
     conftuning_init();
     confctrls_init();
+    confpresets_init();
 
-    // Initialize ring buffers.
-    // psNew is twice as big because we always put two playing samples in at a
-    // time.
-    _sampler.psPlaying = ringbuf_new(RING_BUF_SIZE);
-    _sampler.psNew = ringbuf_new(2 * RING_BUF_SIZE);
-    _sampler.psRecycle = ringbuf_new(RING_BUF_SIZE);
-
-    // Fill the recycle ring buffer.
-    int i;
-    for (i = 0; i < RING_BUF_SIZE; ++i) {
-        PlayingSample *ps = malloc_exit(sizeof(PlayingSample));
-        ringbuf_put(_sampler.psRecycle, ps);
-    }
-
-    // Start the midi-reading thread.
-    pthread_t thread;
-    int status = pthread_create(&thread, NULL, sampler_midi_thread, NULL);
-    if (status != 0) {
-        printf("Sampler: Failed to create midi processing thread.");
+    // Initialize the event queue.
+    _sampler.events = evq_new(EVENT_BUF_SIZE);
+    if (pthread_mutex_init(&_sampler.eventLock, NULL) != 0) {
+        printf("Failed to initialize mutex.\n");
         exit(1);
     }
+    _sampler.frame = 0;
+    _sampler.midiBuf = NULL;
+    _sampler.midiCount = 0;
+    _sampler.midiIdx = 0;
+
+    // Initialize the voice pool and mix threads.
+    mixpool_init();
+    stream_init();
+    vpool_init(&_sampler.voices);
+    atomic_store(&_sampler.numPlaying, 0);
+    stats_init();
+
+    // No jack client until sampler_init_jack is called.
+    _sampler.jackClient = NULL;
+    _sampler.jackPortMidi = NULL;
+    atomic_store(&_sampler.midiRun, false);
+    _sampler.chanBuf = NULL;
+}
 
+void sampler_init_jack()
+{
     // Initialize jack.
     _sampler.jackClient = jack_client_open("JLSampler", JackNullOption, NULL);
+    if (_sampler.jackClient == NULL) {
+        printf("Sampler: Failed to open jack client.\n");
+        exit(1);
+    }
 
     // Create jack output ports.
     _sampler.jackPortL = jack_port_register(_sampler.jackClient, "Out_1",
@@ -70,6 +109,7 @@ void sampler_init()
 
     // Set the jack process callback.
     jack_set_process_callback(_sampler.jackClient, sampler_jack_process, NULL);
+    jack_set_xrun_callback(_sampler.jackClient, stats_xrun, NULL);
 }
 
 int sampler_state()
@@ -86,80 +126,467 @@ inline __m128d sampler_get_peaks()
 
 inline int sampler_num_playing()
 {
-    return ringbuf_count(_sampler.psPlaying);
+    return atomic_load_explicit(&_sampler.numPlaying, memory_order_relaxed);
 }
 
-static const char *_sampler_load(char *dir)
+Controls *sampler_controls()
 {
-    if (_sampler.state != SAMPLER_STATE_STOPPED) {
-        return errBadState;
+    Instrument *inst = atomic_load(&_sampler.active[0]);
+    return &(inst != NULL ? inst : &_sampler.slot[0])->ctrls;
+}
+
+// ----------------------------------------------------------------------------
+// Instrument activation. Called from the audio thread, or by the loader
+// before it starts.
+// ----------------------------------------------------------------------------
+
+// True if the instrument is active or has voices playing.
+static inline bool _live(const Instrument * inst)
+{
+    return inst->activeOn > 0 || inst->numVoices > 0;
+}
+
+// Make an instrument active on a midi channel. The held sustain pedal and
+// pitch bend carry over, so the change isn't heard. Voices of the old
+// instrument keep playing, and once it isn't active on any channel it's
+// retired, unless it's a preset.
+static void _activate(int channel, Instrument * inst)
+{
+    Instrument *old = atomic_load_explicit(&_sampler.active[channel],
+                                           memory_order_relaxed);
+    if (inst == old) {
+        return;
+    }
+    atomic_store(&_sampler.active[channel], inst);
+    inst->activeOn++;
+    if (old == NULL) {
+        return;
     }
 
-    _sampler.state = SAMPLER_STATE_LOADING;
+    if (inst->activeOn == 1) {
+        ctrls_update_direct(&inst->ctrls, CTRL_SUSTAIN,
+                            ctrls_value(&old->ctrls, CTRL_SUSTAIN));
+        ctrls_update_direct(&inst->ctrls, CTRL_PITCH_BEND,
+                            ctrls_value(&old->ctrls, CTRL_PITCH_BEND));
+    }
 
-    printf("Sampler: State = Loading\n");
-    printf("Directory: %s\n", dir);
+    if (--old->activeOn == 0 && !old->preset) {
+        atomic_store(&old->state, INST_RETIRED);
+        if (old->numVoices == 0) {
+            atomic_store(&old->drained, true);
+        }
+    }
+}
 
-    // Attempt to change into the given directory.
-    if (chdir(dir) != 0) {
-        printf("Failed to change into directory: %s\n", dir);
-        _sampler.state = SAMPLER_STATE_STOPPED;
+// Swap in a posted instrument on every channel.
+static void _swap()
+{
+    Instrument *next = atomic_exchange(&_sampler.next, NULL);
+    if (next == NULL) {
+        return;
+    }
+    for (int ch = 0; ch < MIDI_CHANNELS; ++ch) {
+        _activate(ch, next);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Instrument reclaiming.
+// ----------------------------------------------------------------------------
+
+// Free every retired instrument whose voices have finished and whose samples
+// aren't shared. A slot is claimed by moving it to the loading state, so it
+// is only freed once.
+static void _reclaim()
+{
+    for (int i = 0; i < SAMPLER_SLOTS; ++i) {
+        Instrument *inst = &_sampler.slot[i];
+        int state = INST_RETIRED;
+        if (atomic_load(&inst->drained) &&
+            atomic_load(&inst->sharers) == 0 &&
+            atomic_compare_exchange_strong(&inst->state, &state,
+                                           INST_LOADING)) {
+            printf("Sampler: Reclaiming %s\n", inst->dir);
+            inst_free(inst);
+        }
+    }
+}
+
+static void *_reclaim_thread(void *arg)
+{
+    while (atomic_load(&_sampler.reclaimRun)) {
+        _reclaim();
+        usleep(SAMPLER_RECLAIM_US);
+    }
+    return NULL;
+}
+
+// Free every slot and forget the presets. Nothing may be playing.
+static void _free_slots()
+{
+    for (int ch = 0; ch < MIDI_CHANNELS; ++ch) {
+        atomic_store(&_sampler.active[ch], NULL);
+    }
+    atomic_store(&_sampler.next, NULL);
+    for (int i = 0; i < 128; ++i) {
+        _sampler.program[i] = NULL;
+    }
+    for (int i = 0; i < SAMPLER_SLOTS; ++i) {
+        if (atomic_load(&_sampler.slot[i].state) != INST_FREE) {
+            inst_free(&_sampler.slot[i]);
+        }
+    }
+
+    // Sharers are counted off their source as they're freed, so slots are
+    // reset once all of them are.
+    for (int i = 0; i < SAMPLER_SLOTS; ++i) {
+        inst_init(&_sampler.slot[i]);
+    }
+}
+
+// Return a free slot for the next instrument. If every slot is in use, the
+// voices of retired instruments are faded out so they can be reclaimed.
+// Returns NULL if no slot can be freed.
+static Instrument *_free_slot()
+{
+    // A posted instrument that was never swapped in has no voices.
+    Instrument *next = atomic_exchange(&_sampler.next, NULL);
+    if (next != NULL) {
+        inst_free(next);
+    }
+
+    while (true) {
+        bool waiting = false;
+        for (int i = 0; i < SAMPLER_SLOTS; ++i) {
+            Instrument *inst = &_sampler.slot[i];
+            int state = atomic_load(&inst->state);
+            if (state == INST_FREE) {
+                return inst;
+            }
+            if (state == INST_RETIRED && atomic_load(&inst->sharers) == 0) {
+                atomic_store(&inst->kill, true);
+                waiting = true;
+            }
+        }
+        if (!waiting) {
+            return NULL;
+        }
+        usleep(SAMPLER_RECLAIM_US);
+    }
+}
+
+// Return a READY instrument loaded from path whose samples can be shared,
+// counting the caller as a sharer, or NULL. Taking the reference before
+// checking the state keeps the reclaim thread from freeing it, should a
+// program change retire it meanwhile.
+static Instrument *_find_share(const char *path)
+{
+    for (int i = 0; i < SAMPLER_SLOTS; ++i) {
+        Instrument *inst = &_sampler.slot[i];
+        atomic_fetch_add(&inst->sharers, 1);
+        if (atomic_load(&inst->state) == INST_READY &&
+            inst->source == NULL && strcmp(inst->dir, path) == 0) {
+            return inst;
+        }
+        atomic_fetch_sub(&inst->sharers, 1);
+    }
+    return NULL;
+}
+
+// Load the instrument at path into a free slot.
+static const char *_load_slot(char *path, Instrument ** inst)
+{
+    *inst = _free_slot();
+    if (*inst == NULL) {
+        return errNoSlot;
+    }
+    const char *err = inst_load(*inst, path, _sampler.jackClient != NULL,
+                                _find_share(path));
+    if (err == NULL && (*inst)->packed) {
+        vpool_alloc_windows(&_sampler.voices);
+    }
+    return err;
+}
+
+// Load each preset in presets.conf, in the working directory. The lowest
+// program is made active on every channel that doesn't have a preset of its
+// own.
+static const char *_load_presets()
+{
+    char *presetDir = getcwd(NULL, 0);
+    const char *err = NULL;
+    int channel[128];
+
+    for (int prog = 0; prog < 128 && err == NULL; ++prog) {
+        char *dir = confpresets_dir(prog);
+        if (dir == NULL) {
+            continue;
+        }
+        char *ctrls = confpresets_controls(prog);
+
+        // Paths are relative to the presets file, and loading changes the
+        // working directory.
+        char *path = NULL, *ctrlsPath = NULL;
+        if (chdir(presetDir) == 0) {
+            path = realpath(dir, NULL);
+            ctrlsPath = ctrls != NULL ? realpath(ctrls, NULL) : NULL;
+        }
+        printf("Sampler: Program %i: %s\n", prog, dir);
+
+        Instrument *inst;
+        if (path == NULL || (ctrls != NULL && ctrlsPath == NULL)) {
+            err = errBadDir;
+        } else if ((err = _load_slot(path, &inst)) == NULL) {
+            if (ctrlsPath != NULL) {
+                confctrls_load(&inst->ctrls, ctrlsPath);
+                confctrls_unload();
+            }
+            inst->preset = true;
+            _sampler.program[prog] = inst;
+            channel[prog] = confpresets_channel(prog);
+        }
+
+        free(path);
+        free(ctrlsPath);
+        g_free(dir);
+        g_free(ctrls);
+    }
+
+    free(presetDir);
+    if (err != NULL) {
+        return err;
+    }
+
+    // Where presets name the same channel, the lowest program wins.
+    Instrument *lowest = NULL;
+    for (int prog = 127; prog >= 0; --prog) {
+        if (_sampler.program[prog] == NULL) {
+            continue;
+        }
+        lowest = _sampler.program[prog];
+        if (channel[prog] >= 0) {
+            _activate(channel[prog], lowest);
+        }
+    }
+    if (lowest == NULL) {
         return errBadDir;
     }
-    // Load control defaults.
-    ctrls_load_defaults();
+    for (int ch = 0; ch < MIDI_CHANNELS; ++ch) {
+        if (atomic_load(&_sampler.active[ch]) == NULL) {
+            _activate(ch, lowest);
+        }
+    }
+    return NULL;
+}
 
-    // Load config files.
-    confconfig_load();
-    conftuning_load();
-    confctrls_load("controls.conf");
+// ----------------------------------------------------------------------------
+// Channel outputs.
+// ----------------------------------------------------------------------------
 
-    // Change into sample directory to load samples.
-    if (chdir("./samples") != 0) {
-        printf("Failed to change into samples directory.\n");
-        _sampler.state = SAMPLER_STATE_STOPPED;
+// Allocate a mix buffer for each midi channel, and register its jack ports.
+static void _channel_outputs_start()
+{
+    size_t size = MIDI_CHANNELS * 2 * JACK_BUF_SIZE * sizeof(mix_t);
+    if (posix_memalign((void **)&_sampler.chanBuf, 64, size) != 0) {
+        printf("Sampler: Failed to allocate channel buffers.\n");
+        exit(1);
+    }
+    memset(_sampler.chanBuf, 0, size);
+
+    for (int ch = 0; ch < MIDI_CHANNELS; ++ch) {
+        for (int side = 0; side < 2; ++side) {
+            _sampler.jackPortChan[ch][side] = NULL;
+            if (_sampler.jackClient == NULL) {
+                continue;
+            }
+            char name[32];
+            snprintf(name, sizeof(name), "Ch%i_Out_%i", ch + 1, side + 1);
+            _sampler.jackPortChan[ch][side] =
+                jack_port_register(_sampler.jackClient, name,
+                                   JACK_DEFAULT_AUDIO_TYPE,
+                                   JackPortIsOutput, 0);
+        }
+    }
+}
+
+// Unregister the channel ports and free their buffers. The jack client must
+// be inactive.
+static void _channel_outputs_stop()
+{
+    if (_sampler.chanBuf == NULL) {
+        return;
+    }
+    for (int ch = 0; ch < MIDI_CHANNELS; ++ch) {
+        for (int side = 0; side < 2; ++side) {
+            if (_sampler.jackPortChan[ch][side] != NULL) {
+                jack_port_unregister(_sampler.jackClient,
+                                     _sampler.jackPortChan[ch][side]);
+            }
+        }
+    }
+    free(_sampler.chanBuf);
+    _sampler.chanBuf = NULL;
+}
+
+// Return the channel's mix buffer.
+static inline mix_t *_chan_buf(int channel)
+{
+    return _sampler.chanBuf + channel * 2 * JACK_BUF_SIZE;
+}
+
+// ----------------------------------------------------------------------------
+// Midi input.
+// ----------------------------------------------------------------------------
+
+// Register the jack midi port, or start the ALSA thread. Events from the jack
+// port are played in the callback without going through the event queue.
+// The jack client must be inactive.
+static void _midi_input_start(int input)
+{
+    if (_sampler.jackClient == NULL) {
+        return;
+    }
+    if (input == MIDI_INPUT_JACK) {
+        _sampler.jackPortMidi =
+            jack_port_register(_sampler.jackClient, "MIDI_In",
+                               JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0);
+        if (_sampler.jackPortMidi == NULL) {
+            printf("Sampler: Failed to create jack midi port.\n");
+        }
+        return;
+    }
+    atomic_store(&_sampler.midiRun, true);
+    if (pthread_create(&_sampler.midiThread, NULL, sampler_midi_thread,
+                       NULL) != 0) {
+        printf("Sampler: Failed to create midi processing thread.\n");
+        exit(1);
+    }
+}
+
+// Unregister the jack midi port, or stop the ALSA thread, which closes its
+// sequencer client. The jack client must be inactive.
+static void _midi_input_stop()
+{
+    if (_sampler.jackPortMidi != NULL) {
+        jack_port_unregister(_sampler.jackClient, _sampler.jackPortMidi);
+        _sampler.jackPortMidi = NULL;
+        _sampler.midiBuf = NULL;
+        _sampler.midiCount = 0;
+        _sampler.midiIdx = 0;
+    }
+    if (atomic_load(&_sampler.midiRun)) {
+        atomic_store(&_sampler.midiRun, false);
+        pthread_join(_sampler.midiThread, NULL);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// sampler_load / sampler_unload
+// ----------------------------------------------------------------------------
+
+// Load an instrument while the current one keeps playing, and post it to be
+// swapped in by the audio thread.
+static const char *_sampler_swap(char *path)
+{
+    printf("Sampler: Loading next instrument\n");
+    printf("Directory: %s\n", path);
+
+    Instrument *inst;
+    const char *err = _load_slot(path, &inst);
+    if (err != NULL) {
+        return err;
+    }
+
+    atomic_store(&_sampler.next, inst);
+    stats_reset();
+    return NULL;
+}
+
+static const char *_sampler_load(char *dir)
+{
+    if (_sampler.state != SAMPLER_STATE_STOPPED &&
+        _sampler.state != SAMPLER_STATE_RUNNING) {
+        return errBadState;
+    }
+
+    // Loading changes the working directory, so relative paths are resolved
+    // first.
+    char *path = realpath(dir, NULL);
+    if (path == NULL || chdir(path) != 0) {
+        printf("Failed to change into directory: %s\n", dir);
+        free(path);
         return errBadDir;
     }
-    // Load samples using file info.
-    printf("Loading samples...\n");
-    sstore_load();
+    bool presets = confpresets_load();
+    bool chanOut = presets && confpresets_channel_outputs();
+
+    const char *err;
+    if (_sampler.state == SAMPLER_STATE_RUNNING) {
+        // Presets are only loaded when stopped, as they replace every slot.
+        err = presets ? errBadState : _sampler_swap(path);
+        confpresets_unload();
+        free(path);
+        return err;
+    }
+
+    _sampler.state = SAMPLER_STATE_LOADING;
+
+    printf("Sampler: State = Loading\n");
+    printf("Directory: %s\n", path);
+
+    if (presets) {
+        err = _load_presets();
+    } else {
+        Instrument *inst;
+        err = _load_slot(path, &inst);
+        for (int ch = 0; ch < MIDI_CHANNELS && err == NULL; ++ch) {
+            _activate(ch, inst);
+        }
+    }
+    confpresets_unload();
+    free(path);
 
-    // Change back to sampler directory.
-    if (chdir("../") != 0) {
-        printf("Warning: Failed to change out of sample directory.");
+    if (err != NULL) {
+        _free_slots();
+        _sampler.state = SAMPLER_STATE_STOPPED;
+        return err;
     }
+    Instrument *inst = atomic_load(&_sampler.active[0]);
 
-    // Fake RC layer.
-    if(confconfig_fake_rc_layer() != 0) {
-        printf("Creating fake RC layer, order %i...\n",
-               confconfig_fake_rc_layer());
-        sstore_fake_rc_layer(confconfig_fake_rc_layer());
+    if (chanOut) {
+        _channel_outputs_start();
     }
 
-    // Borrow samples.
-    printf("Borrowing samples +/- %i...\n", confconfig_rr_borrow());
-    sstore_borrow_samples(confconfig_rr_borrow());
+    // The first instrument loaded sets the midi input.
+    _midi_input_start(inst->midiInput);
 
-    // Fill samples.
-    printf("Filling samples...\n");
-    sstore_fill_samples();
+    // Offline, frame time starts from zero when loaded.
+    _sampler.frame = 0;
 
-    // Crop samples.
-    printf("Cropping samples, th = %f...\n", confconfig_crop_thresh());
-    sstore_crop(confconfig_crop_thresh());
+    // Mix threads run at the jack thread's priority. The first instrument
+    // loaded sets the number of threads.
+    int priority = -1;
+    if (_sampler.jackClient != NULL) {
+        priority = jack_client_real_time_priority(_sampler.jackClient);
+    }
+    mixpool_start(inst->mixThreads, priority);
 
-    // Compute sample RMS values.
-    printf("Computing RMS values, dt = %f...\n", confconfig_rms_time());
-    sstore_compute_rms(confconfig_rms_time());
+    // Start freeing instruments swapped out from here on.
+    atomic_store(&_sampler.reclaimRun, true);
+    if (pthread_create(&_sampler.reclaimThread, NULL, _reclaim_thread,
+                       NULL) != 0) {
+        printf("Sampler: Failed to create reclaim thread.\n");
+        exit(1);
+    }
 
-    // Unload config files.
-    confconfig_unload();
-    conftuning_unload();
-    confctrls_unload();
+    // Callback stats are kept per instrument.
+    stats_reset();
 
-    // Activate our jack client.
-    printf("Activating Jack client...\n");
-    jack_activate(_sampler.jackClient);
+    // Activate our jack client. There is none when rendering offline.
+    if (_sampler.jackClient != NULL) {
+        printf("Activating Jack client...\n");
+        jack_activate(_sampler.jackClient);
+    }
 
     // Done.
     _sampler.state = SAMPLER_STATE_RUNNING;
@@ -174,18 +601,6 @@ const char *sampler_load(char *dir)
     return ret;
 }
 
-static void _unload_buffer(RingBuffer * rb)
-{
-    PlayingSample *ps;
-    int count = ringbuf_count(rb);
-    for (int i = 0; i < count; ++i) {
-        ps = ringbuf_get(rb);
-        if (ps != NULL) {
-            ringbuf_put(_sampler.psRecycle, ps);
-        }
-    }
-}
-
 const char *_sampler_unload()
 {
     if (_sampler.state != SAMPLER_STATE_RUNNING) {
@@ -195,18 +610,32 @@ const char *_sampler_unload()
     _sampler.state = SAMPLER_STATE_UNLOADING;
 
     // Stop jack callback.
-    printf("Stopping jack client...\n");
-    jack_deactivate(_sampler.jackClient);
-    sleep(1);
-
-    // Free sample memory.
-    printf("Freeing sample memory...\n");
-    sstore_free_data();
+    if (_sampler.jackClient != NULL) {
+        printf("Stopping jack client...\n");
+        jack_deactivate(_sampler.jackClient);
+        sleep(1);
+    }
+    _midi_input_stop();
+
+    // Stop mix threads, reclaiming and streaming.
+    mixpool_stop();
+    atomic_store(&_sampler.reclaimRun, false);
+    pthread_join(_sampler.reclaimThread, NULL);
+    stream_stop();
+
+    // Stop playing samples and drop pending events.
+    printf("Stopping playing samples...\n");
+    while (_sampler.voices.numPlaying) {
+        vpool_stop(&_sampler.voices, 0);
+    }
+    atomic_store(&_sampler.numPlaying, 0);
+    Event ev;
+    while (evq_get(_sampler.events, &ev)) {
+    }
 
-    // Clear ring buffers.
-    printf("Clearing ring buffers...\n");
-    _unload_buffer(_sampler.psPlaying);
-    _unload_buffer(_sampler.psNew);
+    // Free every instrument and the channel outputs.
+    _free_slots();
+    _channel_outputs_stop();
 
     _sampler.state = SAMPLER_STATE_STOPPED;
     return NULL;
@@ -221,30 +650,104 @@ const char *sampler_unload()
 
 }
 
-static void _load_ps(
-    PlayingSample *ps, int key, double vel, Sample *sample, double mix)
+// ----------------------------------------------------------------------------
+// Audio thread.
+// ----------------------------------------------------------------------------
+
+// Stop the i-th playing voice. Once an inactive instrument has no voices
+// left, it's marked as drained for the reclaim thread.
+static void _stop_voice(VoicePool * vp, int i)
 {
-    ps->key = key;
-    ps->sample = sample;
-    ps->idx = ps->sample->idx0;
-    ps->amp = ctrls_sample_amp(key, vel, ps->sample->rms) * mix;
-    ps->pan = ctrls_sample_pan(key);
+    int v = vp->playing[i];
+    Instrument *inst = vp->inst[v];
+    if (vp->stolen[v]) {
+        inst->numStolen--;
+    }
+    vpool_stop(vp, i);
+    if (--inst->numVoices == 0) {
+        inst->channels = 0;
+        if (inst->activeOn == 0) {
+            atomic_store(&inst->drained, true);
+        }
+    }
+}
+
+// Start fading out the i-th playing voice.
+static void _steal_voice(VoicePool * vp, int i)
+{
+    vp->inst[vp->playing[i]]->numStolen++;
+    vpool_steal(vp, i);
+}
+
+// Fade out the voices of retired instruments that a loader is waiting on.
+static void _kill_voices()
+{
+    VoicePool *vp = &_sampler.voices;
+    for (int i = 0; i < vp->numPlaying; ++i) {
+        int v = vp->playing[i];
+        if (!vp->stolen[v] && atomic_load_explicit(&vp->inst[v]->kill,
+                                                   memory_order_relaxed)) {
+            _steal_voice(vp, i);
+        }
+    }
+}
 
-    if (ctrls_value(CTRL_TAU_FADE_IN) == 1) {
-        ps->fadeInAmp = 0;
+// Start playing a sample in a free voice. If the instrument, or the key on
+// it, is at its polyphony limit, one of its voices is stolen and faded out
+// first.
+static void _start_voice(Instrument * inst, int channel, int key, double vel,
+                         Sample * sample, double mix)
+{
+    VoicePool *vp = &_sampler.voices;
+    int policy = inst->voiceSteal;
+    int i = -1;
+
+    // Limits apply to the instrument's own voices, so one instrument can't
+    // steal from another.
+    if (inst->keyPolyphony > 0 &&
+        vpool_key_count(vp, inst, key) >= inst->keyPolyphony) {
+        i = vpool_victim(vp, inst, policy, key, true);
+    } else if (inst->numVoices - inst->numStolen >= inst->polyphony) {
+        i = vpool_victim(vp, inst, policy, key, false);
+    }
+    if (i >= 0) {
+        _steal_voice(vp, i);
+    }
+
+    // If every voice is in use, even by fading voices, the oldest is cut.
+    int v = vpool_start(vp);
+    if (v < 0) {
+        _stop_voice(vp, vpool_oldest(vp));
+        v = vpool_start(vp);
+    }
+
+    inst->numVoices++;
+    inst->channels |= 1u << channel;
+    vp->inst[v] = inst;
+    vp->channel[v] = channel;
+    vp->key[v] = key;
+    vp->sample[v] = sample;
+    vp->idx[v] = sample->idx0;
+    vp->amp[v] = ctrls_sample_amp(&inst->ctrls, key, vel, sample->rms) * mix;
+    vp->pan[v] = ctrls_sample_pan(&inst->ctrls, key);
+    stream_voice_start(&vp->stream[v], inst->region, sample);
+
+    if (ctrls_value(&inst->ctrls, CTRL_TAU_FADE_IN) == 1) {
+        vp->fadeInAmp[v] = 0;
     } else {
-        ps->fadeInAmp = 1;
+        vp->fadeInAmp[v] = 1;
     }
 }
 
-// Helper for sampler_midi_thread: playback sample without layer mixing.
-static void _sampler_midi_thread_note(int key, double vel)
+// Start playing a note on an instrument from a midi channel, or release it if
+// vel is zero. Called from the audio thread.
+static void _play_note(Instrument * inst, int channel, int key, double vel)
 {
     // Transpose.
-    key += (int)ctrls_value(CTRL_TRANSPOSE);
+    key += (int)ctrls_value(&inst->ctrls, CTRL_TRANSPOSE);
 
     // Update the controls.
-    ctrls_key_update(key, vel);
+    ctrls_key_update(&inst->ctrls, key, vel);
 
     // If no velocity, nothing to do.
     if (vel == 0) {
@@ -252,42 +755,172 @@ static void _sampler_midi_thread_note(int key, double vel)
     }
 
     Sample *sample1, *sample2;
-    double mix1 = sstore_get_samples(key, vel, &sample1, &sample2);
+    double mix1 = sstore_get_samples(inst->store, &inst->ctrls, key, vel,
+                                     &sample1, &sample2);
     // If we don't have samples, return.
     if(sample1 == NULL && sample2 == NULL) {
         return;
     }
 
-    PlayingSample *ps = ringbuf_get(_sampler.psRecycle);
-    if(ps == NULL) {
-        printf("Buffers full. Key: %i Velocity: %f.\n", key, vel);
-        return;
+    _start_voice(inst, channel, key, vel, sample1, mix1);
+    if(sample2 != NULL) {
+        _start_voice(inst, channel, key, vel, sample2, 1 - mix1);
     }
+}
 
-    _load_ps(ps, key, vel, sample1, mix1);
-    ringbuf_put(_sampler.psNew, ps);
+// Play an event from the queue. Called from the audio thread. New notes are
+// played on the instrument active on the event's channel, while releases,
+// controls and pitch bend also reach instruments still playing voices started
+// from that channel before a swap or program change.
+static void _play_event(const Event * ev)
+{
+    int ch = ev->channel;
 
-    if(sample2 == NULL) {
-        ringbuf_put(_sampler.psNew, NULL);
+    // Program changes switch the channel to a preset, in constant time.
+    if (ev->type == EVENT_PROGRAM) {
+        if (_sampler.program[ev->param] != NULL) {
+            _activate(ch, _sampler.program[ev->param]);
+        }
         return;
     }
 
-    ps = ringbuf_get(_sampler.psRecycle);
-    if(ps == NULL) {
-        printf("Buffers full. Key: %i Velocity: %f.\n", key, vel);
+    Instrument *active = atomic_load_explicit(&_sampler.active[ch],
+                                              memory_order_relaxed);
+
+    for (int i = 0; i < SAMPLER_SLOTS; ++i) {
+        Instrument *inst = &_sampler.slot[i];
+        if (inst != active && (!(inst->channels & (1u << ch)) ||
+                               (ev->type == EVENT_NOTE && ev->value != 0))) {
+            continue;
+        }
+
+        switch (ev->type) {
+        case EVENT_NOTE:
+            _play_note(inst, ch, ev->param, ev->value);
+            break;
+        case EVENT_CONTROL:
+            ctrls_midi_update(&inst->ctrls, ev->param, ev->value);
+            break;
+        case EVENT_PITCH_BEND:
+            ctrls_update(&inst->ctrls, CTRL_PITCH_BEND, ev->value);
+            break;
+        }
+
+        // The change takes effect from the event's frame.
+        ctrls_commit(&inst->ctrls);
+    }
+}
+
+// Queue an event. The ALSA thread and the daemon's socket thread may both
+// queue events, so they take turns.
+static void _put_event(int channel, int type, int param, double value,
+                       jack_nframes_t frame)
+{
+    Event ev = {.frame = frame,.channel = channel,.type = type,.param = param,
+        .value = value
+    };
+    pthread_mutex_lock(&_sampler.eventLock);
+    bool queued = evq_put(_sampler.events, &ev);
+    pthread_mutex_unlock(&_sampler.eventLock);
+    if (!queued) {
+        stats_event_dropped();
+    }
+}
+
+// The current frame time. Offline, this is the start of the next block.
+static jack_nframes_t _now()
+{
+    if (_sampler.jackClient != NULL) {
+        return jack_frame_time(_sampler.jackClient);
+    }
+    return _sampler.frame;
+}
+
+void sampler_note(int channel, int key, double vel)
+{
+    _put_event(channel, EVENT_NOTE, key, vel, _now());
+}
+
+void sampler_control(int channel, int control, double value)
+{
+    _put_event(channel, EVENT_CONTROL, control, value, _now());
+}
+
+void sampler_pitch_bend(int channel, double value)
+{
+    _put_event(channel, EVENT_PITCH_BEND, 0, value, _now());
+}
+
+void sampler_program(int channel, int program)
+{
+    _put_event(channel, EVENT_PROGRAM, program, 0, _now());
+}
+
+// Convert a raw midi channel message of the given size to an event. Returns
+// false for messages the sampler doesn't play.
+static bool _midi_event(const uint8_t * msg, size_t size, Event * ev)
+{
+    // Program changes have one data byte, and the rest two.
+    if (size < 2 || (size < 3 && (msg[0] & 0xF0) != 0xC0)) {
+        return false;
+    }
+
+    ev->channel = msg[0] & 0x0F;
+    switch (msg[0] & 0xF0) {
+    case 0x90:
+        // A note-on with zero velocity is a note-off.
+        ev->type = EVENT_NOTE;
+        ev->param = msg[1];
+        ev->value = (double)(msg[2]) / 127.0;
+        return true;
+    case 0x80:
+        ev->type = EVENT_NOTE;
+        ev->param = msg[1];
+        ev->value = 0;
+        return true;
+    case 0xB0:
+        ev->type = EVENT_CONTROL;
+        ev->param = msg[1];
+        ev->value = (double)(msg[2]) / 127.0;
+        return true;
+    case 0xC0:
+        ev->type = EVENT_PROGRAM;
+        ev->param = msg[1] & 0x7F;
+        ev->value = 0;
+        return true;
+    case 0xE0:
+        // 14-bit value, LSB first, centered on 8192.
+        ev->type = EVENT_PITCH_BEND;
+        ev->param = 0;
+        ev->value = (double)((msg[2] << 7 | msg[1]) - 8192) / 8192.0;
+        return true;
+    }
+    return false;
+}
+
+void sampler_midi_message(const uint8_t * msg, jack_nframes_t frame)
+{
+    if (_sampler.state != SAMPLER_STATE_RUNNING) {
         return;
     }
 
-    _load_ps(ps, key, vel, sample2, 1 - mix1);
-    ringbuf_put(_sampler.psNew, ps);
+    Event ev;
+    if (_midi_event(msg, 3, &ev)) {
+        _put_event(ev.channel, ev.type, ev.param, ev.value, frame);
+    }
 }
 
+// How often the ALSA thread checks whether it should stop, ms.
+#define MIDI_POLL_MS 100
+
 void *sampler_midi_thread()
 {
-    // We need to open the sequencer before doing anything else.
+    // We need to open the sequencer before doing anything else. It's read
+    // without blocking, so the thread can be stopped.
     snd_seq_t *handle;
 
-    int status = snd_seq_open(&handle, "default", SND_SEQ_OPEN_INPUT, 0);
+    int status = snd_seq_open(&handle, "default", SND_SEQ_OPEN_INPUT,
+                              SND_SEQ_NONBLOCK);
     if (status != 0) {
         printf("Failed to open sequencer.\n");
         exit(1);
@@ -307,11 +940,20 @@ void *sampler_midi_thread()
         printf("Failed to create sequencer port.\n");
         exit(1);
     }
+
+    int numFds = snd_seq_poll_descriptors_count(handle, POLLIN);
+    struct pollfd fds[numFds];
+    snd_seq_poll_descriptors(handle, fds, numFds, POLLIN);
+
     // We need a midi event handle to read incoming midi events.
     snd_seq_event_t *event;
 
-    while (1) {
+    while (atomic_load(&_sampler.midiRun)) {
         status = snd_seq_event_input(handle, &event);
+        if (status == -EAGAIN) {
+            poll(fds, numFds, MIDI_POLL_MS);
+            continue;
+        }
         if (status < 0) {
             printf("Sampler: Failed to read MIDI event. Status: %i\n", status);
             continue;
@@ -321,139 +963,425 @@ void *sampler_midi_thread()
             continue;
         }
 
+        int noteCh = event->data.note.channel & 0x0F;
+        int ctrlCh = event->data.control.channel & 0x0F;
+
         switch (event->type) {
         case SND_SEQ_EVENT_NOTEON:
-            _sampler_midi_thread_note(event->data.note.note,
-                                      (double)(event->data.note.velocity) /
-                                      127.0);
+            sampler_note(noteCh, event->data.note.note,
+                         (double)(event->data.note.velocity) / 127.0);
             break;
         case SND_SEQ_EVENT_NOTEOFF:
-            _sampler_midi_thread_note(event->data.note.note, 0);
+            sampler_note(noteCh, event->data.note.note, 0);
             break;
         case SND_SEQ_EVENT_CONTROLLER:
-            ctrls_midi_update(event->data.control.param,
-                              (double)(event->data.control.value) / 127.0);
+            sampler_control(ctrlCh, event->data.control.param,
+                            (double)(event->data.control.value) / 127.0);
+            break;
+        case SND_SEQ_EVENT_PGMCHANGE:
+            sampler_program(ctrlCh, event->data.control.value & 0x7F);
             break;
         case SND_SEQ_EVENT_PITCHBEND:
             // The pitch-bend value runs from -8192 to 8191.
-            ctrls_update(CTRL_PITCH_BEND,
-                         (double)(event->data.control.value) / 8192.0);
+            sampler_pitch_bend(ctrlCh,
+                               (double)(event->data.control.value) / 8192.0);
             break;
         }
     }
+
+    snd_seq_close(handle);
+    return NULL;
 }
 
-// Return 1 if done, 0 to continue playing.
-static inline int _proc_ps(PlayingSample * ps, int nframes,
-                           double pb, double pbSlope)
+// Decode blocks b0 onwards into the window of slot vs, keeping the blocks
+// already decoded.
+static void _fill_window(int vs, const SamplePack * p, int b0)
 {
-    __m128d *out = _sampler.jackBuf;
-    __m128d sLR;
+    VoicePool *vp = &_sampler.voices;
+    int16_t *win = vpool_window(vp, vs);
+    int shift = b0 - vp->winBlock[vs];
+    if (shift == 0 && vp->winBlocks[vs] == VOICE_WINDOW_BLOCKS) {
+        return;
+    }
 
-    Sample *sample = ps->sample;
+    int have = 0;
+    if (shift >= 0 && shift < vp->winBlocks[vs]) {
+        have = vp->winBlocks[vs] - shift;
+        memmove(win, win + 2 * shift * SPACK_BLOCK,
+                2 * have * SPACK_BLOCK * sizeof(int16_t));
+    }
+    for (int b = have; b < VOICE_WINDOW_BLOCKS; ++b) {
+        spack_decode(p, b0 + b, win + 2 * b * SPACK_BLOCK);
+    }
+    vp->winBlock[vs] = b0;
+    vp->winBlocks[vs] = VOICE_WINDOW_BLOCKS;
+}
 
-    double velocity = ctrls_key_velocity(ps->key);
-    double tauKeyUp = ctrls_value(CTRL_TAU_KEY_UP);
-    double tauFadeIn = ctrls_value(CTRL_TAU_FADE_IN);
-    double ctrlAmp = ctrls_value(CTRL_AMPLIFY);
+// Mix n frames of a voice playing a packed sample. The frames are mixed in
+// pieces, each reading only from the blocks decoded into the voice's window.
+static void _mix_packed(int vs, const InterpVoice * v, int n, int interp,
+                        mix_t * out)
+{
+    VoicePool *vp = &_sampler.voices;
+    const SamplePack *p = vp->sample[vs]->pack;
+    InterpVoice piece = *v;
+    piece.data = vpool_window(vp, vs);
+
+    for (int i = 0; i < n;) {
+        // The window starts at the block holding the first frame read. That
+        // is at least -INTERP_SINC_TAPS / 2, so b0 is at least -1: the zeros
+        // before the sample.
+        double pos = v->idx + v->speed * v->offset[i];
+        int first = (int)pos - INTERP_SINC_TAPS / 2;
+        int b0 = (first + SPACK_BLOCK) / SPACK_BLOCK - 1;
+        _fill_window(vs, p, b0);
+
+        // Bisect for the frames whose reads end in the window, with a frame
+        // to spare. The first frame always fits.
+        int end = (b0 + VOICE_WINDOW_BLOCKS) * SPACK_BLOCK;
+        double lim = (end - INTERP_SINC_TAPS / 2 - 1 - v->idx) / v->speed;
+        int lo = i + 1, hi = n;
+        while (lo < hi) {
+            int mid = (lo + hi) / 2;
+            if (v->offset[mid] < lim) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
 
-    if (ctrls_value(CTRL_SUSTAIN) > 0.5 || velocity != 0) {
-        tauKeyUp = 1;
+        piece.idx = v->idx - (double)b0 * SPACK_BLOCK;
+        piece.offset = v->offset + i;
+        piece.keyUp = v->keyUp + i;
+        piece.fadeIn = v->fadeIn + i;
+        interp_mix[interp] (&piece, lo - i, out + 2 * i);
+        i = lo;
     }
+}
 
-    for (int i = 0; i < nframes; ++i) {
-        // Fade out.
-        ps->amp *= tauKeyUp;
+// Mix the voice in slot vs. Return 1 if done, 0 to continue playing.
+static inline int _proc_voice(int vs, int nframes, mix_t * out)
+{
+    VoicePool *vp = &_sampler.voices;
+    Instrument *inst = vp->inst[vs];
+    const Controls *c = &inst->ctrls;
+    InterpRamps *r = &inst->ramps;
+    Sample *sample = vp->sample[vs];
+    InterpVoice v;
+
+    v.data = sample->data;
+    v.idx = vp->idx[vs];
+    v.speed = sample->speed;
+    v.amp = vp->amp[vs] * ctrls_value(c, CTRL_AMPLIFY);
+    v.fade = vp->fadeInAmp[vs];
+    v.offset = r->offset;
+    v.fadeIn = r->fadeIn;
+
+    if (vp->stolen[vs]) {
+        v.keyUp = _sampler.rampSteal;
+    } else if (ctrls_value(c, CTRL_SUSTAIN) > 0.5 ||
+               ctrls_key_velocity(c, vp->key[vs]) != 0) {
+        v.keyUp = _sampler.rampOne;
+    } else {
+        v.keyUp = r->keyUp;
+    }
 
-        // Fade in.
-        ps->fadeInAmp *= tauFadeIn;
+    // Find the number of frames before the end of the sample. Offsets are
+    // increasing, so we can bisect. We stay a fraction of a frame short of
+    // the end so rounding can't push the last read past the guard frame.
+    double lim = (sample->len - 1e-3 - v.idx) / v.speed;
+    int lo = 0, hi = nframes + 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (r->offset[mid] < lim) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    int n = lo < nframes ? lo : nframes;
 
-        // Get the interpolated value.
-        sample_interp(sample, ps->idx, &sLR);
+    if (n == 0) {
+        return 1;
+    }
+
+    // Packed samples are decoded as they play. When streaming, the block is
+    // skipped if its data isn't resident yet.
+    int end = (int)(v.idx + v.speed * r->offset[n]) + INTERP_SINC_TAPS / 2 + 1;
+    if (sample->pack != NULL) {
+        _mix_packed(vs, &v, n, inst->interp, out);
+    } else if (stream_voice_ready(&vp->stream[vs], (int)v.idx, end)) {
+        interp_mix[inst->interp] (&v, n, out);
+    }
 
-        // Amplify.
-        sLR *= ps->amp * (1 - ps->fadeInAmp) * ctrlAmp;
+    vp->idx[vs] += v.speed * r->offset[n];
+    vp->amp[vs] *= v.keyUp[n - 1];
+    vp->fadeInAmp[vs] *= r->fadeIn[n - 1];
 
-        // Write output.
-        // TODO: Panning.
-        out[i] += sLR;
+    return lo <= nframes || vp->amp[vs] < MIN_AMP;
+}
 
-        // Update position and pitch-bend.
-        ps->idx += pb * sample->speed;
-        pb += pbSlope;
+// Return the frame in the block of the next queued event, or nframes if
+// there are none in the block. Late events are played at the start of the
+// block.
+static int _queue_offset(Event * ev, int nframes)
+{
+    if (!evq_peek(_sampler.events, ev)) {
+        return nframes;
+    }
+    int32_t offset = (int32_t) (ev->frame - _sampler.frame);
+    if (offset < 0) {
+        return 0;
+    }
+    return offset < nframes ? offset : nframes;
+}
 
-        // Done?
-        if (ps->idx >= sample->len) {
-            return 1;
+// Return the frame in the block of the next jack midi event, or nframes if
+// there are none left. Messages that aren't played are skipped.
+static int _jack_midi_offset(Event * ev, int nframes)
+{
+    jack_midi_event_t in;
+    for (; _sampler.midiIdx < _sampler.midiCount; ++_sampler.midiIdx) {
+        if (jack_midi_event_get(&in, _sampler.midiBuf, _sampler.midiIdx) != 0
+            || !_midi_event(in.buffer, in.size, ev)) {
+            continue;
         }
+        int offset = in.time < nframes ? in.time : nframes - 1;
+        ev->frame = _sampler.frame + offset;
+        return offset;
     }
+    return nframes;
+}
 
-    return (ps->amp < MIN_AMP);
+// Play the events due at or before frame pos of the block, from both the
+// event queue and the jack midi port, in order. Returns the frame of the next
+// event, or nframes if there are none in the block.
+static int _play_events(int pos, int nframes)
+{
+    Event q, m;
+    while (true) {
+        int qOffset = _queue_offset(&q, nframes);
+        int mOffset = _jack_midi_offset(&m, nframes);
+        int next = qOffset < mOffset ? qOffset : mOffset;
+        if (next > pos) {
+            return next;
+        }
+        if (qOffset <= mOffset) {
+            evq_get(_sampler.events, &q);
+            _play_event(&q);
+        } else {
+            ++_sampler.midiIdx;
+            _play_event(&m);
+        }
+    }
 }
 
-int sampler_jack_process(jack_nframes_t nframes, void *data)
+// The part of the block being mixed in parallel.
+static int _mixPos, _mixFrames;
+
+// Mix a share of the playing samples. Workers mix into their own bus, and
+// the audio thread mixes straight into the jack buffer. With channel outputs,
+// each thread mixes the voices of its own channels into their buffers.
+static void _mix_job(int thread, int nthreads)
 {
-    // Commit control values.
-    ctrls_commit();
+    VoicePool *vp = &_sampler.voices;
+
+    if (_sampler.chanBuf != NULL) {
+        for (int i = 0; i < vp->numPlaying; ++i) {
+            int v = vp->playing[i];
+            if (vp->channel[v] % nthreads == thread) {
+                mix_t *out = _chan_buf(vp->channel[v]) + 2 * _mixPos;
+                _sampler.voiceDone[i] = _proc_voice(v, _mixFrames, out);
+            }
+        }
+        return;
+    }
 
-    // Zero internal buffer.
-    memset(&(_sampler.jackBuf), 0, nframes * sizeof(__m128d));
+    int i0 = vp->numPlaying * thread / nthreads;
+    int i1 = vp->numPlaying * (thread + 1) / nthreads;
+
+    mix_t *out = _sampler.jackBuf + 2 * _mixPos;
+    if (thread != 0) {
+        out = mixpool_bus(thread);
+        memset(out, 0, 2 * _mixFrames * sizeof(mix_t));
+    }
 
-    // Add new playing samples to psPlaying.
-    // We always read two samples at a time to handle mixing between layers.
-    PlayingSample *ps;
+    for (int i = i0; i < i1; ++i) {
+        _sampler.voiceDone[i] = _proc_voice(vp->playing[i], _mixFrames, out);
+    }
+}
 
-    int count = ringbuf_count(_sampler.psNew);
-    count -= count % 2;
-    while (count--) {
-        ps = ringbuf_get(_sampler.psNew);
-        if (ps != NULL) {
-            ringbuf_put(_sampler.psPlaying, ps);
+// Mix nframes from each playing sample into the bus, starting at frame pos.
+static void _mix(int pos, int nframes)
+{
+    // Pre-compute pitch-bend and amplitude ramps.
+    for (int i = 0; i < SAMPLER_SLOTS; ++i) {
+        if (_live(&_sampler.slot[i])) {
+            inst_compute_ramps(&_sampler.slot[i], nframes);
         }
     }
 
-    // Pre-compute pitch-bend data.
-    double pb0 = ctrls_pitch_bend_prev();
-    double pb1 = ctrls_value(CTRL_PITCH_BEND);
-    double pbSlope = (pb1 - pb0) / (double)nframes;
+    VoicePool *vp = &_sampler.voices;
+    mix_t *out = _sampler.jackBuf + 2 * pos;
 
-    // Loop through each playing sample and send to output.
-    count = ringbuf_count(_sampler.psPlaying);
-    while (count--) {
-        ps = ringbuf_get(_sampler.psPlaying);
-        if (_proc_ps(ps, nframes, pb0, pbSlope)) {
-            ringbuf_put(_sampler.psRecycle, ps);
-        } else {
-            ringbuf_put(_sampler.psPlaying, ps);
+    // Only wake workers if each has enough voices to mix.
+    int nthreads = vp->numPlaying / MIX_MIN_VOICES;
+    if (nthreads > mixpool_threads()) {
+        nthreads = mixpool_threads();
+    }
+
+    if (nthreads <= 1) {
+        // Loop through each playing sample and send to output. A finished
+        // voice is replaced by the last playing voice, so i isn't advanced.
+        for (int i = 0; i < vp->numPlaying;) {
+            int v = vp->playing[i];
+            if (_sampler.chanBuf != NULL) {
+                out = _chan_buf(vp->channel[v]) + 2 * pos;
+            }
+            if (_proc_voice(v, nframes, out)) {
+                _stop_voice(vp, i);
+            } else {
+                ++i;
+            }
         }
+        return;
     }
 
-    // Get port arrays.
-    float *outL = jack_port_get_buffer(_sampler.jackPortL, nframes);
-    float *outR = jack_port_get_buffer(_sampler.jackPortR, nframes);
+    _mixPos = pos;
+    _mixFrames = nframes;
+    mixpool_run(_mix_job, nthreads);
+
+    // Sum the workers' buses.
+    for (int t = 1; t < nthreads && _sampler.chanBuf == NULL; ++t) {
+        mix_t *bus = mixpool_bus(t);
+        for (int i = 0; i < 2 * nframes; ++i) {
+            out[i] += bus[i];
+        }
+    }
+
+    // Stop finished voices from the end, so the voice moved into a stopped
+    // voice's place has already been checked.
+    for (int i = vp->numPlaying - 1; i >= 0; --i) {
+        if (_sampler.voiceDone[i]) {
+            _stop_voice(vp, i);
+        }
+    }
+}
+
+void sampler_process(jack_nframes_t nframes, float *outL, float *outR)
+{
+    rtcheck_enter();
+    int64_t t0 = stats_time();
+    VoicePool *vp = &_sampler.voices;
+    int numPlaying = vp->numPlaying;
+    uint64_t numStarted = vp->numStarted;
+
+    // Swap in a newly loaded instrument, and commit control values.
+    _swap();
+    _kill_voices();
+    for (int i = 0; i < SAMPLER_SLOTS; ++i) {
+        if (_live(&_sampler.slot[i])) {
+            ctrls_commit(&_sampler.slot[i].ctrls);
+        }
+    }
+
+    // Zero internal buffers.
+    memset(_sampler.jackBuf, 0, 2 * nframes * sizeof(mix_t));
+    if (_sampler.chanBuf != NULL) {
+        for (int ch = 0; ch < MIDI_CHANNELS; ++ch) {
+            memset(_chan_buf(ch), 0, 2 * nframes * sizeof(mix_t));
+        }
+    }
+
+    // Split the block at each event, so events are played at their frame.
+    int pos = 0;
+    while (pos < nframes) {
+        int end = _play_events(pos, nframes);
+        _mix(pos, end - pos);
+        pos = end;
+    }
+    _sampler.frame += nframes;
+    atomic_store_explicit(&_sampler.numPlaying, _sampler.voices.numPlaying,
+                          memory_order_relaxed);
+
+    // The main outputs carry the sum of the channels.
+    if (_sampler.chanBuf != NULL) {
+        for (int ch = 0; ch < MIDI_CHANNELS; ++ch) {
+            mix_t *buf = _chan_buf(ch);
+            for (int i = 0; i < 2 * nframes; ++i) {
+                _sampler.jackBuf[i] += buf[i];
+            }
+        }
+    }
 
     __m128d vval;
 
     // Copy data to output buffers, and scale to range 0-1.
     for (int i = 0; i < nframes; ++i) {
-        outL[i] = (float)(_sampler.jackBuf[i][0]) * INT16_SCALE;
-        outR[i] = (float)(_sampler.jackBuf[i][1]) * INT16_SCALE;
+        outL[i] = (float)(_sampler.jackBuf[2 * i]) * INT16_SCALE;
+        outR[i] = (float)(_sampler.jackBuf[2 * i + 1]) * INT16_SCALE;
 
         vval[0] = outL[i];
         vval[1] = outR[i];
         _sampler.peak = _mm_max_pd(_sampler.peak, vval);
     }
 
+    int admitted = vp->numStarted - numStarted;
+    int rendered = numPlaying + admitted;
+    stats_callback(nframes, stats_time() - t0, rendered, admitted,
+                   rendered - vp->numPlaying);
+    rtcheck_leave();
+}
+
+int sampler_jack_process(jack_nframes_t nframes, void *data)
+{
+    // Get port arrays.
+    float *outL = jack_port_get_buffer(_sampler.jackPortL, nframes);
+    float *outR = jack_port_get_buffer(_sampler.jackPortR, nframes);
+
+    // Events are timestamped as they arrive during the previous period, and
+    // played one period later at the same offset. This adds a fixed period
+    // of latency instead of up to a period of jitter.
+    _sampler.frame = jack_last_frame_time(_sampler.jackClient) - nframes;
+
+    // Where sample memory is bound to, if binding is on.
+    smem_audio_cpu();
+
+    // Jack midi events are already timed within this period.
+    if (_sampler.jackPortMidi != NULL) {
+        _sampler.midiBuf = jack_port_get_buffer(_sampler.jackPortMidi,
+                                                nframes);
+        _sampler.midiCount = jack_midi_get_event_count(_sampler.midiBuf);
+        _sampler.midiIdx = 0;
+    }
+
+    sampler_process(nframes, outL, outR);
+
+    // Each channel's own outputs.
+    for (int ch = 0; _sampler.chanBuf != NULL && ch < MIDI_CHANNELS; ++ch) {
+        if (_sampler.jackPortChan[ch][0] == NULL) {
+            continue;
+        }
+        float *chL = jack_port_get_buffer(_sampler.jackPortChan[ch][0],
+                                          nframes);
+        float *chR = jack_port_get_buffer(_sampler.jackPortChan[ch][1],
+                                          nframes);
+        mix_t *buf = _chan_buf(ch);
+        for (int i = 0; i < nframes; ++i) {
+            chL[i] = (float)(buf[2 * i]) * INT16_SCALE;
+            chR[i] = (float)(buf[2 * i + 1]) * INT16_SCALE;
+        }
+    }
     return 0;
 }
 
 void sampler_load_controls(char *path) {
-    confctrls_load(path);
+    confctrls_load(sampler_controls(), path);
     confctrls_unload();
 }
 
 const char *sampler_save_controls(char *path) {
-    const char *ret = confctrls_save(path);
+    const char *ret = confctrls_save(sampler_controls(), path);
     confctrls_unload();
     return ret;
 }
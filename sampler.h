@@ -1,12 +1,16 @@
 #ifndef SAMPLER_H_
 #define SAMPLER_H_
 #include <pthread.h>
+#include <stdatomic.h>
 #include <x86intrin.h>
 #include <jack/jack.h>
 #include "controls.h"
 #include "global.h"
+#include "interp.h"
 #include "sample.h"
-#include "ringbuffer.h"
+#include "eventqueue.h"
+#include "instrument.h"
+#include "voicepool.h"
 
 // Explicity states for the sampler to be in.
 #define SAMPLER_STATE_STOPPED 0
@@ -14,8 +18,11 @@
 #define SAMPLER_STATE_RUNNING 2
 #define SAMPLER_STATE_UNLOADING 3
 
+#define SAMPLER_SLOTS 16         // Instruments held at once.
+#define SAMPLER_RECLAIM_US 20000 // Polling interval for freeing instruments.
+
 const char *errBadState;
-const char *errBadDir;
+const char *errNoSlot;
 
 typedef struct Sampler Sampler;
 
@@ -27,28 +34,89 @@ struct Sampler {
     // Peak left and right values.
     __m128d peak;
 
-    // We need three lock-free ring-buffers to organize our playing samples.
-    RingBuffer *psPlaying;      // Currently playing samples.
-    RingBuffer *psNew;          // New samples since last callback.
-    RingBuffer *psRecycle;      // Recycled playing samples.
-
-    // Local,jack buffer.
-    __m128d jackBuf[JACK_BUF_SIZE];
-
-    // Jack client and ports.
+    // Instruments. Each midi channel plays new notes from its active
+    // instrument. Loading while running builds the next instrument in a free
+    // slot and posts it, and the audio thread swaps it in on every channel at
+    // the start of a callback. The old one is retired, and freed by the
+    // reclaim thread once its voices finish.
+    Instrument slot[SAMPLER_SLOTS];
+    _Atomic(Instrument *) active[MIDI_CHANNELS];
+    _Atomic(Instrument *) next;
+
+    // Presets are loaded together from presets.conf, and stay loaded. A
+    // program change makes the program's preset active on its channel.
+    Instrument *program[128];   // NULL for programs without a preset.
+
+    pthread_t reclaimThread;
+    _Atomic bool reclaimRun;
+
+    // Playing samples. Only the audio thread uses the pool, and the number
+    // playing is published for other threads after each callback.
+    VoicePool voices;
+    _Atomic int numPlaying;
+
+    // Set by mix threads for each playing voice that has finished.
+    bool voiceDone[MAX_VOICES];
+
+    // Key-up ramps that are the same for every instrument, like those in
+    // InterpRamps.
+    mix_t rampOne[JACK_BUF_SIZE + 1];   // All ones, for keys that are held.
+    mix_t rampSteal[JACK_BUF_SIZE + 1]; // Decay of stolen voices.
+
+    // Midi events are played by the audio thread at their frame time. The
+    // queue has a single producer, so threads queueing events take
+    // eventLock. The audio thread only reads it.
+    EventQueue *events;
+    pthread_mutex_t eventLock;
+    jack_nframes_t frame;       // Frame time of the first frame of a block.
+
+    // Jack midi input for the current block. NULL when offline.
+    void *midiBuf;
+    uint32_t midiCount;         // Number of events in midiBuf.
+    uint32_t midiIdx;           // Next event to play.
+
+    // Local,jack buffer. Left/right interleaved.
+    mix_t jackBuf[2 * JACK_BUF_SIZE] __attribute__ ((aligned(64)));
+
+    // With channel outputs, each midi channel is mixed into its own buffer
+    // and port pair, and the main outputs carry their sum. Otherwise chanBuf
+    // is NULL.
+    mix_t *chanBuf;             // MIDI_CHANNELS buffers like jackBuf.
+    jack_port_t *jackPortChan[MIDI_CHANNELS][2];
+
+    // Jack client and ports. The midi input, either the jack midi port or
+    // the ALSA thread, is started by a load from stopped, as chosen by the
+    // instrument's MidiInput, and stopped by unloading.
     jack_client_t *jackClient;
     jack_port_t *jackPortL, *jackPortR;
+    jack_port_t *jackPortMidi;  // NULL unless midi input is from jack.
+    pthread_t midiThread;
+    _Atomic bool midiRun;       // The ALSA thread is running.
 };
 
 // There is only one, global sampler object.
 Sampler _sampler;
 
+// sampler_init: Initialize the sampler without connecting to jack or the
+// ALSA sequencer. This is sufficient for offline rendering.
 void sampler_init();
 
-// sampler_midi_thread: A background thread that will continually read
-// and process midi events for the sampler.
+// sampler_init_jack: Open the jack client. Call after sampler_init for
+// real-time playback. Midi is read from either a jack midi port, in the jack
+// callback, or an ALSA sequencer port, as set by MidiInput in the config of
+// the instrument loaded.
+void sampler_init_jack();
+
+// sampler_midi_thread: A background thread that reads and processes midi
+// events from the ALSA sequencer until midiRun is cleared.
 void *sampler_midi_thread();
 
+// sampler_process: Mix nframes of output from all playing samples into the
+// given buffers, starting at frame time _sampler.frame. Queued events are
+// played at their frame within the block. This is the body of the jack
+// callback.
+void sampler_process(jack_nframes_t nframes, float *outL, float *outR);
+
 // jack callback function.
 int sampler_jack_process(jack_nframes_t nframes, void *data);
 
@@ -63,12 +131,31 @@ __m128d sampler_get_peaks();
 int sampler_num_playing();
 
 // sampler_load: Load the sampler from the directory. Return 0 if successful.
+// If the directory has a presets.conf, every preset in it is loaded. If the
+// sampler is already running, the instrument is loaded while the current one
+// keeps playing, and swapped in at the next callback.
 const char *sampler_load(char *dir);
 
 // sampler_unload: Unload samples from memory and stop processing midi and jack
 // events.
 const char *sampler_unload();
 
+// Midi input on a channel, 0-15. These may be called from any thread but the
+// audio thread while the sampler is running. Events are queued for the audio
+// thread, and are played at the current frame time.
+void sampler_note(int channel, int key, double vel);
+void sampler_control(int channel, int control, double value);
+void sampler_pitch_bend(int channel, double value);
+void sampler_program(int channel, int program);
+
+// sampler_midi_message: Queue a raw three-byte midi channel message to be
+// played at the given frame time.
+void sampler_midi_message(const uint8_t * msg, jack_nframes_t frame);
+
+// sampler_controls: Return the controls of the instrument active on the first
+// midi channel. Before anything is loaded, these are the defaults.
+Controls *sampler_controls();
+
 void sampler_load_controls(char *path);
 const char *sampler_save_controls(char *path);
 
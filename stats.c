@@ -0,0 +1,254 @@
+#include <math.h>
+#include <unistd.h>
+#include "global.h"
+#include "stream.h"
+#include "stats.h"
+
+#define _LOAD(x) atomic_load_explicit(&(x), memory_order_relaxed)
+#define _STORE(x, v) atomic_store_explicit(&(x), (v), memory_order_relaxed)
+
+static void _zero()
+{
+    for (int i = 0; i < STATS_BINS; ++i) {
+        _STORE(_stats.hist[i], 0);
+    }
+    _STORE(_stats.callbacks, 0);
+    _STORE(_stats.maxShare, 0);
+    _STORE(_stats.lastShare, 0);
+    _STORE(_stats.voicesRendered, 0);
+    _STORE(_stats.maxVoices, 0);
+    _STORE(_stats.voicesAdmitted, 0);
+    _STORE(_stats.voicesRetired, 0);
+    _STORE(_stats.xruns, 0);
+    _STORE(_stats.eventsDropped, 0);
+}
+
+void stats_init()
+{
+    _zero();
+    atomic_store(&_stats.reset, false);
+
+    _STORE(_stats.loadFiles, 0);
+    _STORE(_stats.loadFilesDone, 0);
+    _STORE(_stats.loadBytes, 0);
+    _STORE(_stats.loadBytesDone, 0);
+    _STORE(_stats.loadStart, 0);
+    _STORE(_stats.loadEnd, 0);
+
+    _STORE(_stats.memBytes, 0);
+    _STORE(_stats.memLocked, 0);
+    _STORE(_stats.memHuge, 0);
+}
+
+void stats_callback(int nframes, int64_t ns, int voices, int admitted,
+                    int retired)
+{
+    if (_LOAD(_stats.reset)) {
+        _zero();
+        atomic_store_explicit(&_stats.reset, false, memory_order_relaxed);
+    }
+
+    double share = ns * (SAMPLE_RATE / 1e9) / nframes;
+    int bin = share / STATS_BIN_WIDTH;
+    if (bin >= STATS_BINS) {
+        bin = STATS_BINS - 1;
+    }
+
+    _STORE(_stats.hist[bin], _LOAD(_stats.hist[bin]) + 1);
+    _STORE(_stats.callbacks, _LOAD(_stats.callbacks) + 1);
+    if (share > _LOAD(_stats.maxShare)) {
+        _STORE(_stats.maxShare, share);
+    }
+    _STORE(_stats.lastShare, share);
+
+    _STORE(_stats.voicesRendered, _LOAD(_stats.voicesRendered) + voices);
+    if (voices > _LOAD(_stats.maxVoices)) {
+        _STORE(_stats.maxVoices, voices);
+    }
+    _STORE(_stats.voicesAdmitted, _LOAD(_stats.voicesAdmitted) + admitted);
+    _STORE(_stats.voicesRetired, _LOAD(_stats.voicesRetired) + retired);
+}
+
+int stats_xrun(void *data)
+{
+    atomic_fetch_add_explicit(&_stats.xruns, 1, memory_order_relaxed);
+    return 0;
+}
+
+void stats_event_dropped()
+{
+    atomic_fetch_add_explicit(&_stats.eventsDropped, 1, memory_order_relaxed);
+}
+
+void stats_load_start(int files, int64_t bytes)
+{
+    _STORE(_stats.loadEnd, 0);
+    _STORE(_stats.loadFilesDone, 0);
+    _STORE(_stats.loadBytesDone, 0);
+    _STORE(_stats.loadFiles, files);
+    _STORE(_stats.loadBytes, bytes);
+    _STORE(_stats.loadStart, stats_time());
+}
+
+int stats_load_file(int64_t bytes)
+{
+    atomic_fetch_add_explicit(&_stats.loadBytesDone, bytes,
+                              memory_order_relaxed);
+    return atomic_fetch_add_explicit(&_stats.loadFilesDone, 1,
+                                     memory_order_relaxed) + 1;
+}
+
+void stats_load_end()
+{
+    _STORE(_stats.loadEnd, stats_time());
+}
+
+void stats_sample_memory(int64_t bytes, int64_t locked, int64_t huge)
+{
+    atomic_fetch_add_explicit(&_stats.memBytes, bytes, memory_order_relaxed);
+    atomic_fetch_add_explicit(&_stats.memLocked, locked,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&_stats.memHuge, huge, memory_order_relaxed);
+}
+
+void stats_reset()
+{
+    atomic_store(&_stats.reset, true);
+}
+
+// Return the share of the period at or below which the fraction p of
+// callbacks in hist finished.
+static double _percentile(const uint64_t * hist, uint64_t total, double p)
+{
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t target = p * total;
+    uint64_t count = 0;
+    for (int i = 0; i < STATS_BINS; ++i) {
+        count += hist[i];
+        if (count > target) {
+            return (i + 1) * STATS_BIN_WIDTH;
+        }
+    }
+    return STATS_BINS * STATS_BIN_WIDTH;
+}
+
+// Return the resident set size in bytes, or 0 if it can't be read.
+static int64_t _rss()
+{
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f == NULL) {
+        return 0;
+    }
+    long size, resident = 0;
+    if (fscanf(f, "%ld %ld", &size, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(f);
+    return (int64_t) resident * sysconf(_SC_PAGESIZE);
+}
+
+// Return the transparent huge pages in use in bytes, or 0 if they can't be
+// read.
+static int64_t _anon_huge()
+{
+    FILE *f = fopen("/proc/self/smaps_rollup", "r");
+    if (f == NULL) {
+        return 0;
+    }
+    char line[128];
+    long kb = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "AnonHugePages: %ld kB", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(f);
+    return (int64_t) kb * 1024;
+}
+
+static uint64_t _snapshot(uint64_t * hist)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < STATS_BINS; ++i) {
+        hist[i] = _LOAD(_stats.hist[i]);
+        total += hist[i];
+    }
+    return total;
+}
+
+void stats_summary(StatsSummary * s)
+{
+    uint64_t hist[STATS_BINS];
+    uint64_t total = _snapshot(hist);
+
+    s->callbacks = _LOAD(_stats.callbacks);
+    s->p50 = _percentile(hist, total, 0.5);
+    s->p99 = _percentile(hist, total, 0.99);
+    s->max = _LOAD(_stats.maxShare);
+    s->p50 = fmin(s->p50, s->max);
+    s->p99 = fmin(s->p99, s->max);
+    s->last = _LOAD(_stats.lastShare);
+    s->meanVoices = 0;
+    if (s->callbacks != 0) {
+        s->meanVoices =
+            (double)_LOAD(_stats.voicesRendered) / s->callbacks;
+    }
+    s->maxVoices = _LOAD(_stats.maxVoices);
+    s->voicesAdmitted = _LOAD(_stats.voicesAdmitted);
+    s->voicesRetired = _LOAD(_stats.voicesRetired);
+    s->xruns = _LOAD(_stats.xruns);
+    s->eventsDropped = _LOAD(_stats.eventsDropped);
+    s->underruns = stream_underruns();
+
+    int64_t start = _LOAD(_stats.loadStart);
+    int64_t end = _LOAD(_stats.loadEnd);
+    s->loading = start != 0 && end == 0;
+    s->loadFiles = _LOAD(_stats.loadFiles);
+    s->loadFilesDone = _LOAD(_stats.loadFilesDone);
+    s->loadBytes = _LOAD(_stats.loadBytes);
+    s->loadBytesDone = _LOAD(_stats.loadBytesDone);
+    s->loadRate = 0;
+    if (start != 0) {
+        int64_t ns = (end != 0 ? end : stats_time()) - start;
+        if (ns > 0) {
+            s->loadRate = s->loadBytesDone * 1e9 / ns;
+        }
+    }
+
+    s->memBytes = _LOAD(_stats.memBytes);
+    s->memLocked = _LOAD(_stats.memLocked);
+    s->memHuge = _LOAD(_stats.memHuge);
+}
+
+void stats_dump(FILE * f)
+{
+    StatsSummary s;
+    stats_summary(&s);
+
+    fprintf(f, "callbacks=%lu p50=%.4f p99=%.4f max=%.4f last=%.4f "
+            "voices_mean=%.2f voices_max=%d admitted=%lu retired=%lu "
+            "xruns=%lu dropped=%lu underruns=%ld loading=%d load_files=%d "
+            "load_files_done=%d load_bytes=%ld load_bytes_done=%ld "
+            "load_rate=%.0f sample_mem=%ld sample_mem_locked=%ld "
+            "sample_mem_huge=%ld rss=%ld anon_huge=%ld bin_width=%g hist=",
+            s.callbacks, s.p50, s.p99, s.max, s.last,
+            s.meanVoices, s.maxVoices, s.voicesAdmitted, s.voicesRetired,
+            s.xruns, s.eventsDropped, s.underruns, s.loading, s.loadFiles,
+            s.loadFilesDone, s.loadBytes, s.loadBytesDone, s.loadRate,
+            s.memBytes, s.memLocked, s.memHuge, _rss(), _anon_huge(),
+            STATS_BIN_WIDTH);
+
+    uint64_t hist[STATS_BINS];
+    _snapshot(hist);
+    bool first = true;
+    for (int i = 0; i < STATS_BINS; ++i) {
+        if (hist[i] != 0) {
+            fprintf(f, "%s%d:%lu", first ? "" : ",", i, hist[i]);
+            first = false;
+        }
+    }
+    fprintf(f, "\n");
+    fflush(f);
+}
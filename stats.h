@@ -0,0 +1,128 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#define STATS_BINS 256          // Histogram bins.
+#define STATS_BIN_WIDTH 0.005   // Share of the period per bin.
+
+// Stats: Audio callback instrumentation, and the progress of sample loading.
+// The audio thread is the only writer of the callback stats, so counters are
+// updated with plain relaxed loads and stores, and readers may see a callback
+// half recorded. Nothing here blocks or allocates.
+typedef struct {
+    // Callbacks by time taken, as a share of the period. The last bin also
+    // counts every callback longer than it.
+    _Atomic uint64_t hist[STATS_BINS];
+    _Atomic uint64_t callbacks;
+    _Atomic double maxShare;    // Longest callback, share of its period.
+    _Atomic double lastShare;
+
+    // Voices rendered is summed over callbacks, for the mean.
+    _Atomic uint64_t voicesRendered;
+    _Atomic int maxVoices;
+    _Atomic uint64_t voicesAdmitted;
+    _Atomic uint64_t voicesRetired;
+
+    _Atomic uint64_t xruns;     // From jack's xrun callback.
+    _Atomic uint64_t eventsDropped;     // Midi events lost to a full queue.
+
+    _Atomic bool reset;         // Cleared by the audio thread.
+
+    // Sample loading, updated by the loading threads. Not reset with the
+    // callback stats, so the last load's figures stay readable.
+    _Atomic int loadFiles;
+    _Atomic int loadFilesDone;
+    _Atomic int64_t loadBytes;  // File sizes.
+    _Atomic int64_t loadBytesDone;
+    _Atomic int64_t loadStart;  // stats_time() when loading started.
+    _Atomic int64_t loadEnd;    // 0 while loading.
+
+    // Sample memory mapped, how much of it is locked, and how much is on
+    // explicit huge pages. Not reset either.
+    _Atomic int64_t memBytes;
+    _Atomic int64_t memLocked;
+    _Atomic int64_t memHuge;
+} Stats;
+
+// StatsSummary: A snapshot of the stats for display.
+typedef struct {
+    uint64_t callbacks;
+    double p50, p99, max, last; // Shares of the period.
+    double meanVoices;
+    int maxVoices;
+    uint64_t voicesAdmitted;
+    uint64_t voicesRetired;
+    uint64_t xruns;
+    uint64_t eventsDropped;
+    long underruns;             // Streaming underruns.
+
+    bool loading;
+    int loadFiles, loadFilesDone;
+    int64_t loadBytes, loadBytesDone;
+    double loadRate;            // Bytes per second.
+
+    int64_t memBytes, memLocked, memHuge;
+} StatsSummary;
+
+// There is only one, global stats object.
+Stats _stats;
+
+// stats_init: Zero everything.
+void stats_init();
+
+// stats_time: Return the monotonic clock in nanoseconds.
+static inline int64_t stats_time()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// stats_callback: Record a callback of nframes that took ns nanoseconds.
+// voices is the number of voices rendered, admitted the number started and
+// retired the number that finished. Audio thread.
+void stats_callback(int nframes, int64_t ns, int voices, int admitted,
+                    int retired);
+
+// stats_xrun: Count an xrun. Jack's xrun callback calls this.
+int stats_xrun(void *data);
+
+// stats_event_dropped: Count a midi event dropped because the event queue
+// was full. Called from the midi threads instead of printing.
+void stats_event_dropped();
+
+// stats_load_start: Start counting the progress of loading files with a total
+// size of bytes.
+void stats_load_start(int files, int64_t bytes);
+
+// stats_load_file: Count a loaded file of the given size. Safe to call from
+// several loading threads. Returns the number of files loaded so far.
+int stats_load_file(int64_t bytes);
+
+// stats_load_end: Mark loading as finished.
+void stats_load_end();
+
+// stats_sample_memory: Add the given byte counts to the sample memory mapped,
+// locked and on explicit huge pages. Negative counts are unmapped memory.
+void stats_sample_memory(int64_t bytes, int64_t locked, int64_t huge);
+
+// stats_reset: Ask the audio thread to zero the stats before the next
+// callback is recorded.
+void stats_reset();
+
+// stats_summary: Fill s from the current stats. Percentiles are the upper
+// edge of their histogram bin, but no more than the maximum.
+void stats_summary(StatsSummary * s);
+
+// stats_dump: Write the stats to f as a single line of space separated
+// key=value pairs, including the last load's progress and the process's
+// resident and transparent huge page memory, ending with the non-empty
+// histogram bins as hist=<bin>:<count>,...
+void stats_dump(FILE * f);
+
+#endif                          // STATS_H_
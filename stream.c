@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "mem.h"
+#include "stream.h"
+
+#define PAGE 4096
+
+// The I/O thread's view of a voice.
+typedef struct {
+    Sample *sample;             // NULL if nothing is locked.
+    StreamRegion *region;       // The region sample is locked in.
+    uint32_t gen;
+    size_t c0, c1;              // Locked chunks.
+    int underruns;              // Voice underruns when the sample started.
+} _Slot;
+
+static _Slot _slots[MAX_VOICES];
+
+void stream_init()
+{
+    _stream.running = false;
+    _stream.numVoices = 0;
+    atomic_store(&_stream.run, false);
+    atomic_store(&_stream.passes, 0);
+    atomic_store(&_stream.underruns, 0);
+}
+
+void stream_register(StreamVoice * sv)
+{
+    atomic_store(&sv->sample, NULL);
+    atomic_store(&sv->region, NULL);
+    sv->headEnd = 0;
+    atomic_store(&sv->gen, 0);
+    atomic_store(&sv->pos, 0);
+    atomic_store(&sv->ready, 0);
+    atomic_store(&sv->underruns, 0);
+    _stream.voices[_stream.numVoices++] = sv;
+}
+
+// ----------------------------------------------------------------------------
+// Chunk locking. A region's lock counts are only touched by one thread at a
+// time: the loading thread before any voice plays from it, then the I/O
+// thread.
+// ----------------------------------------------------------------------------
+
+static void _lock(StreamRegion * r, size_t c0, size_t c1)
+{
+    char *p = r->base + c0 * STREAM_CHUNK;
+    size_t end = c1 * STREAM_CHUNK;
+    size_t len = (end < r->size ? end : r->size) - c0 * STREAM_CHUNK;
+
+    if (!r->lockFailed && mlock(p, len) != 0) {
+        printf("Stream: mlock failed, check the memlock limit. Pages will be "
+               "prefetched but not locked.\n");
+        r->lockFailed = true;
+    }
+
+    // Without locking, read the pages in and hope they stay.
+    if (r->lockFailed) {
+        for (size_t i = 0; i < len; i += PAGE) {
+            (void)*(volatile char *)(p + i);
+        }
+    }
+}
+
+static void _unlock(StreamRegion * r, size_t c0, size_t c1)
+{
+    size_t end = c1 * STREAM_CHUNK;
+    munlock(r->base + c0 * STREAM_CHUNK,
+            (end < r->size ? end : r->size) - c0 * STREAM_CHUNK);
+}
+
+// Lock or unlock chunks, making one system call per run of chunks whose
+// lock count changes between zero and one.
+static void _ref_chunks(StreamRegion * r, size_t c0, size_t c1, int delta)
+{
+    size_t run = c0;
+    bool inRun = false;
+
+    for (size_t c = c0; c < c1; ++c) {
+        bool edge = delta > 0 ? r->refs[c]++ == 0 : --r->refs[c] == 0;
+        if (edge && !inRun) {
+            run = c;
+            inRun = true;
+        } else if (!edge && inRun) {
+            delta > 0 ? _lock(r, run, c) : _unlock(r, run, c);
+            inRun = false;
+        }
+    }
+    if (inRun) {
+        delta > 0 ? _lock(r, run, c1) : _unlock(r, run, c1);
+    }
+}
+
+// Find the chunks holding frames f0 to f1 of a sample, including padding.
+static void _frame_chunks(StreamRegion * r, Sample * s, int f0, int f1,
+                          size_t *c0, size_t *c1)
+{
+    if (f0 < -SAMPLE_PAD) {
+        f0 = -SAMPLE_PAD;
+    }
+    if (f1 > s->len + SAMPLE_PAD) {
+        f1 = s->len + SAMPLE_PAD;
+    }
+    if (f1 <= f0) {
+        f1 = f0 + 1;
+    }
+    *c0 = ((char *)(s->data + 2 * f0) - r->base) / STREAM_CHUNK;
+    *c1 = ((char *)(s->data + 2 * f1) - r->base - 1) / STREAM_CHUNK + 1;
+}
+
+static bool _in_map(StreamRegion * r, Sample * s)
+{
+    return r != NULL && s->data != NULL && (char *)s->data >= r->base &&
+        (char *)s->data < r->base + r->size;
+}
+
+// ----------------------------------------------------------------------------
+// I/O thread
+// ----------------------------------------------------------------------------
+
+static void _release(_Slot * slot)
+{
+    if (slot->sample != NULL) {
+        _ref_chunks(slot->region, slot->c0, slot->c1, -1);
+        atomic_fetch_sub(&slot->region->slots, 1);
+        slot->sample = NULL;
+        slot->region = NULL;
+    }
+}
+
+static void _serve(int i)
+{
+    StreamVoice *sv = _stream.voices[i];
+    _Slot *slot = &_slots[i];
+
+    uint32_t gen = atomic_load_explicit(&sv->gen, memory_order_acquire);
+
+    // Report underruns once the sample has finished.
+    if (gen != slot->gen && (slot->gen & 1)) {
+        int underruns = atomic_load(&sv->underruns) - slot->underruns;
+        if (underruns > 0) {
+            printf("Stream: Voice %i underran %i blocks.\n", i, underruns);
+        }
+    }
+    if (gen != slot->gen) {
+        slot->underruns = atomic_load(&sv->underruns);
+        slot->gen = gen;
+    }
+
+    if (!(gen & 1)) {
+        _release(slot);
+        return;
+    }
+
+    // If the voice was restarted while they were read, the sample and region
+    // may not belong together, and it's served on the next pass.
+    Sample *s = atomic_load_explicit(&sv->sample, memory_order_relaxed);
+    StreamRegion *r = atomic_load_explicit(&sv->region, memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&sv->gen, memory_order_relaxed) != gen) {
+        return;
+    }
+    if (!_in_map(r, s)) {
+        _release(slot);
+        return;
+    }
+
+    int pos = atomic_load_explicit(&sv->pos, memory_order_relaxed);
+    double speed = s->speed > 1 ? s->speed : 1;
+
+    // Twice the sample's speed allows for pitch bend.
+    int ahead = STREAM_AHEAD * SAMPLE_RATE * 2 * speed;
+    int behind = STREAM_BEHIND * SAMPLE_RATE * 2 * speed;
+
+    size_t c0, c1;
+    _frame_chunks(r, s, pos - behind, pos + ahead, &c0, &c1);
+
+    // Lock the new window before releasing the old one, so chunks in both
+    // stay locked.
+    atomic_fetch_add(&r->slots, 1);
+    _ref_chunks(r, c0, c1, 1);
+    _release(slot);
+    slot->sample = s;
+    slot->region = r;
+    slot->c0 = c0;
+    slot->c1 = c1;
+
+    // Frames before the end of the last chunk are resident.
+    int64_t ready = (r->base + c1 * STREAM_CHUNK - (char *)s->data) /
+        (2 * sizeof(int16_t));
+    if (ready > s->len + SAMPLE_PAD) {
+        ready = s->len + SAMPLE_PAD;
+    }
+    atomic_store_explicit(&sv->ready, (uint64_t) gen << 32 | ready,
+                          memory_order_release);
+}
+
+static void *_io_thread(void *arg)
+{
+    while (atomic_load(&_stream.run)) {
+        for (int i = 0; i < _stream.numVoices; ++i) {
+            _serve(i);
+        }
+        atomic_fetch_add(&_stream.passes, 1);
+        usleep(STREAM_POLL_US);
+    }
+
+    for (int i = 0; i < _stream.numVoices; ++i) {
+        _release(&_slots[i]);
+    }
+    return NULL;
+}
+
+// ----------------------------------------------------------------------------
+// stream_start / stream_stop
+// ----------------------------------------------------------------------------
+
+void stream_start()
+{
+    if (_stream.running) {
+        return;
+    }
+
+    atomic_store(&_stream.underruns, 0);
+    memset(_slots, 0, sizeof(_slots));
+
+    atomic_store(&_stream.run, true);
+    if (pthread_create(&_stream.thread, NULL, _io_thread, NULL) != 0) {
+        printf("Stream: Failed to create I/O thread.\n");
+        exit(1);
+    }
+
+    _stream.running = true;
+}
+
+void stream_stop()
+{
+    if (!_stream.running) {
+        return;
+    }
+    _stream.running = false;
+
+    atomic_store(&_stream.run, false);
+    pthread_join(_stream.thread, NULL);
+}
+
+// ----------------------------------------------------------------------------
+// stream_region_new / stream_region_free
+// ----------------------------------------------------------------------------
+
+StreamRegion *stream_region_new(char *base, size_t size, double preload,
+                                SampleStore * ss)
+{
+    StreamRegion *r = malloc_exit(sizeof(StreamRegion));
+    r->base = base;
+    r->size = size;
+    r->preload = preload * SAMPLE_RATE;
+    r->lockFailed = false;
+    r->refs = calloc_exit((size + STREAM_CHUNK - 1) / STREAM_CHUNK,
+                          sizeof(uint32_t));
+    atomic_store(&r->slots, 0);
+
+    // Lock the head of every sample.
+    for (int key = 0; key < 128; ++key) {
+        for (int layer = 0; layer < sstore_num_layers(ss, key); ++layer) {
+            for (int var = 0; var < sstore_num_samples(ss, key, layer);
+                 ++var) {
+                Sample *s = sstore_sample(ss, key, layer, var);
+                if (!_in_map(r, s)) {
+                    continue;
+                }
+                size_t c0, c1;
+                _frame_chunks(r, s, s->idx0 - SAMPLE_PAD,
+                              s->idx0 + r->preload + SAMPLE_PAD, &c0, &c1);
+                _ref_chunks(r, c0, c1, 1);
+            }
+        }
+    }
+
+    size_t locked = 0;
+    for (size_t c = 0; c < (size + STREAM_CHUNK - 1) / STREAM_CHUNK; ++c) {
+        locked += r->refs[c] != 0;
+    }
+    printf("Stream: %.1f MB of %.1f MB resident.\n",
+           locked * (double)STREAM_CHUNK / 1e6, size / 1e6);
+
+    return r;
+}
+
+void stream_region_free(StreamRegion * r)
+{
+    if (r == NULL) {
+        return;
+    }
+
+    // Once no voice plays from the region, two full passes of the I/O
+    // thread are enough for it to have let go.
+    if (_stream.running) {
+        uint64_t passes = atomic_load(&_stream.passes);
+        while (atomic_load(&_stream.passes) < passes + 2 ||
+               atomic_load(&r->slots) != 0) {
+            usleep(STREAM_POLL_US);
+        }
+    }
+
+    munlock(r->base, r->size);
+    free(r->refs);
+    free(r);
+}
+
+long stream_underruns()
+{
+    return atomic_load(&_stream.underruns);
+}
+
+void stream_voice_start(StreamVoice * sv, StreamRegion * region,
+                        Sample * sample)
+{
+    // The voice is normally stopped already. If not, it's stopped first, so
+    // gen is even while the sample and region change.
+    uint32_t gen = atomic_load_explicit(&sv->gen, memory_order_relaxed);
+    if (gen & 1) {
+        atomic_store_explicit(&sv->gen, ++gen, memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_release);
+
+    atomic_store_explicit(&sv->region, region, memory_order_relaxed);
+    if (region == NULL) {
+        return;
+    }
+    atomic_store_explicit(&sv->sample, sample, memory_order_relaxed);
+    sv->headEnd = sample->idx0 + region->preload;
+    atomic_store_explicit(&sv->pos, sample->idx0, memory_order_relaxed);
+    atomic_store_explicit(&sv->gen, (gen + 2) | 1, memory_order_release);
+}
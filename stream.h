@@ -0,0 +1,127 @@
+#ifndef STREAM_H_
+#define STREAM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "global.h"
+#include "sample.h"
+
+#define STREAM_CHUNK 65536      // Bytes locked or unlocked at a time.
+#define STREAM_AHEAD 0.5        // Seconds kept resident ahead of a voice.
+#define STREAM_BEHIND 0.05      // Seconds kept resident behind a voice.
+#define STREAM_POLL_US 2000     // I/O thread polling interval.
+
+// StreamRegion: A mapped sample cache that samples are streamed from. Only
+// the first preload frames after idx0 of each sample are kept locked in
+// memory, and the I/O thread locks a window ahead of each playing sample.
+// Each streaming instrument has its own region.
+typedef struct {
+    char *base;
+    size_t size;
+    int preload;                // Frames kept resident after idx0.
+    uint32_t *refs;             // Lock count per chunk.
+    bool lockFailed;            // mlock failed, pages are only touched.
+    _Atomic int slots;          // I/O thread slots holding chunks here.
+} StreamRegion;
+
+// StreamVoice: Streaming state for one playing sample. The audio thread
+// starts, updates and stops it, and the I/O thread reads it and publishes how
+// far ahead the data is resident. The sample and region are only changed
+// while gen is even, and the I/O thread checks gen again after reading them.
+typedef struct {
+    Sample *_Atomic sample;     // Sample being played.
+    StreamRegion *_Atomic region; // NULL if the sample isn't streamed.
+    _Atomic uint32_t gen;       // Odd while playing, bumped on start and stop.
+    _Atomic int pos;            // Playback position, from the audio thread.
+    _Atomic uint64_t ready;     // gen << 32 | resident frames, from I/O.
+    _Atomic int underruns;      // Blocks skipped because data wasn't ready.
+    int headEnd;                // Frames resident without streaming.
+} StreamVoice;
+
+// Stream: The I/O thread serving every streamed voice. If a voice's window
+// isn't ready, the audio thread skips the block and counts an underrun rather
+// than waiting.
+typedef struct {
+    bool running;
+
+    StreamVoice *voices[MAX_VOICES];
+    int numVoices;
+
+    _Atomic bool run;
+    _Atomic uint64_t passes;    // Completed passes over the voices.
+    pthread_t thread;
+
+    _Atomic long underruns;     // Total since streaming started.
+} Stream;
+
+// There is only one, global stream object.
+Stream _stream;
+
+// stream_init: Initialize with the I/O thread stopped.
+void stream_init();
+
+// stream_register: Add a voice for the I/O thread to serve. Call for every
+// voice slot before streaming starts.
+void stream_register(StreamVoice * sv);
+
+// stream_start: Start the I/O thread if it isn't running.
+void stream_start();
+
+// stream_stop: Stop the I/O thread, releasing every voice's window. Safe to
+// call when it isn't running.
+void stream_stop();
+
+// stream_region_new: Lock the first preload seconds of every sample in ss
+// that lies in the mapped cache at base, and return the region to stream
+// them from.
+StreamRegion *stream_region_new(char *base, size_t size, double preload,
+                                SampleStore * ss);
+
+// stream_region_free: Unlock and free a region once no voice plays from it.
+// Waits for the I/O thread to release its windows.
+void stream_region_free(StreamRegion * r);
+
+// stream_underruns: Return the number of blocks skipped since streaming
+// started.
+long stream_underruns();
+
+// stream_voice_start: Start streaming a sample from idx0 out of region, which
+// may be NULL if the sample is resident. Audio thread.
+void stream_voice_start(StreamVoice * sv, StreamRegion * region,
+                        Sample * sample);
+
+// stream_voice_stop: Stop streaming. Audio thread.
+static inline void stream_voice_stop(StreamVoice * sv)
+{
+    uint32_t gen = atomic_load_explicit(&sv->gen, memory_order_relaxed);
+    atomic_store_explicit(&sv->gen, gen + (gen & 1), memory_order_release);
+}
+
+// stream_voice_ready: Return true if frames up to end are resident, and
+// publish the playback position pos. Otherwise count an underrun. Audio
+// thread.
+static inline bool stream_voice_ready(StreamVoice * sv, int pos, int end)
+{
+    if (atomic_load_explicit(&sv->region, memory_order_relaxed) == NULL) {
+        return true;
+    }
+
+    atomic_store_explicit(&sv->pos, pos, memory_order_relaxed);
+    if (end <= sv->headEnd) {
+        return true;
+    }
+
+    uint32_t gen = atomic_load_explicit(&sv->gen, memory_order_relaxed);
+    uint64_t ready = atomic_load_explicit(&sv->ready, memory_order_acquire);
+    if ((ready >> 32) == gen && end <= (int)(ready & 0xFFFFFFFF)) {
+        return true;
+    }
+
+    atomic_fetch_add_explicit(&sv->underruns, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&_stream.underruns, 1, memory_order_relaxed);
+    return false;
+}
+
+#endif                          // STREAM_H_
@@ -0,0 +1,109 @@
+#include <string.h>
+#include "voicepool.h"
+#include "mem.h"
+
+static const char *_stealNames[VOICE_STEAL_COUNT] = {
+    "oldest", "quietest", "retrigger"
+};
+
+void vpool_init(VoicePool * vp)
+{
+    vp->numPlaying = 0;
+    vp->numFree = MAX_VOICES;
+    vp->numStarted = 0;
+    vp->window = NULL;
+
+    // Hand out low slots first.
+    for (int i = 0; i < MAX_VOICES; ++i) {
+        vp->free[i] = MAX_VOICES - 1 - i;
+        stream_register(&vp->stream[i]);
+    }
+}
+
+void vpool_alloc_windows(VoicePool * vp)
+{
+    if (vp->window != NULL) {
+        return;
+    }
+
+    // Touch every page here rather than in the audio thread.
+    size_t size = 2 * MAX_VOICES * VOICE_WINDOW_FRAMES * sizeof(int16_t);
+    int16_t *window = malloc_exit(size);
+    memset(window, 0, size);
+    vp->window = window;
+}
+
+const char *vpool_steal_name(int policy)
+{
+    if (policy < 0 || policy >= VOICE_STEAL_COUNT) {
+        return "unknown";
+    }
+    return _stealNames[policy];
+}
+
+int vpool_steal_parse(const char *name)
+{
+    for (int i = 0; i < VOICE_STEAL_COUNT; ++i) {
+        if (strcmp(name, _stealNames[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int vpool_victim(const VoicePool * vp, const Instrument * inst, int policy,
+                 int key, bool sameKey)
+{
+    // Retriggering steals the oldest voice on the key, falling back to the
+    // oldest voice.
+    if (policy == VOICE_STEAL_RETRIGGER) {
+        int i = vpool_victim(vp, inst, VOICE_STEAL_OLDEST, key, true);
+        if (i >= 0 || sameKey) {
+            return i;
+        }
+        policy = VOICE_STEAL_OLDEST;
+    }
+
+    int best = -1;
+    for (int i = 0; i < vp->numPlaying; ++i) {
+        int v = vp->playing[i];
+        if (vp->stolen[v] || vp->inst[v] != inst ||
+            (sameKey && vp->key[v] != key)) {
+            continue;
+        }
+        if (best < 0) {
+            best = i;
+            continue;
+        }
+        int b = vp->playing[best];
+        if (policy == VOICE_STEAL_QUIETEST ? vp->amp[v] < vp->amp[b] :
+            vp->started[v] < vp->started[b]) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+int vpool_oldest(const VoicePool * vp)
+{
+    int best = -1;
+    for (int i = 0; i < vp->numPlaying; ++i) {
+        if (best < 0 || vp->started[vp->playing[i]] <
+            vp->started[vp->playing[best]]) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+int vpool_key_count(const VoicePool * vp, const Instrument * inst, int key)
+{
+    int count = 0;
+    for (int i = 0; i < vp->numPlaying; ++i) {
+        int v = vp->playing[i];
+        if (vp->key[v] == key && vp->inst[v] == inst && !vp->stolen[v]) {
+            ++count;
+        }
+    }
+    return count;
+}
@@ -0,0 +1,123 @@
+#ifndef VOICEPOOL_H_
+#define VOICEPOOL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "global.h"
+#include "sample.h"
+#include "stream.h"
+#include "instrument.h"
+
+// Voice stealing policies, selected per instrument with the VoiceSteal key in
+// config.conf.
+#define VOICE_STEAL_OLDEST 0    // The voice started first.
+#define VOICE_STEAL_QUIETEST 1  // The voice with the lowest amplification.
+#define VOICE_STEAL_RETRIGGER 2 // The oldest voice on the same key, if any.
+#define VOICE_STEAL_COUNT 3
+
+#define VOICE_STEAL_TAU 0.5     // Fade time constant of stolen voices, ms.
+
+// Blocks of packed samples each voice keeps decoded, from the block holding
+// the first frame it reads.
+#define VOICE_WINDOW_BLOCKS 2
+#define VOICE_WINDOW_FRAMES (VOICE_WINDOW_BLOCKS * SPACK_BLOCK)
+
+// VoicePool: The playing samples, in structure-of-arrays layout. Each voice
+// has a fixed slot, so its stream state never moves. Playing slots are kept
+// packed at the start of playing, and free slots on a stack. The pool is
+// only used by the audio thread.
+typedef struct {
+    int numPlaying;
+    int playing[MAX_VOICES];    // Slots of playing voices.
+    int numFree;
+    int free[MAX_VOICES];       // Free slots.
+    uint64_t numStarted;        // Voices started so far, for voice age.
+
+    // Per-slot voice state.
+    Instrument *inst[MAX_VOICES];       // The instrument sample is from.
+    int channel[MAX_VOICES];            // The midi channel that started it.
+    int key[MAX_VOICES];                // The key (midi-note) being played.
+    Sample *sample[MAX_VOICES];         // The sample being played.
+    double idx[MAX_VOICES];             // The current playback position.
+    mix_t amp[MAX_VOICES];              // The current amplification.
+    double pan[MAX_VOICES];             // The current pan: -1=left, 1=right.
+    mix_t fadeInAmp[MAX_VOICES];        // Fade in amplitude, from 1 to 0.
+    uint64_t started[MAX_VOICES];       // numStarted when started.
+    bool stolen[MAX_VOICES];            // Fading out to free the voice.
+    StreamVoice stream[MAX_VOICES];     // Disk streaming state.
+
+    // Decoded blocks of packed samples, VOICE_WINDOW_FRAMES per slot. NULL
+    // until a packed instrument is loaded.
+    int16_t *window;
+    int winBlock[MAX_VOICES];           // The first block in the window.
+    int winBlocks[MAX_VOICES];          // Blocks decoded, 0 if none.
+} VoicePool;
+
+// vpool_init: Initialize the pool with every slot free, and register each
+// slot's stream state.
+void vpool_init(VoicePool * vp);
+
+// vpool_alloc_windows: Allocate the decode windows for packed samples, if they
+// aren't already. Called by a loader before a packed instrument is used.
+void vpool_alloc_windows(VoicePool * vp);
+
+// vpool_window: Return the decode window of slot v.
+static inline int16_t *vpool_window(VoicePool * vp, int v)
+{
+    return vp->window + 2 * v * VOICE_WINDOW_FRAMES;
+}
+
+// vpool_steal_name: Return the config name of a voice stealing policy.
+const char *vpool_steal_name(int policy);
+
+// vpool_steal_parse: Return the policy with the given name, or -1.
+int vpool_steal_parse(const char *name);
+
+// vpool_victim: Return the index in playing of the voice of inst to steal for
+// a new note on key, or -1 if there is none. Voices that are already stolen
+// aren't candidates. If sameKey is true, only voices playing key are
+// candidates.
+int vpool_victim(const VoicePool * vp, const Instrument * inst, int policy,
+                 int key, bool sameKey);
+
+// vpool_oldest: Return the index in playing of the oldest voice, stolen or
+// not, or -1 if nothing is playing.
+int vpool_oldest(const VoicePool * vp);
+
+// vpool_key_count: Return the number of voices of inst playing key that
+// aren't stolen.
+int vpool_key_count(const VoicePool * vp, const Instrument * inst, int key);
+
+// vpool_start: Return a free slot, added to the end of the playing slots. If
+// there are no free slots, returns -1.
+static inline int vpool_start(VoicePool * vp)
+{
+    if (vp->numFree == 0) {
+        return -1;
+    }
+    int v = vp->free[--vp->numFree];
+    vp->playing[vp->numPlaying++] = v;
+    vp->started[v] = vp->numStarted++;
+    vp->stolen[v] = false;
+    vp->winBlocks[v] = 0;
+    return v;
+}
+
+// vpool_steal: Mark the i-th playing voice as stolen. It keeps playing while
+// it fades out.
+static inline void vpool_steal(VoicePool * vp, int i)
+{
+    vp->stolen[vp->playing[i]] = true;
+}
+
+// vpool_stop: Free the i-th playing slot. The last playing slot is moved to
+// index i.
+static inline void vpool_stop(VoicePool * vp, int i)
+{
+    int v = vp->playing[i];
+    stream_voice_stop(&vp->stream[v]);
+    vp->playing[i] = vp->playing[--vp->numPlaying];
+    vp->free[vp->numFree++] = v;
+}
+
+#endif                          // VOICEPOOL_H_